@@ -1,3 +1,16 @@
-D:\softwares\VulkanSDK\1.1.130.0\Bin32\glslc.exe shader.vert -o vert.spv
-D:\softwares\VulkanSDK\1.1.130.0\Bin32\glslc.exe shader.frag -o frag.spv
-pause
\ No newline at end of file
+@echo off
+rem Compile the shaders into the SPIR-V binaries the application loads from the shaders directory
+set GLSLC=D:\softwares\VulkanSDK\1.1.130.0\Bin32\glslc.exe
+if defined VULKAN_SDK set GLSLC=%VULKAN_SDK%\Bin\glslc.exe
+if not exist shaders mkdir shaders
+"%GLSLC%" shader.vert -o shaders\vert.spv || goto failed
+"%GLSLC%" depth.vert -o shaders\depth.spv || goto failed
+"%GLSLC%" shader.frag -o shaders\frag.spv || goto failed
+"%GLSLC%" -DBINDLESS shader.frag -o shaders\frag_bindless.spv || goto failed
+"%GLSLC%" cull.comp -o shaders\cull.spv || goto failed
+pause
+exit /b 0
+:failed
+echo failed to compile the shaders!
+pause
+exit /b 1
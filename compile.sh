@@ -0,0 +1,18 @@
+#!/bin/sh
+# Compile the shaders into the SPIR-V binaries the application loads from the shaders directory
+# glslc is taken from GLSLC when set, then from the Vulkan SDK when VULKAN_SDK is set, and from the path otherwise
+set -e
+cd "$(dirname "$0")"
+if [ -z "$GLSLC" ]; then
+	if [ -n "$VULKAN_SDK" ]; then
+		GLSLC="$VULKAN_SDK/bin/glslc"
+	else
+		GLSLC=glslc
+	fi
+fi
+mkdir -p shaders
+"$GLSLC" shader.vert -o shaders/vert.spv
+"$GLSLC" depth.vert -o shaders/depth.spv
+"$GLSLC" shader.frag -o shaders/frag.spv
+"$GLSLC" -DBINDLESS shader.frag -o shaders/frag_bindless.spv
+"$GLSLC" cull.comp -o shaders/cull.spv
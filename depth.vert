@@ -0,0 +1,55 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Position only vertex shader of the depth pre-pass
+// Computes the position exactly as shader.vert does, so that the lit pass can test for equal depth
+
+// Uniform for Model, View and Projection matrices
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+// Per object data
+struct ObjectData {
+    mat4 model;
+    vec4 tint;
+    vec4 boundingSphere;
+    uint meshIndex;
+    uint materialIndex;
+};
+
+// Storage buffer with the data of every scene object
+layout(std430, binding = 3) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+// Order the objects are drawn in, mapping the instance index of the draws to the object index
+layout(std430, binding = 7) readonly buffer DrawOrderBuffer {
+    uint objectIndices[];
+} drawOrder;
+
+// Transform of the object being drawn, pushed before the draw when every object is drawn on its own
+layout(push_constant) uniform DrawConstants {
+    mat4 model;
+    vec4 tint;
+    uint materialIndex;
+} draw;
+
+// Source of the object data, compiled into the pipeline: the push constants or the object buffer
+layout(constant_id = 0) const bool pushConstantDraws = false;
+
+// Position of the vertex, the only attribute read
+layout(location = 0) in vec3 inPosition;
+
+invariant gl_Position;
+
+// Main function
+void main() {
+	uint objectIndex = drawOrder.objectIndices[gl_InstanceIndex];
+	mat4 modelMatrix = ubo.model * (pushConstantDraws ? draw.model : objectBuffer.objects[objectIndex].model);
+
+	vec4 VCS_position =  ubo.view * modelMatrix * vec4(inPosition,  1.0);
+    gl_Position = ubo.proj *VCS_position;
+}
@@ -20,9 +20,31 @@
 #include <fstream> // Provides functions to read/write a file
 #include <string> // String related function
 #include <array>
+#include <deque> // Provides deque used by the deferred deletion queue
+#include <random> // Random placement of the flock
+#include <cmath> // Provides sqrt and ceil
+#include <cfloat> // Provides FLT_MAX and DBL_MAX
+#include <chrono> // Clock used by the frame pacer and the latency measurement
+#include <thread> // Provides sleep_until used by the frame pacer, the image writer threads and the worker pool
+#include <mutex> // Guards the job queue of the image writer
+#include <condition_variable> // Wakes the image writer threads
+#include <atomic> // Counters shared with the image writer threads
+#include <memory> // Provides unique_ptr
+#include <map> // Rolling statistics of the profiler scopes
+#include <iomanip> // Formatting of the profiler statistics table
+#include <cstdio> // Provides rename used to replace the metrics file
+#include <filesystem> // Modification times of the shader sources and binaries
 #include <glm\glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+// The software rasterizer and the image comparison process 4 pixels at a time with SSE2 when the compiler targets it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
+
 // Vec3
 struct Vec3
 {
@@ -103,6 +125,160 @@ struct LightingConstants
 	float specularEnabled = 1;
 	float DiffuseEnabled = 1;
 	float textureEnabled = 1;
+
+	// Light position in view space, written every frame for the fragment shader
+	glm::vec4 viewLightPosition;
+
+	// Cluster grid of the point lights: tiles across and down the screen, depth slices and the no of point lights
+	glm::uvec4 clusterGrid;
+
+	// Tiles per pixel across and down the screen, and the scale and bias from the log of the view depth to the depth slice
+	glm::vec4 clusterScale;
+
+	// Matrix from view space to the texture coordinates and depth of the shadow map
+	glm::mat4 shadowMatrix;
+
+	// 1 when the shadow map is sampled in x, and the size of a texel of the shadow map in y
+	glm::vec4 shadowParams;
+};
+
+// Distances to the near and far planes of the projection
+const float nearPlaneDistance = 0.1f;
+const float farPlaneDistance = 1000.0f;
+
+// Point light of the clustered lighting
+struct PointLight
+{
+	// Position in xyz and radius of influence in w. In view space when uploaded
+	glm::vec4 position;
+
+	// Colour in rgb
+	glm::vec4 colour;
+};
+
+// Dimensions of the cluster grid over the view frustum, matching shader.frag
+const uint32_t clusterTilesX = 16;
+const uint32_t clusterTilesY = 9;
+const uint32_t clusterSlices = 24;
+const uint32_t clusterCount = clusterTilesX * clusterTilesY * clusterSlices;
+
+// Most point lights, and most light indices over all clusters
+const uint32_t maxPointLights = 4096;
+const uint32_t maxClusterLightIndices = 256 * 1024;
+
+// Offsets of the cluster ranges and the light indices in the storage buffer of the lights, after the lights and the ranges, and its size
+const VkDeviceSize clusterRangesOffset = maxPointLights * sizeof(PointLight);
+const VkDeviceSize clusterIndicesOffset = clusterRangesOffset + clusterCount * 2 * sizeof(uint32_t);
+const VkDeviceSize clusterBufferSize = clusterIndicesOffset + maxClusterLightIndices * sizeof(uint32_t);
+
+// Assigns point lights to the clusters of the view frustum they can light
+// A light is added to every cluster of the depth slices its sphere spans whose tile overlaps the screen bounds of the sphere.
+// The bounds are those of the box around the sphere, which is conservative but cheap
+class LightClusterBuilder
+{
+public:
+	// Lights transformed to view space
+	std::vector<PointLight> viewLights;
+
+	// Offset into the light indices and no of lights of every cluster, ordered by tile across, tile down and then depth slice
+	std::vector<uint32_t> ranges;
+
+	// Indices of the lights of the clusters
+	std::vector<uint32_t> indices;
+
+	// Function to compute the scale and bias from the log of the view depth to the depth slice
+	static glm::vec2 sliceScaleBias() {
+		float scale = clusterSlices / std::log(farPlaneDistance / nearPlaneDistance);
+		return glm::vec2(scale, -std::log(nearPlaneDistance) * scale);
+	}
+
+	// Function to bin the lights with the view and projection matrices of the frame
+	// Only the first count lights are binned
+	void build(const std::vector<PointLight>& lights, uint32_t count, const glm::mat4& view, const glm::mat4& proj) {
+		viewLights.resize(count);
+		std::vector<uint32_t> counts(clusterCount, 0);
+		std::vector<std::array<uint32_t, 6>> bounds(count);
+		glm::vec2 slice = sliceScaleBias();
+
+		// Clusters spanned by every light: first and last tile across and down and first and last slice
+		for (uint32_t i = 0; i < count; i++) {
+			glm::vec4 centre = view * glm::vec4(lights[i].position.x, lights[i].position.y, lights[i].position.z, 1.0f);
+			float radius = lights[i].position.w;
+			viewLights[i].position = glm::vec4(centre.x, centre.y, centre.z, radius);
+			viewLights[i].colour = lights[i].colour;
+
+			// The camera looks down the negative z axis
+			float nearest = -centre.z - radius;
+			float farthest = -centre.z + radius;
+			if (farthest < nearPlaneDistance || nearest > farPlaneDistance) {
+				bounds[i] = { 1, 0, 1, 0, 1, 0 };
+				continue;
+			}
+			auto sliceOf = [&](float depth) {
+				float index = std::log(std::max(depth, nearPlaneDistance)) * slice.x + slice.y;
+				return static_cast<uint32_t>(std::min(std::max(index, 0.0f), clusterSlices - 1.0f));
+			};
+
+			// A sphere crossing the near plane may cover the whole screen
+			float minimumX = -1.0f, maximumX = 1.0f, minimumY = -1.0f, maximumY = 1.0f;
+			if (nearest > nearPlaneDistance) {
+				minimumX = minimumY = FLT_MAX;
+				maximumX = maximumY = -FLT_MAX;
+				for (float depth : { nearest, farthest }) {
+					for (float sign : { -1.0f, 1.0f }) {
+						float x = proj[0][0] * (centre.x + sign * radius) / depth;
+						float y = proj[1][1] * (centre.y + sign * radius) / depth;
+						minimumX = std::min(minimumX, x);
+						maximumX = std::max(maximumX, x);
+						minimumY = std::min(minimumY, y);
+						maximumY = std::max(maximumY, y);
+					}
+				}
+				if (maximumX < -1.0f || minimumX > 1.0f || maximumY < -1.0f || minimumY > 1.0f) {
+					bounds[i] = { 1, 0, 1, 0, 1, 0 };
+					continue;
+				}
+			}
+			auto tileOf = [](float ndc, uint32_t tiles) {
+				return static_cast<uint32_t>(std::min(std::max((ndc + 1.0f) * 0.5f * tiles, 0.0f), tiles - 1.0f));
+			};
+			bounds[i] = { tileOf(minimumX, clusterTilesX), tileOf(maximumX, clusterTilesX), tileOf(minimumY, clusterTilesY), tileOf(maximumY, clusterTilesY), sliceOf(nearest), sliceOf(farthest) };
+
+			forEachCluster(bounds[i], [&](uint32_t cluster) { counts[cluster]++; });
+		}
+
+		// Offsets of the clusters into the indices, then the indices of the lights of every cluster
+		ranges.resize(clusterCount * 2);
+		uint32_t offset = 0;
+		for (uint32_t cluster = 0; cluster < clusterCount; cluster++) {
+			uint32_t count = std::min(counts[cluster], maxClusterLightIndices - offset);
+			ranges[cluster * 2] = offset;
+			ranges[cluster * 2 + 1] = 0;
+			counts[cluster] = count;
+			offset += count;
+		}
+		indices.resize(offset);
+		for (uint32_t i = 0; i < count; i++) {
+			forEachCluster(bounds[i], [&](uint32_t cluster) {
+				if (ranges[cluster * 2 + 1] < counts[cluster]) {
+					indices[ranges[cluster * 2] + ranges[cluster * 2 + 1]++] = i;
+				}
+			});
+		}
+	}
+
+private:
+	// Function to run a function for every cluster within bounds of first and last tile across, tile down and slice
+	template <typename Function>
+	static void forEachCluster(const std::array<uint32_t, 6>& bounds, Function function) {
+		for (uint32_t z = bounds[4]; z <= bounds[5]; z++) {
+			for (uint32_t y = bounds[2]; y <= bounds[3]; y++) {
+				for (uint32_t x = bounds[0]; x <= bounds[1]; x++) {
+					function(x + clusterTilesX * (y + clusterTilesY * z));
+				}
+			}
+		}
+	}
 };
 
 // Mesh
@@ -118,21 +294,2958 @@ struct Mesh
 	LightingConstants lightingConstants;
 };
 
-// Maximum no of frames processed concurrently
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// Range of a mesh inside the shared vertex and index buffers
+struct MeshRange
+{
+	// First index of the mesh in the shared index buffer
+	uint32_t firstIndex;
 
-// Width and Height of the Window
-const int WIDTH = 800;
-const int HEIGHT = 600;
+	// No of indices of the mesh
+	uint32_t indexCount;
 
-// Validation layers to be enabled
-const std::vector<const char*> validationLayers = {
-	"VK_LAYER_KHRONOS_validation"
+	// Offset added to the indices to address the vertices of the mesh in the shared vertex buffer
+	int32_t vertexOffset;
+
+	// Bounding sphere of the mesh - centre in xyz and radius in w
+	glm::vec4 boundingSphere;
 };
 
-// Device extensions to be enabled
-const std::vector<const char*> deviceExtensions = {
-	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+// Per object data read by the vertex shader from the object storage buffer
+struct ObjectData
+{
+	glm::mat4 model;
+
+	// Per instance material override multiplied with the vertex colour
+	glm::vec4 tint;
+
+	// Bounding sphere of the mesh of the object, used by the culling compute shader
+	glm::vec4 boundingSphere;
+
+	// Index of the mesh of the object, used to look up the draw of the mesh
+	uint32_t meshIndex;
+
+	// Index of the material of the object in the material buffer of the bindless descriptors
+	uint32_t materialIndex;
+
+	// Padding to match the std430 layout of the structure in the shaders
+	uint32_t padding[2];
+};
+
+// Material read by the fragment shader from the material storage buffer of the bindless descriptors
+struct MaterialData
+{
+	// Index of the texture of the material in the bindless texture array
+	uint32_t textureIndex;
+
+	// Padding to match the std430 layout of the structure in the shaders
+	uint32_t padding[3];
+};
+
+// Most textures in the bindless texture array, lowered to the descriptor limits of the device
+const uint32_t maxBindlessTextures = 1024;
+
+// Per draw data pushed as push constants when every object is drawn on its own
+struct DrawConstants
+{
+	// Placement of the object in the scene
+	glm::mat4 model;
+
+	// Material override of the object multiplied with the vertex colour
+	glm::vec4 tint;
+
+	// Index of the material of the object
+	uint32_t materialIndex;
+};
+
+// Object placed in the scene
+struct SceneObject
+{
+	// Index of the mesh drawn for the object
+	uint32_t meshIndex;
+
+	// Placement of the object in the scene
+	glm::mat4 model;
+
+	// Material override of the object
+	glm::vec4 tint;
+};
+
+// Presentation policies selectable from the command line
+enum class PresentPolicy
+{
+	// Present immediately, tearing allowed. Falls back to mailbox and then vsync
+	Uncapped,
+
+	// Wait for the vertical blank. Always supported
+	Vsync,
+
+	// Wait for the vertical blank unless the frame is late. Falls back to vsync
+	Relaxed,
+
+	// Replace the queued image with the newest one without tearing. Falls back to vsync
+	Mailbox
+};
+
+// Ways to generate the mip levels of the texture selectable from the command line
+enum class MipmapGeneration
+{
+	// Blit on the GPU when the texture format supports linear blits, otherwise filter on the CPU
+	Auto,
+
+	// Blit every level from the previous one on the GPU. Falls back to the CPU when the format does not support linear blits
+	Gpu,
+
+	// Filter the levels on the CPU and upload them with the base level
+	Cpu,
+
+	// Single level texture
+	Off
+};
+
+// Block compressed formats the texture can be stored in, selectable from the command line
+enum class TextureCompression
+{
+	// Best format the device can sample: BC7, then ETC2, then uncompressed
+	Auto,
+
+	// 8 bytes per block of opaque colour
+	Bc1,
+
+	// 16 bytes per block, a BC1 colour block and an interpolated alpha block
+	Bc3,
+
+	// 16 bytes per block of colour and alpha with 4 bit indices (mode 6 only)
+	Bc7,
+
+	// 8 bytes per block of opaque colour, for devices without BC support (ETC1 compatible blocks)
+	Etc2,
+
+	// Uncompressed RGBA
+	Off
+};
+
+// Running statistics of latency samples in milliseconds
+struct LatencyStats
+{
+	uint64_t count = 0;
+	double total = 0.0;
+	double minimum = DBL_MAX;
+	double maximum = 0.0;
+
+	// Function to add a sample
+	void add(double milliseconds) {
+		count++;
+		total += milliseconds;
+		minimum = std::min(minimum, milliseconds);
+		maximum = std::max(maximum, milliseconds);
+	}
+
+	// Function to get the average of the samples
+	double mean() const {
+		return count > 0 ? total / count : 0.0;
+	}
+};
+
+// Summary of frame time samples in milliseconds
+struct FrameTimeSummary
+{
+	size_t count = 0;
+	double mean = 0.0;
+	double variance = 0.0;
+	double minimum = 0.0;
+	double maximum = 0.0;
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+};
+
+// Function to summarize frame time samples
+// Percentiles use the nearest rank of the sorted samples. The variance is the population variance
+FrameTimeSummary summarizeFrameTimes(std::vector<double> samples) {
+	FrameTimeSummary summary;
+	if (samples.empty()) {
+		return summary;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	summary.count = samples.size();
+	summary.minimum = samples.front();
+	summary.maximum = samples.back();
+
+	double total = 0.0;
+	for (double sample : samples) {
+		total += sample;
+	}
+	summary.mean = total / samples.size();
+
+	double squaredDifferences = 0.0;
+	for (double sample : samples) {
+		squaredDifferences += (sample - summary.mean) * (sample - summary.mean);
+	}
+	summary.variance = squaredDifferences / samples.size();
+
+	auto percentile = [&samples](double fraction) {
+		size_t rank = static_cast<size_t>(std::ceil(fraction * samples.size()));
+		return samples[std::min(samples.size() - 1, rank > 0 ? rank - 1 : 0)];
+	};
+	summary.p50 = percentile(0.50);
+	summary.p95 = percentile(0.95);
+	summary.p99 = percentile(0.99);
+
+	return summary;
+}
+
+// Controller of the resolution scale of dynamic resolution, fed with the GPU frame times
+// The GPU time of a frame falls roughly with the no of pixels, the square of the scale, so the scale follows the square root of the time ratio
+// The scale moves in steps and holds after every move until the frames rendered at the new scale are measured
+class ResolutionController
+{
+public:
+	// Function to start at full resolution with a target GPU frame time, the lowest scale and the no of frames measured late
+	void reset(double targetMilliseconds, float minimumScale, uint32_t latencyFrames) {
+		target = targetMilliseconds;
+		minimum = minimumScale;
+		latency = latencyFrames;
+		current = 1.0f;
+		smoothed = 0.0;
+		holdFrames = 0;
+	}
+
+	// Function to feed the GPU time of a completed frame
+	void update(double gpuMilliseconds) {
+		if (holdFrames > 0) {
+			holdFrames--;
+			return;
+		}
+		smoothed = smoothed == 0.0 ? gpuMilliseconds : smoothed + 0.2 * (gpuMilliseconds - smoothed);
+
+		// Aim a little under the target and leave the scale alone while the time is between the aim and the target
+		double aim = 0.9 * target;
+		if (smoothed <= target && (smoothed >= 0.8 * aim || current >= 1.0f)) {
+			return;
+		}
+
+		float desired = current * static_cast<float>(std::sqrt(aim / smoothed));
+		desired = std::round(desired / scaleStep) * scaleStep;
+		desired = std::min(1.0f, std::max(minimum, desired));
+		if (desired != current) {
+			current = desired;
+			smoothed = 0.0;
+			holdFrames = latency;
+		}
+	}
+
+	// Function to get the scale of the width and height
+	float scale() const {
+		return current;
+	}
+
+	// Function to get the extent rendered at the current scale of a full extent
+	VkExtent2D extent(VkExtent2D full) const {
+		return { std::max(1u, static_cast<uint32_t>(full.width * current)), std::max(1u, static_cast<uint32_t>(full.height * current)) };
+	}
+
+private:
+	// Steps the scale moves in
+	static constexpr float scaleStep = 0.05f;
+
+	double target = 16.0;
+	float minimum = 0.5f;
+	uint32_t latency = 0;
+	float current = 1.0f;
+	double smoothed = 0.0;
+	uint32_t holdFrames = 0;
+};
+
+// Settings of the application, parsed from the command line
+struct AppSettings
+{
+	// No of copies of each loaded mesh placed in the scene
+	uint32_t instanceCount = 1;
+
+	// Flag to draw the copies of a mesh with a single instanced draw instead of one draw per copy
+	bool instancing = true;
+
+	// Flag to cull the scene objects against the view frustum in a compute pass before drawing
+	bool gpuCulling = true;
+
+	// Flag to compare the no of draws produced by the culling pass with a CPU reference
+	bool verifyCulling = false;
+
+	// Flag to index the textures of the materials from one descriptor array when the device supports descriptor indexing
+	bool bindless = true;
+
+	// Presentation policy of the swap chain
+	PresentPolicy presentPolicy = PresentPolicy::Mailbox;
+
+	// Max no of frames per second enforced by the frame pacer, 0 for no cap
+	double frameRateCap = 0.0;
+
+	// Requested no of swap chain images, 0 for one more than the minimum of the surface
+	uint32_t swapChainImageCount = 0;
+
+	// Requested no of samples per pixel of the colour and depth attachments, lowered to what the device supports
+	uint32_t sampleCount = 1;
+
+	// Flag to render at a resolution scaled every frame to keep the GPU frame time on target, upscaled into the swap chain image
+	bool dynamicResolution = false;
+
+	// Frame rate dynamic resolution aims for, and the lowest scale of the width and height it renders at
+	double dynamicResolutionTargetFps = 60.0;
+	float minimumResolutionScale = 0.5f;
+
+	// Flag to render into offscreen images without a window, surface or swap chain
+	bool headless = false;
+
+	// No of frames to render before exiting, 0 to run until the window is closed
+	uint64_t frameCount = 0;
+
+	// Width and Height of the Window or of the offscreen images
+	uint32_t width = 800;
+	uint32_t height = 600;
+
+	// Path of the exported frames, with a run of '#' replaced by the frame no. Empty to export nothing
+	// Frames are written as PNG when the path ends in .png and as PPM otherwise
+	std::string exportPath;
+
+	// No of threads encoding and writing the exported frames
+	uint32_t writerThreadCount = 2;
+
+	// Flag to replay the scripted camera and light path and report frame time statistics
+	bool benchmark = false;
+
+	// No of frames at the start of the benchmark left out of the statistics
+	uint32_t benchmarkWarmupFrames = 10;
+
+	// Path of the JSON file the benchmark results are written to
+	std::string benchmarkOutputPath = "benchmark.json";
+
+	// Flag to measure the GPU time of the passes and draw groups with timestamp queries
+	bool gpuProfiling = false;
+
+	// Path of the Chrome trace of the GPU scopes. Empty to write no trace
+	std::string gpuTracePath;
+
+	// Path of the Chrome trace of the CPU scopes merged with the GPU scopes. Empty to trace nothing
+	std::string cpuTracePath;
+
+	// Path of the text file the metrics registry is written to. Empty to write no metrics
+	std::string metricsPath;
+
+	// No of frames between two writes of the metrics file
+	uint32_t metricsIntervalFrames = 60;
+
+	// Flag to render on the CPU with the software rasterizer instead of Vulkan
+	bool software = false;
+
+	// No of threads of the software rasterizer. 0 uses every hardware thread
+	uint32_t softwareThreadCount = 0;
+
+	// Part of the name of the GPU to use, e.g. llvmpipe for lavapipe. Empty to use the first suitable GPU
+	std::string deviceName;
+
+	// Directory of the golden images the canonical views are compared with. Empty to run no golden image check
+	std::string goldenDirectory;
+
+	// Flag to write the rendered canonical views as the new golden images instead of comparing them
+	bool goldenUpdate = false;
+
+	// Directory the rendered image and the diff image of a failed view are written to
+	std::string goldenDiffDirectory = ".";
+
+	// Largest difference of a colour channel that is not counted as a differing pixel
+	uint32_t goldenTolerance = 3;
+
+	// Largest fraction of differing pixels and smallest structural similarity with which a view passes
+	double goldenMaxDifferingPixels = 0.001;
+	double goldenMinSsim = 0.98;
+
+	// Generation of the mip levels of the texture
+	MipmapGeneration mipmapGeneration = MipmapGeneration::Auto;
+
+	// Block compressed format of the texture
+	TextureCompression textureCompression = TextureCompression::Auto;
+
+	// Path of the file the pipeline cache is loaded from and saved to. Empty to keep the cache in memory only
+	std::string pipelineCachePath = "pipeline_cache.bin";
+
+	// Flag to draw every object on its own with its transform and tint in push constants instead of the object buffer
+	bool pushConstantDraws = false;
+
+	// Flag to lay down the depth of the scene in a depth only pass, so that the lit pass shades only the visible fragments
+	bool depthPrepass = false;
+
+	// Flag to sort the objects of every mesh front to back by view depth every frame
+	bool sortDraws = true;
+
+	// Flag to cast shadows from the light with a shadow map, rendered again only when the light or the scene moves
+	bool shadows = true;
+
+	// Width and height of the shadow map in texels
+	uint32_t shadowMapSize = 2048;
+
+	// No of point lights placed around the flock and lit with clustered forward lighting
+	uint32_t pointLightCount = 0;
+
+	// Flag to run the benchmark once for every power of two no of point lights, from 1 to the most point lights
+	bool lightSweep = false;
+
+	// No of frames of every step of the light sweep
+	uint64_t lightSweepStepFrames = 0;
+};
+
+// No of steps of the light sweep, one for every power of two up to the most point lights
+const uint32_t lightSweepSteps = 13;
+
+// Function to compute a bounding sphere enclosing the vertices
+// Returns the centre of the bounding box in xyz and the distance to the farthest vertex in w
+glm::vec4 computeBoundingSphere(const std::vector<Vertex>& vertices) {
+	if (vertices.empty()) {
+		return glm::vec4(0.0f);
+	}
+
+	glm::vec3 minimum(vertices[0].position.x, vertices[0].position.y, vertices[0].position.z);
+	glm::vec3 maximum = minimum;
+	for (const auto& vertex : vertices) {
+		glm::vec3 position(vertex.position.x, vertex.position.y, vertex.position.z);
+		minimum = glm::min(minimum, position);
+		maximum = glm::max(maximum, position);
+	}
+
+	glm::vec3 centre = (minimum + maximum) * 0.5f;
+	float radius = 0.0f;
+	for (const auto& vertex : vertices) {
+		radius = std::max(radius, glm::length(glm::vec3(vertex.position.x, vertex.position.y, vertex.position.z) - centre));
+	}
+
+	return glm::vec4(centre, radius);
+}
+
+// Function to extract the view frustum planes from a view projection matrix
+// Planes are left, right, bottom, top, near and far with normals pointing into the frustum. Depth range is zero to one
+void extractFrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6]) {
+	// Rows of the matrix. glm matrices are column major
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[2];
+	planes[5] = rows[3] - rows[2];
+}
+
+// Function to find the smallest signed distance of a sphere to the frustum planes, relative to its radius
+// The sphere is outside the frustum when the value is negative
+float sphereFrustumDistance(const glm::vec4 planes[6], const glm::vec3& centre, float radius) {
+	float distance = FLT_MAX;
+	for (int i = 0; i < 6; i++) {
+		glm::vec3 normal(planes[i]);
+		distance = std::min(distance, glm::dot(normal, centre) + planes[i].w + radius * glm::length(normal));
+	}
+	return distance;
+}
+
+// Event of a Chrome trace
+struct TraceEvent
+{
+	std::string name;
+
+	// Category and thread the event is shown under
+	std::string category;
+	std::string thread;
+
+	// Start and duration in nanoseconds
+	uint64_t startNanoseconds;
+	uint64_t durationNanoseconds;
+};
+
+// Function to write events as a Chrome trace, viewable in chrome://tracing or Perfetto
+// Timestamps are written in microseconds from the earliest event
+void writeChromeTrace(const std::string& path, const std::vector<TraceEvent>& events) {
+	std::ofstream file(path);
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to open trace file!");
+	}
+
+	uint64_t origin = UINT64_MAX;
+	for (const auto& event : events) {
+		origin = std::min(origin, event.startNanoseconds);
+	}
+
+	file << std::fixed << std::setprecision(3);
+	file << "{\"traceEvents\":[\n";
+	for (size_t i = 0; i < events.size(); i++) {
+		const TraceEvent& event = events[i];
+		file << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":\"" << event.thread
+			<< "\",\"ts\":" << (event.startNanoseconds - origin) / 1000.0 << ",\"dur\":" << event.durationNanoseconds / 1000.0 << "}" << (i + 1 < events.size() ? ",\n" : "\n");
+	}
+	file << "],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+// Function to get the current time in nanoseconds of the steady clock, the time base of the traces
+uint64_t steadyClockNanoseconds() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// CPU tracing is compiled in unless CPU_TRACING is defined as 0, which removes the trace scopes entirely
+#ifndef CPU_TRACING
+#define CPU_TRACING 1
+#endif
+
+#if CPU_TRACING
+// Scope recorded by the CPU tracer
+struct CpuTraceEvent
+{
+	// Name of the scope. Must be a string literal, as only the pointer is stored
+	const char* name;
+
+	// Start and end in nanoseconds of the steady clock
+	uint64_t startNanoseconds;
+	uint64_t endNanoseconds;
+};
+
+// Ring of the trace events of one thread
+// Only the owning thread writes. It publishes each event by advancing the head, overwriting the oldest event when full
+struct CpuTraceBuffer
+{
+	static const size_t capacity = 1 << 16;
+
+	std::array<CpuTraceEvent, capacity> events;
+	std::atomic<uint64_t> head{ 0 };
+	uint32_t threadIndex = 0;
+};
+
+// Tracer collecting the scopes of every thread
+// Recording takes no lock. Only the first event of a thread takes a lock to register the buffer of the thread
+class CpuTracer
+{
+public:
+	// Function to get the tracer shared by all threads
+	static CpuTracer& instance() {
+		static CpuTracer tracer;
+		return tracer;
+	}
+
+	// Function to get the current time in nanoseconds of the steady clock
+	static uint64_t now() {
+		return steadyClockNanoseconds();
+	}
+
+	// Function to start recording the scopes
+	void start() {
+		active.store(true, std::memory_order_relaxed);
+	}
+
+	// Function to check whether the scopes are recorded
+	bool isActive() const {
+		return active.load(std::memory_order_relaxed);
+	}
+
+	// Function to record a scope in the buffer of the calling thread
+	void record(const char* name, uint64_t start, uint64_t end) {
+		CpuTraceBuffer& buffer = threadBuffer();
+		uint64_t index = buffer.head.load(std::memory_order_relaxed);
+		buffer.events[index % CpuTraceBuffer::capacity] = { name, start, end };
+		buffer.head.store(index + 1, std::memory_order_release);
+	}
+
+	// Function to get the recorded scopes of every thread as trace events
+	// The threads still recording should be idle, as an event being overwritten may be read torn
+	std::vector<TraceEvent> events() {
+		std::vector<TraceEvent> traceEvents;
+		std::lock_guard<std::mutex> lock(registryMutex);
+		for (const auto& buffer : buffers) {
+			uint64_t head = buffer->head.load(std::memory_order_acquire);
+			uint64_t first = head > CpuTraceBuffer::capacity ? head - CpuTraceBuffer::capacity : 0;
+			for (uint64_t i = first; i < head; i++) {
+				const CpuTraceEvent& event = buffer->events[i % CpuTraceBuffer::capacity];
+				traceEvents.push_back({ event.name, "cpu", buffer->threadIndex == 0 ? "main" : "thread " + std::to_string(buffer->threadIndex), event.startNanoseconds, event.endNanoseconds - event.startNanoseconds });
+			}
+		}
+		return traceEvents;
+	}
+
+private:
+	// Function to get the buffer of the calling thread, registering it on first use
+	CpuTraceBuffer& threadBuffer() {
+		thread_local CpuTraceBuffer* buffer = registerThread();
+		return *buffer;
+	}
+
+	// Function to create the buffer of the calling thread
+	CpuTraceBuffer* registerThread() {
+		std::lock_guard<std::mutex> lock(registryMutex);
+		buffers.emplace_back(new CpuTraceBuffer());
+		buffers.back()->threadIndex = static_cast<uint32_t>(buffers.size() - 1);
+		return buffers.back().get();
+	}
+
+	std::atomic<bool> active{ false };
+	std::mutex registryMutex;
+	std::vector<std::unique_ptr<CpuTraceBuffer>> buffers;
+};
+
+// Scope recording the time from its construction to its destruction when the tracer is active
+class CpuTraceScope
+{
+public:
+	explicit CpuTraceScope(const char* scopeName) : name(scopeName), start(CpuTracer::instance().isActive() ? CpuTracer::now() : 0) {
+	}
+
+	~CpuTraceScope() {
+		if (start != 0) {
+			CpuTracer::instance().record(name, start, CpuTracer::now());
+		}
+	}
+
+	CpuTraceScope(const CpuTraceScope&) = delete;
+	CpuTraceScope& operator=(const CpuTraceScope&) = delete;
+
+private:
+	const char* name;
+	uint64_t start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// Macro to trace the enclosing block
+#define TRACE_SCOPE(name) CpuTraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+// Registry of named counters and gauges, written as a text file in the Prometheus exposition format
+// Labels are part of the name, e.g. vulkan_memory_allocations{heap="0"}
+class MetricsRegistry
+{
+public:
+	// Function to set the value of a gauge
+	void set(const std::string& name, double value) {
+		values[name] = value;
+	}
+
+	// Function to add to the value of a counter
+	void add(const std::string& name, double delta) {
+		values[name] += delta;
+	}
+
+	// Function to write all metrics to the file
+	// The metrics are written to a temporary file first so that a scraper never reads a partial file
+	bool writeTextFile(const std::string& path) const {
+		std::string temporaryPath = path + ".tmp";
+		{
+			std::ofstream file(temporaryPath, std::ios::trunc);
+			if (!file.is_open()) {
+				return false;
+			}
+
+			file << std::setprecision(15);
+			for (const auto& metric : values) {
+				file << metric.first << " " << metric.second << "\n";
+			}
+
+			if (!file.good()) {
+				return false;
+			}
+		}
+
+		// rename does not replace an existing file on Windows
+		std::remove(path.c_str());
+		return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+	}
+
+private:
+	// Values of the metrics by name, sorted so that the file is stable between writes
+	std::map<std::string, double> values;
+};
+
+// Rendered frame waiting to be encoded and written to a file
+struct ImageWriteJob
+{
+	// Path of the file
+	std::string path;
+
+	// Size of the image in pixels
+	uint32_t width;
+	uint32_t height;
+
+	// Flag to indicate that the pixels are stored as BGRA instead of RGBA
+	bool bgra;
+
+	// Pixels with 4 bytes each, rows tightly packed
+	std::vector<uint8_t> pixels;
+};
+
+// Function to convert the 4 byte pixels of an image to tightly packed RGB
+std::vector<uint8_t> toRgb(const ImageWriteJob& job) {
+	std::vector<uint8_t> rgb(static_cast<size_t>(job.width) * job.height * 3);
+	for (size_t i = 0; i < static_cast<size_t>(job.width) * job.height; i++) {
+		rgb[i * 3 + 0] = job.pixels[i * 4 + (job.bgra ? 2 : 0)];
+		rgb[i * 3 + 1] = job.pixels[i * 4 + 1];
+		rgb[i * 3 + 2] = job.pixels[i * 4 + (job.bgra ? 0 : 2)];
+	}
+	return rgb;
+}
+
+// Function to write an image as binary PPM
+bool writePpm(const ImageWriteJob& job) {
+	std::ofstream file(job.path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	std::vector<uint8_t> rgb = toRgb(job);
+	file << "P6\n" << job.width << " " << job.height << "\n255\n";
+	file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+	return file.good();
+}
+
+// Function to compute the CRC-32 of PNG chunks
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+	static const std::array<uint32_t, 256> table = []() {
+		std::array<uint32_t, 256> values = {};
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t value = i;
+			for (int bit = 0; bit < 8; bit++) {
+				value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+			}
+			values[i] = value;
+		}
+		return values;
+	}();
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// Function to write an image as PNG
+// The image data is stored in uncompressed deflate blocks, trading file size for encoding speed
+bool writePng(const ImageWriteJob& job) {
+	std::vector<uint8_t> rgb = toRgb(job);
+
+	// Scanlines, each preceded by filter type 0
+	size_t rowSize = static_cast<size_t>(job.width) * 3;
+	std::vector<uint8_t> scanlines;
+	scanlines.reserve((rowSize + 1) * job.height);
+	for (uint32_t y = 0; y < job.height; y++) {
+		scanlines.push_back(0);
+		scanlines.insert(scanlines.end(), rgb.begin() + y * rowSize, rgb.begin() + (y + 1) * rowSize);
+	}
+
+	// zlib stream of stored blocks of at most 65535 bytes followed by the Adler-32 of the scanlines
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	uint32_t adlerA = 1, adlerB = 0;
+	for (size_t offset = 0; offset < scanlines.size() || offset == 0; offset += 65535) {
+		size_t blockSize = std::min<size_t>(65535, scanlines.size() - offset);
+		bool lastBlock = offset + blockSize >= scanlines.size();
+		zlib.push_back(lastBlock ? 1 : 0);
+		zlib.push_back(blockSize & 0xFF);
+		zlib.push_back((blockSize >> 8) & 0xFF);
+		zlib.push_back(~blockSize & 0xFF);
+		zlib.push_back((~blockSize >> 8) & 0xFF);
+		zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+		if (lastBlock) {
+			break;
+		}
+	}
+	for (uint8_t value : scanlines) {
+		adlerA = (adlerA + value) % 65521;
+		adlerB = (adlerB + adlerA) % 65521;
+	}
+	uint32_t adler = (adlerB << 16) | adlerA;
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		zlib.push_back((adler >> shift) & 0xFF);
+	}
+
+	std::ofstream file(job.path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	// Function to write a chunk with its length and CRC
+	auto writeChunk = [&file](const char* type, const std::vector<uint8_t>& data) {
+		std::vector<uint8_t> chunk(type, type + 4);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+		uint32_t length = static_cast<uint32_t>(data.size());
+		uint32_t crc = crc32(chunk.data(), chunk.size());
+		uint8_t lengthBytes[4] = { uint8_t(length >> 24), uint8_t(length >> 16), uint8_t(length >> 8), uint8_t(length) };
+		uint8_t crcBytes[4] = { uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc) };
+		file.write(reinterpret_cast<const char*>(lengthBytes), 4);
+		file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+		file.write(reinterpret_cast<const char*>(crcBytes), 4);
+	};
+
+	// Header - size, 8 bit depth, RGB colour, default compression, filtering and no interlacing
+	std::vector<uint8_t> header = {
+		uint8_t(job.width >> 24), uint8_t(job.width >> 16), uint8_t(job.width >> 8), uint8_t(job.width),
+		uint8_t(job.height >> 24), uint8_t(job.height >> 16), uint8_t(job.height >> 8), uint8_t(job.height),
+		8, 2, 0, 0, 0
+	};
+
+	const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	file.write(reinterpret_cast<const char*>(signature), 8);
+	writeChunk("IHDR", header);
+	writeChunk("IDAT", zlib);
+	writeChunk("IEND", {});
+	return file.good();
+}
+
+// Pool of threads encoding and writing rendered frames
+// Submitting blocks while the queue is full, so that slow storage cannot exhaust the memory
+class ImageWriterPool
+{
+public:
+	explicit ImageWriterPool(uint32_t threadCount) : maxQueuedJobs(threadCount * 4) {
+		for (uint32_t i = 0; i < threadCount; i++) {
+			workers.emplace_back([this]() { work(); });
+		}
+	}
+
+	~ImageWriterPool() {
+		finish();
+	}
+
+	// Function to queue an image to be written
+	void submit(ImageWriteJob job) {
+		std::unique_lock<std::mutex> lock(mutex);
+		spaceAvailable.wait(lock, [this]() { return jobs.size() < maxQueuedJobs; });
+		jobs.push_back(std::move(job));
+		jobAvailable.notify_one();
+	}
+
+	// Function to write the queued images and stop the threads
+	void finish() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		jobAvailable.notify_all();
+		for (auto& worker : workers) {
+			if (worker.joinable()) {
+				worker.join();
+			}
+		}
+		workers.clear();
+	}
+
+	// No of images written and the no that could not be written
+	std::atomic<uint32_t> writtenCount{ 0 };
+	std::atomic<uint32_t> failedCount{ 0 };
+
+private:
+	// Function run by each thread
+	void work() {
+		while (true) {
+			ImageWriteJob job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty()) {
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+				spaceAvailable.notify_one();
+			}
+
+			TRACE_SCOPE("write image");
+			bool png = job.path.size() >= 4 && job.path.compare(job.path.size() - 4, 4, ".png") == 0;
+			if (png ? writePng(job) : writePpm(job)) {
+				writtenCount++;
+			}
+			else {
+				std::cerr << "failed to write " << job.path << std::endl;
+				failedCount++;
+			}
+		}
+	}
+
+	size_t maxQueuedJobs;
+	std::deque<ImageWriteJob> jobs;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable spaceAvailable;
+	bool stopping = false;
+};
+
+// Function to make the path of an exported frame by replacing the run of '#' in the pattern with the zero padded frame no
+// The frame no is appended before the extension when the pattern has no '#'
+std::string exportFramePath(const std::string& pattern, uint64_t frame) {
+	std::string number = std::to_string(frame);
+	size_t first = pattern.find('#');
+	if (first == std::string::npos) {
+		size_t extension = pattern.find_last_of('.');
+		size_t directory = pattern.find_last_of("/\\");
+		if (extension == std::string::npos || (directory != std::string::npos && extension < directory)) {
+			extension = pattern.size();
+		}
+		return pattern.substr(0, extension) + "_" + number + pattern.substr(extension);
+	}
+
+	size_t last = pattern.find_first_not_of('#', first);
+	if (last == std::string::npos) {
+		last = pattern.size();
+	}
+	if (number.size() < last - first) {
+		number.insert(0, last - first - number.size(), '0');
+	}
+	return pattern.substr(0, first) + number + pattern.substr(last);
+}
+
+// Function to read a binary PPM image as RGBA pixels
+bool readPpm(const std::string& path, ImageWriteJob& image) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	std::string magic;
+	uint32_t maxValue = 0;
+	file >> magic >> image.width >> image.height >> maxValue;
+	if (magic != "P6" || maxValue != 255 || image.width == 0 || image.height == 0) {
+		return false;
+	}
+	file.get();
+
+	std::vector<uint8_t> rgb(static_cast<size_t>(image.width) * image.height * 3);
+	file.read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+	if (!file.good()) {
+		return false;
+	}
+
+	image.path = path;
+	image.bgra = false;
+	image.pixels.resize(static_cast<size_t>(image.width) * image.height * 4);
+	for (size_t i = 0; i < static_cast<size_t>(image.width) * image.height; i++) {
+		image.pixels[i * 4 + 0] = rgb[i * 3 + 0];
+		image.pixels[i * 4 + 1] = rgb[i * 3 + 1];
+		image.pixels[i * 4 + 2] = rgb[i * 3 + 2];
+		image.pixels[i * 4 + 3] = 255;
+	}
+	return true;
+}
+
+// Function to swap the red and blue channels of an image stored as BGRA
+void convertToRgba(ImageWriteJob& image) {
+	if (!image.bgra) {
+		return;
+	}
+	for (size_t i = 0; i < image.pixels.size(); i += 4) {
+		std::swap(image.pixels[i], image.pixels[i + 2]);
+	}
+	image.bgra = false;
+}
+
+// Differences between a rendered image and its golden image
+struct ImageComparison
+{
+	// No of pixels with a colour channel differing by more than the tolerance
+	uint64_t differingPixels = 0;
+
+	// Largest difference of a colour channel
+	uint32_t maxDifference = 0;
+
+	// Mean difference of the colour channels
+	double meanDifference = 0.0;
+
+	// Mean structural similarity of the luminance over 8x8 windows, 1 for identical images
+	double ssim = 1.0;
+};
+
+// Function to compute the mean structural similarity of the luminance of two RGBA images of the same size
+double computeSsim(const ImageWriteJob& expected, const ImageWriteJob& actual) {
+	size_t pixelCount = static_cast<size_t>(expected.width) * expected.height;
+	std::vector<float> expectedLuma(pixelCount);
+	std::vector<float> actualLuma(pixelCount);
+	for (size_t i = 0; i < pixelCount; i++) {
+		expectedLuma[i] = 0.299f * expected.pixels[i * 4] + 0.587f * expected.pixels[i * 4 + 1] + 0.114f * expected.pixels[i * 4 + 2];
+		actualLuma[i] = 0.299f * actual.pixels[i * 4] + 0.587f * actual.pixels[i * 4 + 1] + 0.114f * actual.pixels[i * 4 + 2];
+	}
+
+	// Windows of 8x8 pixels, overlapping by half. Images smaller than a window are compared as a single window
+	const double c1 = (0.01 * 255.0) * (0.01 * 255.0);
+	const double c2 = (0.03 * 255.0) * (0.03 * 255.0);
+	uint32_t windowWidth = std::min(8u, expected.width);
+	uint32_t windowHeight = std::min(8u, expected.height);
+	double total = 0.0;
+	uint64_t windows = 0;
+	for (uint32_t y = 0; y + windowHeight <= expected.height; y += std::max(1u, windowHeight / 2)) {
+		for (uint32_t x = 0; x + windowWidth <= expected.width; x += std::max(1u, windowWidth / 2)) {
+			double sumExpected = 0.0, sumActual = 0.0, sumExpectedSquared = 0.0, sumActualSquared = 0.0, sumProduct = 0.0;
+			for (uint32_t j = y; j < y + windowHeight; j++) {
+				for (uint32_t i = x; i < x + windowWidth; i++) {
+					double e = expectedLuma[static_cast<size_t>(j) * expected.width + i];
+					double a = actualLuma[static_cast<size_t>(j) * expected.width + i];
+					sumExpected += e;
+					sumActual += a;
+					sumExpectedSquared += e * e;
+					sumActualSquared += a * a;
+					sumProduct += e * a;
+				}
+			}
+
+			double n = static_cast<double>(windowWidth) * windowHeight;
+			double meanExpected = sumExpected / n;
+			double meanActual = sumActual / n;
+			double varianceExpected = sumExpectedSquared / n - meanExpected * meanExpected;
+			double varianceActual = sumActualSquared / n - meanActual * meanActual;
+			double covariance = sumProduct / n - meanExpected * meanActual;
+			total += ((2.0 * meanExpected * meanActual + c1) * (2.0 * covariance + c2))
+				/ ((meanExpected * meanExpected + meanActual * meanActual + c1) * (varianceExpected + varianceActual + c2));
+			windows++;
+		}
+	}
+	return windows > 0 ? total / windows : 1.0;
+}
+
+// Function to compare a rendered image with its golden image. Both must be RGBA images of the same size
+// Writes the absolute differences amplified 8 times into the diff image. The alpha channel is not compared, as the goldens have none
+ImageComparison compareImages(const ImageWriteJob& expected, const ImageWriteJob& actual, uint32_t tolerance, ImageWriteJob& diff) {
+	ImageComparison result;
+	size_t pixelCount = static_cast<size_t>(expected.width) * expected.height;
+	diff.width = expected.width;
+	diff.height = expected.height;
+	diff.bgra = false;
+	diff.pixels.resize(pixelCount * 4);
+
+	const uint8_t* expectedPixels = expected.pixels.data();
+	const uint8_t* actualPixels = actual.pixels.data();
+	uint64_t differenceSum = 0;
+	size_t i = 0;
+#if USE_SSE2
+	// 4 pixels at a time
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i colourMask = _mm_set1_epi32(0x00FFFFFF);
+	const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xFF000000));
+	const __m128i toleranceVector = _mm_set1_epi8(static_cast<char>(std::min(tolerance, 255u)));
+	__m128i sums = zero;
+	__m128i maxima = zero;
+	for (; i + 4 <= pixelCount; i += 4) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(expectedPixels + i * 4));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(actualPixels + i * 4));
+		__m128i difference = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)), colourMask);
+
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(difference, zero));
+		maxima = _mm_max_epu8(maxima, difference);
+
+		// A pixel is within the tolerance when no channel is left after subtracting the tolerance
+		__m128i withinTolerance = _mm_cmpeq_epi32(_mm_subs_epu8(difference, toleranceVector), zero);
+		int withinMask = _mm_movemask_ps(_mm_castsi128_ps(withinTolerance));
+		result.differingPixels += 4 - ((withinMask & 1) + ((withinMask >> 1) & 1) + ((withinMask >> 2) & 1) + ((withinMask >> 3) & 1));
+
+		__m128i amplified = _mm_adds_epu8(difference, difference);
+		amplified = _mm_adds_epu8(amplified, amplified);
+		amplified = _mm_adds_epu8(amplified, amplified);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(diff.pixels.data() + i * 4), _mm_or_si128(amplified, opaque));
+	}
+
+	uint64_t laneSums[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(laneSums), sums);
+	differenceSum = laneSums[0] + laneSums[1];
+	uint8_t laneMaxima[16];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(laneMaxima), maxima);
+	for (uint8_t value : laneMaxima) {
+		result.maxDifference = std::max<uint32_t>(result.maxDifference, value);
+	}
+#endif
+	// Remaining pixels one at a time
+	for (; i < pixelCount; i++) {
+		bool differs = false;
+		for (int channel = 0; channel < 3; channel++) {
+			uint32_t difference = static_cast<uint32_t>(std::abs(expectedPixels[i * 4 + channel] - actualPixels[i * 4 + channel]));
+			differenceSum += difference;
+			result.maxDifference = std::max(result.maxDifference, difference);
+			differs = differs || difference > tolerance;
+			diff.pixels[i * 4 + channel] = static_cast<uint8_t>(std::min(difference * 8, 255u));
+		}
+		diff.pixels[i * 4 + 3] = 255;
+		if (differs) {
+			result.differingPixels++;
+		}
+	}
+
+	result.meanDifference = pixelCount > 0 ? static_cast<double>(differenceSum) / (pixelCount * 3) : 0.0;
+	result.ssim = computeSsim(expected, actual);
+	return result;
+}
+
+// View rendered by the golden image check
+// A placement of the scene as set by the mouse controls and the lighting toggles of the keyboard controls
+struct CanonicalView
+{
+	const char* name;
+
+	// Values of translate_x, translate_y, rotate_x and rotate_y
+	float translateX, translateY;
+	float rotateX, rotateY;
+
+	// Lighting toggles
+	bool ambient, diffuse, specular, texture;
+};
+
+// Views rendered by the golden image check, one per frame
+const CanonicalView canonicalViews[] = {
+	{ "default", 0.0f, 0.0f, 0.0f, 0.0f, true, true, true, true },
+	{ "no_ambient", 0.0f, 0.0f, 0.0f, 0.0f, false, true, true, true },
+	{ "no_diffuse", 0.0f, 0.0f, 0.0f, 0.0f, true, false, true, true },
+	{ "no_specular", 0.0f, 0.0f, 0.0f, 0.0f, true, true, false, true },
+	{ "no_texture", 0.0f, 0.0f, 0.0f, 0.0f, true, true, true, false },
+	{ "texture_only", 0.0f, 0.0f, 0.0f, 0.0f, false, false, false, true },
+	{ "unlit_untextured", 0.0f, 0.0f, 0.0f, 0.0f, false, false, false, false },
+	{ "rotate_x", 0.0f, 0.0f, 9.0f, 0.0f, true, true, true, true },
+	{ "rotate_y", 0.0f, 0.0f, 0.0f, 9.0f, true, true, true, true },
+	{ "rotate_xy", 0.0f, 0.0f, -6.0f, 4.0f, true, true, true, true },
+	{ "translate", 5.0f, -5.0f, 0.0f, 0.0f, true, true, true, true },
+	{ "translate_rotate", -4.0f, 3.0f, 18.0f, -3.0f, true, true, true, true },
+};
+const uint32_t canonicalViewCount = sizeof(canonicalViews) / sizeof(canonicalViews[0]);
+
+// Pool of worker threads shared by every parallel loop
+// The threads are started once, one per core besides the calling thread, and wait for tasks between the loops
+class WorkerPool
+{
+public:
+	explicit WorkerPool(uint32_t threadCount) {
+		for (uint32_t i = 0; i < threadCount; i++) {
+			threads.emplace_back([this]() { run(); });
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		condition.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	// Function to get the pool, created by the first parallel loop
+	static WorkerPool& shared() {
+		static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+		return pool;
+	}
+
+	// Function to get the no of worker threads
+	uint32_t size() const {
+		return static_cast<uint32_t>(threads.size());
+	}
+
+	// Function to queue a task for the next free worker thread
+	void submit(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+		condition.notify_one();
+	}
+
+private:
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+
+	// Function run by each worker thread, taking tasks until the pool is destroyed
+	void run() {
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (tasks.empty()) {
+					return;
+				}
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+};
+
+// Function to run a function for every index on up to threadCount threads, including the calling thread
+// The other threads are workers of the shared pool. The calling thread works through the indices too and then only waits for
+// the workers that joined in, so a helper still queued behind other loops, or behind a loop it is nested in, is never waited for
+template <typename Function>
+void parallelFor(uint32_t threadCount, uint32_t count, Function function) {
+	// State shared with the helpers, which outlives the call when a helper is only taken from the queue after it
+	struct Loop
+	{
+		std::atomic<uint32_t> next{ 0 };
+		std::mutex mutex;
+		std::condition_variable finished;
+		uint32_t activeHelpers = 0;
+		bool closed = false;
+	};
+	auto loop = std::make_shared<Loop>();
+	auto work = [&]() {
+		for (uint32_t i = loop->next++; i < count; i = loop->next++) {
+			function(i);
+		}
+	};
+
+	WorkerPool& pool = WorkerPool::shared();
+	uint32_t helperCount = std::min({ threadCount, count, pool.size() + 1 });
+	for (uint32_t i = 1; i < helperCount; i++) {
+		pool.submit([loop, &work]() {
+			{
+				std::lock_guard<std::mutex> lock(loop->mutex);
+				if (loop->closed) {
+					return;
+				}
+				loop->activeHelpers++;
+			}
+			work();
+			{
+				std::lock_guard<std::mutex> lock(loop->mutex);
+				loop->activeHelpers--;
+			}
+			loop->finished.notify_all();
+		});
+	}
+	work();
+
+	std::unique_lock<std::mutex> lock(loop->mutex);
+	loop->closed = true;
+	loop->finished.wait(lock, [&]() { return loop->activeHelpers == 0; });
+}
+
+// Function to decode an sRGB encoded value to a linear value
+float srgbToLinear(float value) {
+	return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+// Function to encode a linear value as an sRGB value
+float linearToSrgb(float value) {
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Level of a mip chain packed into one buffer
+struct MipLevel
+{
+	uint32_t width;
+	uint32_t height;
+
+	// Byte offset of the texels of the level in the packed chain
+	size_t offset;
+};
+
+// Function to compute the number of levels of a full mip chain down to 1x1
+uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+	uint32_t levels = 1;
+	while ((std::max(width, height) >> levels) > 0) {
+		levels++;
+	}
+	return levels;
+}
+
+// Builds the full mip chain of an RGBA texture on the CPU
+// Each level is a 2x2 box filter of the previous one. Filtering runs on linear values, so sRGB texels are decoded first
+// and encoded again when written, which keeps the brightness of the smaller levels. Levels are split into tiles that
+// are filtered in parallel, a whole texel at a time with SSE2 when the compiler targets it
+class MipChainGenerator
+{
+public:
+	// Edge length of the tiles in texels
+	static const uint32_t tileSize = 64;
+
+	MipChainGenerator(bool sRGB, uint32_t threadCount) : threadCount(std::max(1u, threadCount)) {
+		for (int i = 0; i < 256; i++) {
+			decode[i] = sRGB ? srgbToLinear(i / 255.0f) : i / 255.0f;
+		}
+		for (int i = 0; i < encodeSize; i++) {
+			float value = i / static_cast<float>(encodeSize - 1);
+			encode[i] = static_cast<unsigned char>((sRGB ? linearToSrgb(value) : value) * 255.0f + 0.5f);
+		}
+	}
+
+	// Function to build the chain, returning the texels of all levels packed one after the other, base level first
+	std::vector<unsigned char> generate(const std::vector<unsigned char>& rgba, uint32_t width, uint32_t height, std::vector<MipLevel>& levels) const {
+		levels.clear();
+		size_t totalSize = 0;
+		for (uint32_t level = 0; level < mipLevelCount(width, height); level++) {
+			MipLevel mipLevel;
+			mipLevel.width = std::max(1u, width >> level);
+			mipLevel.height = std::max(1u, height >> level);
+			mipLevel.offset = totalSize;
+			levels.push_back(mipLevel);
+			totalSize += static_cast<size_t>(mipLevel.width) * mipLevel.height * 4;
+		}
+
+		std::vector<unsigned char> chain(totalSize);
+		std::copy(rgba.begin(), rgba.begin() + static_cast<size_t>(width) * height * 4, chain.begin());
+
+		// Linear values of the previous and the current level
+		std::vector<float> source(static_cast<size_t>(width) * height * 4);
+		std::vector<float> destination(source.size());
+		parallelFor(threadCount, height, [&](uint32_t y) {
+			for (size_t i = static_cast<size_t>(y) * width * 4; i < static_cast<size_t>(y + 1) * width * 4; i += 4) {
+				source[i] = decode[rgba[i]];
+				source[i + 1] = decode[rgba[i + 1]];
+				source[i + 2] = decode[rgba[i + 2]];
+				source[i + 3] = rgba[i + 3] / 255.0f;
+			}
+		});
+
+		for (size_t level = 1; level < levels.size(); level++) {
+			const MipLevel& previous = levels[level - 1];
+			const MipLevel& current = levels[level];
+			unsigned char* texels = chain.data() + current.offset;
+
+			uint32_t tilesX = (current.width + tileSize - 1) / tileSize;
+			uint32_t tilesY = (current.height + tileSize - 1) / tileSize;
+			parallelFor(threadCount, tilesX * tilesY, [&](uint32_t tile) {
+				uint32_t beginX = (tile % tilesX) * tileSize;
+				uint32_t beginY = (tile / tilesX) * tileSize;
+				uint32_t endX = std::min(beginX + tileSize, current.width);
+				uint32_t endY = std::min(beginY + tileSize, current.height);
+
+				for (uint32_t y = beginY; y < endY; y++) {
+					// Rows and columns past the edge of a level with an odd size, or of a 1 texel wide level, are clamped
+					const float* row0 = &source[static_cast<size_t>(std::min(y * 2, previous.height - 1)) * previous.width * 4];
+					const float* row1 = &source[static_cast<size_t>(std::min(y * 2 + 1, previous.height - 1)) * previous.width * 4];
+					for (uint32_t x = beginX; x < endX; x++) {
+						size_t x0 = static_cast<size_t>(std::min(x * 2, previous.width - 1)) * 4;
+						size_t x1 = static_cast<size_t>(std::min(x * 2 + 1, previous.width - 1)) * 4;
+						size_t index = (static_cast<size_t>(y) * current.width + x) * 4;
+						filterTexel(row0 + x0, row0 + x1, row1 + x0, row1 + x1, &destination[index], texels + index);
+					}
+				}
+			});
+
+			std::swap(source, destination);
+		}
+
+		return chain;
+	}
+
+private:
+	// Size of the table encoding linear values
+	static const int encodeSize = 4096;
+
+	uint32_t threadCount;
+
+	// Linear value of every 8 bit value, and the 8 bit value of linear values quantized to encodeSize steps
+	float decode[256];
+	unsigned char encode[encodeSize];
+
+	// Function to average 4 texels into a linear texel and its encoded value
+	void filterTexel(const float* a, const float* b, const float* c, const float* d, float* linear, unsigned char* encoded) const {
+#if USE_SSE2
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a), _mm_loadu_ps(b)), _mm_add_ps(_mm_loadu_ps(c), _mm_loadu_ps(d)));
+		_mm_storeu_ps(linear, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+		for (int channel = 0; channel < 4; channel++) {
+			linear[channel] = (a[channel] + b[channel] + c[channel] + d[channel]) * 0.25f;
+		}
+#endif
+		for (int channel = 0; channel < 3; channel++) {
+			encoded[channel] = encode[static_cast<int>(std::min(std::max(linear[channel], 0.0f), 1.0f) * (encodeSize - 1) + 0.5f)];
+		}
+		encoded[3] = static_cast<unsigned char>(std::min(std::max(linear[3], 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+};
+
+// Block of 4x4 texels to compress, one array of the 16 texels per channel
+struct TexelBlock
+{
+	float channels[4][16];
+};
+
+// Function to find the nearest palette entry of every texel of a block over a range of channels
+// The index and the squared distance of every texel are written to indices and errors
+void findNearest(const TexelBlock& block, const float (*palette)[4], int paletteSize, int firstChannel, int channelCount, uint8_t indices[16], float errors[16]) {
+#if USE_SSE2
+	// 4 texels at a time against every palette entry
+	for (int texel = 0; texel < 16; texel += 4) {
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128i bestIndex = _mm_setzero_si128();
+		for (int entry = 0; entry < paletteSize; entry++) {
+			__m128 distance = _mm_setzero_ps();
+			for (int channel = firstChannel; channel < firstChannel + channelCount; channel++) {
+				__m128 difference = _mm_sub_ps(_mm_loadu_ps(&block.channels[channel][texel]), _mm_set1_ps(palette[entry][channel]));
+				distance = _mm_add_ps(distance, _mm_mul_ps(difference, difference));
+			}
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+			best = _mm_min_ps(distance, best);
+			bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(entry)), _mm_andnot_si128(closer, bestIndex));
+		}
+		int32_t lanes[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), bestIndex);
+		_mm_storeu_ps(&errors[texel], best);
+		for (int lane = 0; lane < 4; lane++) {
+			indices[texel + lane] = static_cast<uint8_t>(lanes[lane]);
+		}
+	}
+#else
+	for (int texel = 0; texel < 16; texel++) {
+		errors[texel] = FLT_MAX;
+		for (int entry = 0; entry < paletteSize; entry++) {
+			float distance = 0.0f;
+			for (int channel = firstChannel; channel < firstChannel + channelCount; channel++) {
+				float difference = block.channels[channel][texel] - palette[entry][channel];
+				distance += difference * difference;
+			}
+			if (distance < errors[texel]) {
+				errors[texel] = distance;
+				indices[texel] = static_cast<uint8_t>(entry);
+			}
+		}
+	}
+#endif
+}
+
+// Function to fit the endpoints of a line through the texels of a block along their principal axis
+void fitEndpoints(const TexelBlock& block, int channelCount, float low[4], float high[4]) {
+	float mean[4] = {};
+	for (int channel = 0; channel < channelCount; channel++) {
+		for (int texel = 0; texel < 16; texel++) {
+			mean[channel] += block.channels[channel][texel];
+		}
+		mean[channel] /= 16.0f;
+	}
+
+	float covariance[4][4] = {};
+	for (int texel = 0; texel < 16; texel++) {
+		for (int i = 0; i < channelCount; i++) {
+			for (int j = 0; j < channelCount; j++) {
+				covariance[i][j] += (block.channels[i][texel] - mean[i]) * (block.channels[j][texel] - mean[j]);
+			}
+		}
+	}
+
+	// Power iteration for the direction of largest variance
+	float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = {};
+		float length = 0.0f;
+		for (int i = 0; i < channelCount; i++) {
+			for (int j = 0; j < channelCount; j++) {
+				next[i] += covariance[i][j] * axis[j];
+			}
+			length = std::max(length, std::abs(next[i]));
+		}
+		if (length < 1e-6f) {
+			break;
+		}
+		for (int i = 0; i < channelCount; i++) {
+			axis[i] = next[i] / length;
+		}
+	}
+	float axisLength = 0.0f;
+	for (int i = 0; i < channelCount; i++) {
+		axisLength += axis[i] * axis[i];
+	}
+	axisLength = std::sqrt(axisLength);
+
+	float minimum = 0.0f;
+	float maximum = 0.0f;
+	for (int texel = 0; texel < 16; texel++) {
+		float projection = 0.0f;
+		for (int channel = 0; channel < channelCount; channel++) {
+			projection += (block.channels[channel][texel] - mean[channel]) * axis[channel] / axisLength;
+		}
+		minimum = std::min(minimum, projection);
+		maximum = std::max(maximum, projection);
+	}
+	for (int channel = 0; channel < channelCount; channel++) {
+		low[channel] = std::min(std::max(mean[channel] + axis[channel] / axisLength * minimum, 0.0f), 255.0f);
+		high[channel] = std::min(std::max(mean[channel] + axis[channel] / axisLength * maximum, 0.0f), 255.0f);
+	}
+}
+
+// Writes values of any width to a zeroed block, least significant bit first
+struct BitWriter
+{
+	unsigned char* data;
+	uint32_t position = 0;
+
+	void write(uint32_t value, uint32_t bits) {
+		for (uint32_t i = 0; i < bits; i++, position++) {
+			if ((value >> i) & 1) {
+				data[position >> 3] |= static_cast<unsigned char>(1 << (position & 7));
+			}
+		}
+	}
+};
+
+// Compresses the levels of an RGBA mip chain to a block compressed format
+// Blocks are compressed in parallel, each from its 4x4 texels with the edge texels repeated in levels smaller than a block.
+// Endpoints are fitted along the principal axis of the block and the indices picked with SSE2 when the compiler targets it.
+// The sRGB encoded values are compressed as they are, since the formats interpolate before decoding
+class BlockCompressor
+{
+public:
+	BlockCompressor(TextureCompression format, uint32_t threadCount) : format(format), threadCount(std::max(1u, threadCount)) {
+	}
+
+	// Function to get the size of a compressed block in bytes
+	static uint32_t blockBytes(TextureCompression format) {
+		return format == TextureCompression::Bc1 || format == TextureCompression::Etc2 ? 8 : 16;
+	}
+
+	// Function to compute the layout of the compressed levels of a chain
+	static std::vector<MipLevel> compressedLevels(TextureCompression format, const std::vector<MipLevel>& levels) {
+		std::vector<MipLevel> compressed;
+		size_t offset = 0;
+		for (const MipLevel& level : levels) {
+			compressed.push_back({ level.width, level.height, offset });
+			offset += static_cast<size_t>((level.width + 3) / 4) * ((level.height + 3) / 4) * blockBytes(format);
+		}
+		return compressed;
+	}
+
+	// Function to compute the size of the compressed levels of a chain in bytes
+	static size_t compressedSize(TextureCompression format, const std::vector<MipLevel>& levels) {
+		const MipLevel& last = levels.back();
+		return compressedLevels(format, levels).back().offset + static_cast<size_t>((last.width + 3) / 4) * ((last.height + 3) / 4) * blockBytes(format);
+	}
+
+	// Function to compress every level of a chain, returning the blocks of all levels packed one after the other
+	std::vector<unsigned char> compress(const std::vector<unsigned char>& chain, const std::vector<MipLevel>& levels) const {
+		std::vector<MipLevel> compressed = compressedLevels(format, levels);
+		std::vector<unsigned char> blocks(compressedSize(format, levels), 0);
+
+		for (size_t level = 0; level < levels.size(); level++) {
+			const MipLevel& source = levels[level];
+			uint32_t blocksX = (source.width + 3) / 4;
+			uint32_t blocksY = (source.height + 3) / 4;
+			parallelFor(threadCount, blocksY, [&](uint32_t blockY) {
+				for (uint32_t blockX = 0; blockX < blocksX; blockX++) {
+					TexelBlock block;
+					for (uint32_t texel = 0; texel < 16; texel++) {
+						uint32_t x = std::min(blockX * 4 + texel % 4, source.width - 1);
+						uint32_t y = std::min(blockY * 4 + texel / 4, source.height - 1);
+						const unsigned char* rgba = &chain[source.offset + (static_cast<size_t>(y) * source.width + x) * 4];
+						for (int channel = 0; channel < 4; channel++) {
+							block.channels[channel][texel] = rgba[channel];
+						}
+					}
+
+					unsigned char* output = &blocks[compressed[level].offset + (static_cast<size_t>(blockY) * blocksX + blockX) * blockBytes(format)];
+					switch (format) {
+					case TextureCompression::Bc1:
+						encodeBc1(block, output);
+						break;
+					case TextureCompression::Bc3:
+						encodeBc3Alpha(block, output);
+						encodeBc1(block, output + 8);
+						break;
+					case TextureCompression::Bc7:
+						encodeBc7(block, output);
+						break;
+					case TextureCompression::Etc2:
+						encodeEtc(block, output);
+						break;
+					default:
+						throw std::invalid_argument("unsupported texture compression!");
+					}
+				}
+			});
+		}
+
+		return blocks;
+	}
+
+private:
+	TextureCompression format;
+	uint32_t threadCount;
+
+	// Function to encode the colour of a block as a BC1 block with 4 colours
+	static void encodeBc1(const TexelBlock& block, unsigned char* output) {
+		float low[4], high[4];
+		fitEndpoints(block, 3, low, high);
+
+		auto pack = [](const float colour[4]) {
+			return static_cast<uint16_t>((static_cast<int>(colour[0] * 31.0f / 255.0f + 0.5f) << 11) | (static_cast<int>(colour[1] * 63.0f / 255.0f + 0.5f) << 5) | static_cast<int>(colour[2] * 31.0f / 255.0f + 0.5f));
+		};
+		auto unpack = [](uint16_t colour, float result[4]) {
+			int red = colour >> 11, green = (colour >> 5) & 63, blue = colour & 31;
+			result[0] = static_cast<float>((red << 3) | (red >> 2));
+			result[1] = static_cast<float>((green << 2) | (green >> 4));
+			result[2] = static_cast<float>((blue << 3) | (blue >> 2));
+			result[3] = 255.0f;
+		};
+
+		// The first colour must be the larger one to select the 4 colour mode
+		uint16_t colour0 = pack(high);
+		uint16_t colour1 = pack(low);
+		if (colour0 < colour1) {
+			std::swap(colour0, colour1);
+		}
+
+		uint32_t indexBits = 0;
+		if (colour0 != colour1) {
+			float palette[4][4];
+			unpack(colour0, palette[0]);
+			unpack(colour1, palette[1]);
+			for (int channel = 0; channel < 4; channel++) {
+				palette[2][channel] = (2.0f * palette[0][channel] + palette[1][channel]) / 3.0f;
+				palette[3][channel] = (palette[0][channel] + 2.0f * palette[1][channel]) / 3.0f;
+			}
+
+			uint8_t indices[16];
+			float errors[16];
+			findNearest(block, palette, 4, 0, 3, indices, errors);
+			for (int texel = 0; texel < 16; texel++) {
+				indexBits |= static_cast<uint32_t>(indices[texel]) << (texel * 2);
+			}
+		}
+
+		output[0] = colour0 & 0xFF;
+		output[1] = colour0 >> 8;
+		output[2] = colour1 & 0xFF;
+		output[3] = colour1 >> 8;
+		for (int i = 0; i < 4; i++) {
+			output[4 + i] = (indexBits >> (i * 8)) & 0xFF;
+		}
+	}
+
+	// Function to encode the alpha of a block as a BC3 alpha block with 8 interpolated values
+	static void encodeBc3Alpha(const TexelBlock& block, unsigned char* output) {
+		float minimum = 255.0f;
+		float maximum = 0.0f;
+		for (int texel = 0; texel < 16; texel++) {
+			minimum = std::min(minimum, block.channels[3][texel]);
+			maximum = std::max(maximum, block.channels[3][texel]);
+		}
+		unsigned char alpha0 = static_cast<unsigned char>(maximum + 0.5f);
+		unsigned char alpha1 = static_cast<unsigned char>(minimum + 0.5f);
+		output[0] = alpha0;
+		output[1] = alpha1;
+		if (alpha0 == alpha1) {
+			return;
+		}
+
+		float palette[8][4] = {};
+		palette[0][3] = alpha0;
+		palette[1][3] = alpha1;
+		for (int i = 2; i < 8; i++) {
+			palette[i][3] = ((8 - i) * alpha0 + (i - 1) * alpha1) / 7.0f;
+		}
+
+		uint8_t indices[16];
+		float errors[16];
+		findNearest(block, palette, 8, 3, 1, indices, errors);
+		BitWriter writer = { output + 2 };
+		for (int texel = 0; texel < 16; texel++) {
+			writer.write(indices[texel], 3);
+		}
+	}
+
+	// Function to encode a block as a BC7 mode 6 block with RGBA endpoints of 7 bits and a shared lowest bit each
+	static void encodeBc7(const TexelBlock& block, unsigned char* output) {
+		float low[4], high[4];
+		fitEndpoints(block, 4, low, high);
+
+		// Endpoints with the lowest bit that best matches the fitted colour
+		// Opaque blocks always set the lowest bit, as an alpha of 255 can not be stored otherwise
+		bool opaque = true;
+		for (int texel = 0; texel < 16; texel++) {
+			opaque = opaque && block.channels[3][texel] == 255.0f;
+		}
+		uint32_t endpoints[2][4];
+		uint32_t pBits[2];
+		const float* fitted[2] = { low, high };
+		for (int i = 0; i < 2; i++) {
+			float bestError = FLT_MAX;
+			for (uint32_t pBit = opaque ? 1 : 0; pBit < 2; pBit++) {
+				uint32_t quantized[4];
+				float error = 0.0f;
+				for (int channel = 0; channel < 4; channel++) {
+					quantized[channel] = static_cast<uint32_t>(std::min(std::max((fitted[i][channel] - pBit) / 2.0f + 0.5f, 0.0f), 127.0f));
+					float difference = static_cast<float>(quantized[channel] << 1 | pBit) - fitted[i][channel];
+					error += difference * difference;
+				}
+				if (error < bestError) {
+					bestError = error;
+					pBits[i] = pBit;
+					std::copy(quantized, quantized + 4, endpoints[i]);
+				}
+			}
+		}
+
+		static const uint32_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		float palette[16][4];
+		for (int i = 0; i < 16; i++) {
+			for (int channel = 0; channel < 4; channel++) {
+				uint32_t value0 = endpoints[0][channel] << 1 | pBits[0];
+				uint32_t value1 = endpoints[1][channel] << 1 | pBits[1];
+				palette[i][channel] = static_cast<float>(((64 - weights[i]) * value0 + weights[i] * value1 + 32) >> 6);
+			}
+		}
+
+		uint8_t indices[16];
+		float errors[16];
+		findNearest(block, palette, 16, 0, 4, indices, errors);
+
+		// The highest bit of the index of the first texel is implied zero, so the endpoints are swapped when it is set
+		if (indices[0] >= 8) {
+			std::swap(endpoints[0], endpoints[1]);
+			std::swap(pBits[0], pBits[1]);
+			for (int texel = 0; texel < 16; texel++) {
+				indices[texel] = 15 - indices[texel];
+			}
+		}
+
+		BitWriter writer = { output };
+		writer.write(1 << 6, 7);
+		for (int channel = 0; channel < 4; channel++) {
+			writer.write(endpoints[0][channel], 7);
+			writer.write(endpoints[1][channel], 7);
+		}
+		writer.write(pBits[0], 1);
+		writer.write(pBits[1], 1);
+		writer.write(indices[0], 3);
+		for (int texel = 1; texel < 16; texel++) {
+			writer.write(indices[texel], 4);
+		}
+	}
+
+	// Function to encode the colour of a block as an ETC1 block, which every ETC2 decoder reads
+	// Both the vertical and the horizontal split into 2 sub blocks are tried with every modifier table
+	static void encodeEtc(const TexelBlock& block, unsigned char* output) {
+		static const int modifiers[8][2] = { { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 } };
+
+		uint64_t bestBits = 0;
+		float bestError = FLT_MAX;
+		for (uint32_t flip = 0; flip < 2; flip++) {
+			// Texels of the sub blocks, split left and right or top and bottom
+			bool second[16];
+			float average[2][3] = {};
+			for (int texel = 0; texel < 16; texel++) {
+				second[texel] = flip ? texel / 4 >= 2 : texel % 4 >= 2;
+				for (int channel = 0; channel < 3; channel++) {
+					average[second[texel]][channel] += block.channels[channel][texel] / 8.0f;
+				}
+			}
+
+			// Base colours of 5 bits with a difference of 3 bits when close enough, 4 bits each otherwise
+			int base[2][3];
+			bool differential = true;
+			for (int channel = 0; channel < 3; channel++) {
+				base[0][channel] = static_cast<int>(average[0][channel] * 31.0f / 255.0f + 0.5f);
+				base[1][channel] = static_cast<int>(average[1][channel] * 31.0f / 255.0f + 0.5f);
+				int difference = base[1][channel] - base[0][channel];
+				differential = differential && difference >= -4 && difference <= 3;
+			}
+			float colours[2][3];
+			for (int sub = 0; sub < 2; sub++) {
+				for (int channel = 0; channel < 3; channel++) {
+					if (!differential) {
+						base[sub][channel] = static_cast<int>(average[sub][channel] * 15.0f / 255.0f + 0.5f);
+					}
+					colours[sub][channel] = static_cast<float>(differential ? (base[sub][channel] << 3) | (base[sub][channel] >> 2) : base[sub][channel] * 17);
+				}
+			}
+
+			// Best modifier table of each sub block
+			float error = 0.0f;
+			uint32_t tables[2] = {};
+			uint8_t indices[16] = {};
+			for (int sub = 0; sub < 2; sub++) {
+				float bestSubError = FLT_MAX;
+				for (uint32_t table = 0; table < 8; table++) {
+					// Order of the modifiers given by the pixel index values
+					int offsets[4] = { modifiers[table][0], modifiers[table][1], -modifiers[table][0], -modifiers[table][1] };
+					float palette[4][4] = {};
+					for (int i = 0; i < 4; i++) {
+						for (int channel = 0; channel < 3; channel++) {
+							palette[i][channel] = std::min(std::max(colours[sub][channel] + offsets[i], 0.0f), 255.0f);
+						}
+					}
+
+					uint8_t tableIndices[16];
+					float errors[16];
+					findNearest(block, palette, 4, 0, 3, tableIndices, errors);
+					float subError = 0.0f;
+					for (int texel = 0; texel < 16; texel++) {
+						subError += second[texel] == (sub == 1) ? errors[texel] : 0.0f;
+					}
+					if (subError < bestSubError) {
+						bestSubError = subError;
+						tables[sub] = table;
+						for (int texel = 0; texel < 16; texel++) {
+							if (second[texel] == (sub == 1)) {
+								indices[texel] = tableIndices[texel];
+							}
+						}
+					}
+				}
+				error += bestSubError;
+			}
+
+			if (error < bestError) {
+				bestError = error;
+				uint64_t bits = 0;
+				for (int channel = 0; channel < 3; channel++) {
+					uint64_t colour = differential
+						? static_cast<uint64_t>(base[0][channel]) << 3 | static_cast<uint64_t>((base[1][channel] - base[0][channel]) & 7)
+						: static_cast<uint64_t>(base[0][channel]) << 4 | static_cast<uint64_t>(base[1][channel]);
+					bits |= colour << (56 - channel * 8);
+				}
+				bits |= static_cast<uint64_t>(tables[0]) << 37 | static_cast<uint64_t>(tables[1]) << 34;
+				bits |= static_cast<uint64_t>(differential) << 33 | static_cast<uint64_t>(flip) << 32;
+
+				// The texels are numbered down the columns, with the high and the low bit of the index in separate halves
+				for (int texel = 0; texel < 16; texel++) {
+					int position = (texel % 4) * 4 + texel / 4;
+					bits |= static_cast<uint64_t>(indices[texel] >> 1) << (16 + position);
+					bits |= static_cast<uint64_t>(indices[texel] & 1) << position;
+				}
+				bestBits = bits;
+			}
+		}
+
+		// The block is stored big endian
+		for (int i = 0; i < 8; i++) {
+			output[i] = (bestBits >> (56 - i * 8)) & 0xFF;
+		}
+	}
+};
+
+// Header of a compressed texture cache file, followed by the blocks of every level
+struct CompressedTextureHeader
+{
+	char magic[4];
+	uint32_t version;
+
+	// TextureCompression of the blocks
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelCount;
+
+	// Hash of the uncompressed texels the blocks were compressed from, to detect a changed texture
+	uint64_t sourceHash;
+};
+
+// Function to hash bytes with 64 bit FNV-1a, continuing from the hash of the bytes before them
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// Function to hash bytes with 64 bit FNV-1a
+uint64_t hashBytes(const std::vector<unsigned char>& bytes) {
+	return hashBytes(bytes.data(), bytes.size());
+}
+
+// Function to read the blocks of a compressed texture cache file
+// Returns false when the file does not exist or was written for other texels, a format or a no of levels
+bool readCompressedTexture(const std::string& path, const CompressedTextureHeader& expected, std::vector<unsigned char>& blocks) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	CompressedTextureHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(&header, &expected, sizeof(header)) != 0) {
+		return false;
+	}
+	return static_cast<bool>(file.read(reinterpret_cast<char*>(blocks.data()), blocks.size()));
+}
+
+// Function to write the blocks of a compressed texture to a cache file
+void writeCompressedTexture(const std::string& path, const CompressedTextureHeader& header, const std::vector<unsigned char>& blocks) {
+	std::ofstream file(path, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(blocks.data()), blocks.size());
+	if (!file) {
+		throw std::runtime_error("failed to write compressed texture " + path + "!");
+	}
+}
+
+// Texture sampled by the software rasterizer
+// The texels are decoded from sRGB to linear values, as the GPU does when sampling the VK_FORMAT_R8G8B8A8_SRGB texture
+struct SoftwareTexture
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<glm::vec4> texels;
+
+	// Function to decode tightly packed RGBA texels
+	void load(const std::vector<unsigned char>& rgba, uint32_t textureWidth, uint32_t textureHeight) {
+		width = textureWidth;
+		height = textureHeight;
+
+		float decode[256];
+		for (int i = 0; i < 256; i++) {
+			decode[i] = srgbToLinear(i / 255.0f);
+		}
+
+		texels.resize(static_cast<size_t>(width) * height);
+		for (size_t i = 0; i < texels.size(); i++) {
+			texels[i] = glm::vec4(decode[rgba[i * 4]], decode[rgba[i * 4 + 1]], decode[rgba[i * 4 + 2]], rgba[i * 4 + 3] / 255.0f);
+		}
+	}
+
+	// Function to sample the texture with bilinear filtering and repeat addressing, like the texture sampler
+	glm::vec4 sample(const glm::vec2& texCoord) const {
+		if (texels.empty()) {
+			return glm::vec4(1.0f);
+		}
+
+		// Texel centres are at half integer coordinates
+		float x = texCoord.x * width - 0.5f;
+		float y = texCoord.y * height - 0.5f;
+		if (!std::isfinite(x) || !std::isfinite(y)) {
+			return texels[0];
+		}
+		float floorX = std::floor(x);
+		float floorY = std::floor(y);
+		float fractionX = x - floorX;
+		float fractionY = y - floorY;
+
+		auto wrap = [](float coordinate, uint32_t size) {
+			int64_t index = static_cast<int64_t>(coordinate) % static_cast<int64_t>(size);
+			return static_cast<uint32_t>(index < 0 ? index + size : index);
+		};
+		uint32_t x0 = wrap(floorX, width);
+		uint32_t x1 = wrap(floorX + 1.0f, width);
+		uint32_t y0 = wrap(floorY, height);
+		uint32_t y1 = wrap(floorY + 1.0f, height);
+
+		glm::vec4 top = glm::mix(texels[y0 * width + x0], texels[y0 * width + x1], fractionX);
+		glm::vec4 bottom = glm::mix(texels[y1 * width + x0], texels[y1 * width + x1], fractionX);
+		return glm::mix(top, bottom, fractionY);
+	}
+};
+
+// Reference renderer reproducing the vertex and fragment shaders on the CPU, used where there is no Vulkan device
+// Objects are transformed, clipped and binned into tiles in parallel, then the tiles are rasterized in parallel against a depth buffer.
+// Coverage and depth are tested for 4 pixels at a time, with SSE2 when the compiler targets it
+class SoftwareRasterizer
+{
+public:
+	// Counts of the last rendered frame
+	struct FrameStatistics
+	{
+		// Triangles read from the index lists
+		uint64_t trianglesSubmitted = 0;
+
+		// Triangles left after back face culling and clipping
+		uint64_t trianglesRasterized = 0;
+
+		// Fragments passing the depth test and shaded
+		uint64_t fragmentsShaded = 0;
+	};
+
+	explicit SoftwareRasterizer(uint32_t threads) : threadCount(std::max(1u, threads)) {
+	}
+
+	// Function to set the size of the colour and depth buffers
+	void resize(uint32_t frameWidth, uint32_t frameHeight) {
+		width = frameWidth;
+		height = frameHeight;
+		tilesX = (width + tileSize - 1) / tileSize;
+		tilesY = (height + tileSize - 1) / tileSize;
+
+		// Depth rows are padded to a multiple of 4 so that the last block of a row can be loaded at once
+		depthStride = (width + 3) & ~3u;
+		colour.assign(static_cast<size_t>(width) * height * 4, 0);
+		depth.assign(static_cast<size_t>(depthStride) * height, 1.0f);
+	}
+
+	// Function to render the scene objects with the uniform values of a frame
+	void render(const std::vector<Mesh>& meshes, const std::vector<SceneObject>& objects, const UniformBufferObject& ubo, const LightingConstants& lighting, const SoftwareTexture& texture) {
+		statistics = FrameStatistics();
+
+		// Each chunk of objects keeps its triangles in submission order, so the tiles draw them in the same order as the GPU
+		uint32_t chunkCount = std::max(1u, std::min(static_cast<uint32_t>(objects.size()), threadCount * 4));
+		chunks.resize(chunkCount);
+		parallelFor(threadCount, chunkCount, [&](uint32_t chunkIndex) {
+			TRACE_SCOPE("software geometry");
+			Chunk& chunk = chunks[chunkIndex];
+			chunk.triangles.clear();
+			chunk.bins.resize(tilesX * tilesY);
+			for (auto& bin : chunk.bins) {
+				bin.clear();
+			}
+			chunk.trianglesSubmitted = 0;
+
+			size_t first = objects.size() * chunkIndex / chunkCount;
+			size_t last = objects.size() * (chunkIndex + 1) / chunkCount;
+			for (size_t i = first; i < last; i++) {
+				processObject(meshes[objects[i].meshIndex], objects[i], ubo, lighting, chunk);
+			}
+		});
+
+		for (const auto& chunk : chunks) {
+			statistics.trianglesSubmitted += chunk.trianglesSubmitted;
+			statistics.trianglesRasterized += chunk.triangles.size();
+		}
+
+		std::atomic<uint64_t> fragments(0);
+		parallelFor(threadCount, tilesX * tilesY, [&](uint32_t tile) {
+			TRACE_SCOPE("software tile");
+			fragments += rasterizeTile(tile, lighting, texture);
+		});
+		statistics.fragmentsShaded = fragments;
+	}
+
+	// RGBA pixels of the last rendered frame, stored like the UNORM offscreen targets
+	const std::vector<uint8_t>& pixels() const {
+		return colour;
+	}
+
+	// Counts of the last rendered frame
+	const FrameStatistics& lastFrame() const {
+		return statistics;
+	}
+
+	// Function to reproduce the Phong shading of shader.frag for one fragment, for the light of the scene with no shadow map and no point lights
+	static glm::vec4 shadeFragment(const glm::vec3& fragColor, const glm::vec2& fragTexCoord, const glm::vec3& fragLightVector, const glm::vec3& fragEyeVector, const glm::vec3& fragNormal, const LightingConstants& lighting, const SoftwareTexture& texture) {
+		// Calculate ambient component
+		glm::vec4 ambientLight(0.0f);
+		if (lighting.ambientEnabled > 0.5f) {
+			ambientLight = glm::vec4(glm::vec3(lighting.lightAmbient) * fragColor, 1.0f) * lighting.ambientIntensity;
+		}
+
+		// Normalize the vectors. The light and eye vectors have no w and the w of 1 added to the normal does not change the dot products
+		glm::vec3 normEyeVector = glm::normalize(fragEyeVector);
+		glm::vec3 normLightVector = glm::normalize(fragLightVector);
+		glm::vec3 normNormal = glm::normalize(fragNormal);
+
+		// Calculate the diffuse component. The shader scales it by the ambient colour
+		float diffuseDotProduct = glm::dot(normLightVector, normNormal);
+		glm::vec4 diffuseLight(0.0f);
+		if (lighting.DiffuseEnabled > 0.5f) {
+			diffuseLight = glm::vec4(glm::vec3(lighting.lightAmbient) * fragColor * diffuseDotProduct, 1.0f) * lighting.diffuseIntensity;
+		}
+
+		// Calculate the specular component
+		glm::vec3 halfAngleVector = glm::normalize((normEyeVector + normLightVector) / 2.0f);
+		float specularDotProduct = glm::dot(halfAngleVector, normNormal);
+		float specularPower = std::pow(std::max(0.0f, specularDotProduct), lighting.lightSpecularExponent);
+		glm::vec4 specularLight(0.0f);
+		if (lighting.specularEnabled > 0.5f) {
+			specularPower = std::min(std::max(specularPower, 0.0f), 1.0f);
+			specularLight = glm::vec4(glm::vec3(lighting.lightSpecular) * fragColor * specularPower * lighting.specularIntensity, 1.0f);
+		}
+
+		// Calculate the total lighting, which is 1 when there is no lighting to show the texture
+		glm::vec4 lightingColor = ambientLight + diffuseLight + specularLight;
+		if (lightingColor == glm::vec4(0.0f)) {
+			lightingColor = glm::vec4(1.0f);
+		}
+
+		if (lighting.textureEnabled > 0.5f) {
+			return glm::min(lightingColor * texture.sample(fragTexCoord), glm::vec4(1.0f));
+		}
+		return glm::min(lightingColor, glm::vec4(1.0f));
+	}
+
+private:
+	// Size of the square tiles in pixels, a multiple of 4
+	static const uint32_t tileSize = 64;
+
+	// Vertex in clip space with the values the vertex shader passes to the fragment shader
+	struct ClipVertex
+	{
+		glm::vec4 position;
+		glm::vec3 color;
+		glm::vec2 texCoord;
+		glm::vec3 lightVector;
+		glm::vec3 eyeVector;
+		glm::vec3 normal;
+	};
+
+	// Triangle set up for rasterization
+	struct Triangle
+	{
+		// Edge functions A * x + B * y + C, positive inside. Edge i is opposite vertex i
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+
+		// Flag to indicate whether pixel centres exactly on an edge belong to the triangle, following the top-left rule
+		bool topLeft[3];
+
+		// Depth as a plane A * x + B * y + C
+		float depthA, depthB, depthC;
+
+		// Reciprocal of the sum of the edge functions, which turns them into barycentric coordinates
+		float inverseArea;
+
+		// Bounds in pixels
+		int32_t minX, minY, maxX, maxY;
+
+		// Reciprocal of the clip space w of the vertices and the vertex values divided by w, for perspective correct interpolation
+		float inverseW[3];
+		ClipVertex vertices[3];
+	};
+
+	// Triangles of a range of objects and the triangles overlapping each tile
+	struct Chunk
+	{
+		std::vector<ClipVertex> vertices;
+		std::vector<Triangle> triangles;
+		std::vector<std::vector<uint32_t>> bins;
+		uint64_t trianglesSubmitted = 0;
+	};
+
+	// Function to run the vertex shader on the vertices of an object and set up its triangles
+	void processObject(const Mesh& mesh, const SceneObject& object, const UniformBufferObject& ubo, const LightingConstants& lighting, Chunk& chunk) {
+		glm::mat4 modelView = ubo.view * ubo.model * object.model;
+		glm::vec4 lightPosition = ubo.view * lighting.lightPosition;
+		glm::vec3 tint(object.tint);
+
+		chunk.vertices.resize(mesh.vertices.size());
+		for (size_t i = 0; i < mesh.vertices.size(); i++) {
+			const Vertex& vertex = mesh.vertices[i];
+			glm::vec4 VCS_position = modelView * glm::vec4(vertex.position.x, vertex.position.y, vertex.position.z, 1.0f);
+
+			ClipVertex& output = chunk.vertices[i];
+			output.position = ubo.proj * VCS_position;
+			output.color = glm::vec3(vertex.color.x, vertex.color.y, vertex.color.z) * tint;
+			output.texCoord = glm::vec2(vertex.tex.x, vertex.tex.y);
+			output.lightVector = glm::vec3(lightPosition - VCS_position);
+			output.eyeVector = -glm::vec3(VCS_position);
+			output.normal = glm::vec3(modelView * glm::vec4(vertex.normal.x, vertex.normal.y, vertex.normal.z, 0.0f));
+		}
+
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+			chunk.trianglesSubmitted++;
+			const ClipVertex* triangle[3] = { &chunk.vertices[mesh.indices[i]], &chunk.vertices[mesh.indices[i + 1]], &chunk.vertices[mesh.indices[i + 2]] };
+
+			// Skip triangles entirely outside one of the side planes of the view volume
+			bool outside = false;
+			for (int axis = 0; axis < 2 && !outside; axis++) {
+				outside = (triangle[0]->position[axis] > triangle[0]->position.w && triangle[1]->position[axis] > triangle[1]->position.w && triangle[2]->position[axis] > triangle[2]->position.w)
+					|| (triangle[0]->position[axis] < -triangle[0]->position.w && triangle[1]->position[axis] < -triangle[1]->position.w && triangle[2]->position[axis] < -triangle[2]->position.w);
+			}
+			if (outside) {
+				continue;
+			}
+
+			ClipVertex polygon[4];
+			uint32_t polygonSize = clipNear(triangle, polygon);
+			for (uint32_t j = 1; j + 1 < polygonSize; j++) {
+				setupTriangle(polygon[0], polygon[j], polygon[j + 1], chunk);
+			}
+		}
+	}
+
+	// Function to interpolate between two clip space vertices
+	static ClipVertex lerp(const ClipVertex& a, const ClipVertex& b, float t) {
+		ClipVertex result;
+		result.position = glm::mix(a.position, b.position, t);
+		result.color = glm::mix(a.color, b.color, t);
+		result.texCoord = glm::mix(a.texCoord, b.texCoord, t);
+		result.lightVector = glm::mix(a.lightVector, b.lightVector, t);
+		result.eyeVector = glm::mix(a.eyeVector, b.eyeVector, t);
+		result.normal = glm::mix(a.normal, b.normal, t);
+		return result;
+	}
+
+	// Function to clip a triangle against the near plane, where the Vulkan clip space z is 0
+	// Returns the no of vertices of the clipped polygon, which is 0, 3 or 4
+	static uint32_t clipNear(const ClipVertex* triangle[3], ClipVertex polygon[4]) {
+		uint32_t count = 0;
+		for (int i = 0; i < 3; i++) {
+			const ClipVertex& current = *triangle[i];
+			const ClipVertex& next = *triangle[(i + 1) % 3];
+			float currentDistance = current.position.z;
+			float nextDistance = next.position.z;
+
+			if (currentDistance >= 0.0f) {
+				polygon[count++] = current;
+			}
+			if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f)) {
+				polygon[count++] = lerp(current, next, currentDistance / (currentDistance - nextDistance));
+			}
+		}
+		return count;
+	}
+
+	// Function to project a clipped triangle to the frame, cull it when back facing and add it to the tiles it overlaps
+	void setupTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, Chunk& chunk) {
+		const ClipVertex* vertices[3] = { &a, &b, &c };
+
+		Triangle triangle;
+		float x[3], y[3], z[3];
+		for (int i = 0; i < 3; i++) {
+			float inverseW = 1.0f / vertices[i]->position.w;
+			x[i] = (vertices[i]->position.x * inverseW * 0.5f + 0.5f) * width;
+			y[i] = (vertices[i]->position.y * inverseW * 0.5f + 0.5f) * height;
+			z[i] = vertices[i]->position.z * inverseW;
+
+			triangle.inverseW[i] = inverseW;
+			triangle.vertices[i].color = vertices[i]->color * inverseW;
+			triangle.vertices[i].texCoord = vertices[i]->texCoord * inverseW;
+			triangle.vertices[i].lightVector = vertices[i]->lightVector * inverseW;
+			triangle.vertices[i].eyeVector = vertices[i]->eyeVector * inverseW;
+			triangle.vertices[i].normal = vertices[i]->normal * inverseW;
+		}
+
+		// Counter clockwise triangles are front facing, which in framebuffer coordinates with y pointing down have a negative signed area
+		// Back facing, degenerate and invalid triangles are all culled here
+		float signedArea = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (!(signedArea < 0.0f)) {
+			return;
+		}
+		triangle.inverseArea = -1.0f / signedArea;
+
+		for (int i = 0; i < 3; i++) {
+			int from = (i + 1) % 3;
+			int to = (i + 2) % 3;
+			triangle.edgeA[i] = y[to] - y[from];
+			triangle.edgeB[i] = x[from] - x[to];
+			triangle.edgeC[i] = -(triangle.edgeA[i] * x[from] + triangle.edgeB[i] * y[from]);
+			triangle.topLeft[i] = triangle.edgeA[i] > 0.0f || (triangle.edgeA[i] == 0.0f && triangle.edgeB[i] > 0.0f);
+		}
+
+		triangle.depthA = (z[0] * triangle.edgeA[0] + z[1] * triangle.edgeA[1] + z[2] * triangle.edgeA[2]) * triangle.inverseArea;
+		triangle.depthB = (z[0] * triangle.edgeB[0] + z[1] * triangle.edgeB[1] + z[2] * triangle.edgeB[2]) * triangle.inverseArea;
+		triangle.depthC = (z[0] * triangle.edgeC[0] + z[1] * triangle.edgeC[1] + z[2] * triangle.edgeC[2]) * triangle.inverseArea;
+
+		// Bounds of the pixels whose centres may be covered, clamped in floating point first as a vertex close to the near plane projects far away
+		float minX = std::max(0.0f, std::floor(std::min(std::min(x[0], x[1]), x[2])));
+		float minY = std::max(0.0f, std::floor(std::min(std::min(y[0], y[1]), y[2])));
+		float maxX = std::min(static_cast<float>(width) - 1.0f, std::ceil(std::max(std::max(x[0], x[1]), x[2])));
+		float maxY = std::min(static_cast<float>(height) - 1.0f, std::ceil(std::max(std::max(y[0], y[1]), y[2])));
+		if (minX > maxX || minY > maxY) {
+			return;
+		}
+		triangle.minX = static_cast<int32_t>(minX);
+		triangle.minY = static_cast<int32_t>(minY);
+		triangle.maxX = static_cast<int32_t>(maxX);
+		triangle.maxY = static_cast<int32_t>(maxY);
+
+		uint32_t index = static_cast<uint32_t>(chunk.triangles.size());
+		chunk.triangles.push_back(triangle);
+		for (int32_t tileY = triangle.minY / tileSize; tileY <= triangle.maxY / static_cast<int32_t>(tileSize); tileY++) {
+			for (int32_t tileX = triangle.minX / tileSize; tileX <= triangle.maxX / static_cast<int32_t>(tileSize); tileX++) {
+				chunk.bins[tileY * tilesX + tileX].push_back(index);
+			}
+		}
+	}
+
+	// Function to clear a tile and draw the triangles overlapping it in submission order
+	// Returns the no of fragments shaded
+	uint64_t rasterizeTile(uint32_t tile, const LightingConstants& lighting, const SoftwareTexture& texture) {
+		int32_t tileMinX = static_cast<int32_t>((tile % tilesX) * tileSize);
+		int32_t tileMinY = static_cast<int32_t>((tile / tilesX) * tileSize);
+		int32_t tileMaxX = std::min(tileMinX + static_cast<int32_t>(tileSize), static_cast<int32_t>(width)) - 1;
+		int32_t tileMaxY = std::min(tileMinY + static_cast<int32_t>(tileSize), static_cast<int32_t>(height)) - 1;
+
+		// Clear to the clear values of the render pass
+		for (int32_t y = tileMinY; y <= tileMaxY; y++) {
+			for (int32_t x = tileMinX; x <= tileMaxX; x++) {
+				uint8_t* pixel = &colour[(static_cast<size_t>(y) * width + x) * 4];
+				pixel[0] = 204;
+				pixel[1] = 153;
+				pixel[2] = 0;
+				pixel[3] = 255;
+				depth[static_cast<size_t>(y) * depthStride + x] = 1.0f;
+			}
+		}
+
+		uint64_t fragments = 0;
+		for (const auto& chunk : chunks) {
+			for (uint32_t index : chunk.bins[tile]) {
+				const Triangle& triangle = chunk.triangles[index];
+				int32_t minX = std::max(triangle.minX, tileMinX) & ~3;
+				int32_t maxX = std::min(triangle.maxX, tileMaxX);
+				int32_t minY = std::max(triangle.minY, tileMinY);
+				int32_t maxY = std::min(triangle.maxY, tileMaxY);
+
+				for (int32_t y = minY; y <= maxY; y++) {
+					float* depthRow = &depth[static_cast<size_t>(y) * depthStride];
+					for (int32_t x = minX; x <= maxX; x += 4) {
+						// Lanes past the end of the span belong to the next tile
+						uint32_t laneMask = maxX - x >= 3 ? 0xF : (1u << (maxX - x + 1)) - 1;
+
+						float blockDepth[4];
+						uint32_t mask = testBlock(triangle, x, y, depthRow + x, blockDepth) & laneMask;
+						for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+							if (mask & 1) {
+								depthRow[x + lane] = blockDepth[lane];
+								shadePixel(triangle, x + lane, y, lighting, texture);
+								fragments++;
+							}
+						}
+					}
+				}
+			}
+		}
+		return fragments;
+	}
+
+	// Function to test the coverage and depth of 4 neighbouring pixels in a row
+	// Returns a bit for every pixel covered and closer than the stored depth, with the depth of the 4 pixels
+	static uint32_t testBlock(const Triangle& triangle, int32_t x, int32_t y, const float* storedDepth, float blockDepth[4]) {
+		float centreY = y + 0.5f;
+#if USE_SSE2
+		__m128 centreX = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+		__m128 zero = _mm_setzero_ps();
+		__m128 covered = _mm_cmpeq_ps(zero, zero);
+		for (int i = 0; i < 3; i++) {
+			__m128 edge = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[i]), centreX), _mm_set1_ps(triangle.edgeB[i] * centreY + triangle.edgeC[i]));
+			__m128 inside = _mm_cmpgt_ps(edge, zero);
+			if (triangle.topLeft[i]) {
+				inside = _mm_or_ps(inside, _mm_cmpeq_ps(edge, zero));
+			}
+			covered = _mm_and_ps(covered, inside);
+		}
+
+		// Depth test with VK_COMPARE_OP_LESS. Depths past the far plane are clipped
+		__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.depthA), centreX), _mm_set1_ps(triangle.depthB * centreY + triangle.depthC));
+		covered = _mm_and_ps(covered, _mm_cmplt_ps(z, _mm_loadu_ps(storedDepth)));
+		covered = _mm_and_ps(covered, _mm_cmple_ps(z, _mm_set1_ps(1.0f)));
+		_mm_storeu_ps(blockDepth, z);
+		return static_cast<uint32_t>(_mm_movemask_ps(covered));
+#else
+		uint32_t mask = 0;
+		for (int lane = 0; lane < 4; lane++) {
+			float centreX = x + lane + 0.5f;
+			bool covered = true;
+			for (int i = 0; i < 3; i++) {
+				float edge = triangle.edgeA[i] * centreX + (triangle.edgeB[i] * centreY + triangle.edgeC[i]);
+				covered = covered && (edge > 0.0f || (edge == 0.0f && triangle.topLeft[i]));
+			}
+
+			// Depth test with VK_COMPARE_OP_LESS. Depths past the far plane are clipped
+			blockDepth[lane] = triangle.depthA * centreX + (triangle.depthB * centreY + triangle.depthC);
+			if (covered && blockDepth[lane] < storedDepth[lane] && blockDepth[lane] <= 1.0f) {
+				mask |= 1u << lane;
+			}
+		}
+		return mask;
+#endif
+	}
+
+	// Function to interpolate the vertex values at a pixel centre and shade the pixel
+	void shadePixel(const Triangle& triangle, int32_t x, int32_t y, const LightingConstants& lighting, const SoftwareTexture& texture) {
+		float centreX = x + 0.5f;
+		float centreY = y + 0.5f;
+
+		float barycentric[3];
+		for (int i = 0; i < 3; i++) {
+			barycentric[i] = (triangle.edgeA[i] * centreX + triangle.edgeB[i] * centreY + triangle.edgeC[i]) * triangle.inverseArea;
+		}
+		float w = 1.0f / (barycentric[0] * triangle.inverseW[0] + barycentric[1] * triangle.inverseW[1] + barycentric[2] * triangle.inverseW[2]);
+
+		auto interpolate = [&](auto member) {
+			return (triangle.vertices[0].*member * barycentric[0] + triangle.vertices[1].*member * barycentric[1] + triangle.vertices[2].*member * barycentric[2]) * w;
+		};
+		glm::vec4 result = shadeFragment(interpolate(&ClipVertex::color), interpolate(&ClipVertex::texCoord), interpolate(&ClipVertex::lightVector),
+			interpolate(&ClipVertex::eyeVector), interpolate(&ClipVertex::normal), lighting, texture);
+
+		// Store like a UNORM attachment
+		uint8_t* pixel = &colour[(static_cast<size_t>(y) * width + x) * 4];
+		for (int i = 0; i < 4; i++) {
+			pixel[i] = static_cast<uint8_t>(std::min(std::max(result[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+	}
+
+	uint32_t threadCount;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t tilesX = 0;
+	uint32_t tilesY = 0;
+	uint32_t depthStride = 0;
+	std::vector<uint8_t> colour;
+	std::vector<float> depth;
+	std::vector<Chunk> chunks;
+	FrameStatistics statistics;
+};
+
+// GPU profiler built on timestamp queries
+// Scopes are recorded into the pre-recorded command buffer of each swap chain image and read back without waiting once the frame using the image has completed
+class GpuProfiler
+{
+public:
+	// Max no of scopes recorded in the command buffer of one swap chain image
+	static const uint32_t maxScopesPerImage = 64;
+
+	// No of frames kept by the rolling statistics of each scope
+	static const size_t rollingFrameCount = 240;
+
+	// Max no of scope timings kept for the trace
+	static const size_t maxTraceEvents = 200000;
+
+	// Timing of a scope in a completed frame
+	struct ScopeTiming {
+		std::string name;
+		uint32_t depth;
+		uint64_t frame;
+
+		// Start in nanoseconds of the device timestamp clock and duration in nanoseconds
+		uint64_t startNanoseconds;
+		double durationNanoseconds;
+	};
+
+	// Function to create the query pool with room for the scopes of every swap chain image
+	void create(VkDevice logicalDevice, uint32_t imageCount, float period, uint64_t mask) {
+		device = logicalDevice;
+		timestampPeriod = period;
+		timestampMask = mask;
+		images.assign(imageCount, ImageScopes());
+
+		VkQueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = imageCount * maxScopesPerImage * 2;
+
+		if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create profiler query pool!");
+		}
+	}
+
+	// Function to give up the query pool so that it can be destroyed once the frames using it complete
+	// Scopes of frames still in flight are not measured
+	VkQueryPool releaseQueryPool() {
+		VkQueryPool releasedQueryPool = queryPool;
+		queryPool = VK_NULL_HANDLE;
+		images.clear();
+		return releasedQueryPool;
+	}
+
+	// Function to check whether the profiler has a query pool to record into
+	bool enabled() const {
+		return queryPool != VK_NULL_HANDLE;
+	}
+
+	// Function to reset the queries of a swap chain image at the start of its command buffer
+	void beginCommandBuffer(VkCommandBuffer commandBuffer, uint32_t image) {
+		if (!enabled()) {
+			return;
+		}
+		images[image] = ImageScopes();
+		vkCmdResetQueryPool(commandBuffer, queryPool, image * maxScopesPerImage * 2, maxScopesPerImage * 2);
+	}
+
+	// Function to record the start of a scope
+	// Returns the index to end the scope with. Scopes past the max no of scopes are not measured
+	uint32_t beginScope(VkCommandBuffer commandBuffer, uint32_t image, const std::string& name) {
+		if (!enabled() || images[image].names.size() >= maxScopesPerImage) {
+			return UINT32_MAX;
+		}
+
+		ImageScopes& scopes = images[image];
+		uint32_t scope = static_cast<uint32_t>(scopes.names.size());
+		scopes.names.push_back(name);
+		scopes.depths.push_back(scopes.openScopes++);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, queryIndex(image, scope));
+		return scope;
+	}
+
+	// Function to record the end of a scope
+	void endScope(VkCommandBuffer commandBuffer, uint32_t image, uint32_t scope) {
+		if (!enabled() || scope == UINT32_MAX) {
+			return;
+		}
+		images[image].openScopes--;
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, queryIndex(image, scope) + 1);
+	}
+
+	// Function to note the frame whose scopes the swap chain image now holds
+	void markSubmitted(uint32_t image, uint64_t frame) {
+		if (enabled()) {
+			images[image].pendingFrame = frame;
+		}
+	}
+
+	// Function to read the scopes of the last frame submitted with a swap chain image
+	// Does not wait. Returns false when there was nothing to read or the results were not available
+	bool collect(uint32_t image) {
+		if (!enabled() || images[image].pendingFrame == UINT64_MAX || images[image].names.empty()) {
+			return false;
+		}
+
+		ImageScopes& scopes = images[image];
+		uint64_t frame = scopes.pendingFrame;
+		scopes.pendingFrame = UINT64_MAX;
+
+		std::vector<uint64_t> timestamps(scopes.names.size() * 2);
+		VkResult result = vkGetQueryPoolResults(device, queryPool, queryIndex(image, 0), static_cast<uint32_t>(timestamps.size()),
+			timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (result != VK_SUCCESS) {
+			return false;
+		}
+
+		latestTimings.clear();
+		for (size_t i = 0; i < scopes.names.size(); i++) {
+			uint64_t start = timestamps[i * 2] & timestampMask;
+			uint64_t ticks = ((timestamps[i * 2 + 1] & timestampMask) - start) & timestampMask;
+
+			ScopeTiming timing;
+			timing.name = scopes.names[i];
+			timing.depth = scopes.depths[i];
+			timing.frame = frame;
+			timing.startNanoseconds = static_cast<uint64_t>(start * static_cast<double>(timestampPeriod));
+			timing.durationNanoseconds = ticks * static_cast<double>(timestampPeriod);
+			latestTimings.push_back(timing);
+
+			// Add to the rolling statistics, keeping the scopes in the order they are first seen
+			auto& samples = rollingSamples[timing.name];
+			if (samples.empty()) {
+				scopeOrder.push_back(timing.name);
+			}
+			samples.push_back(timing.durationNanoseconds / 1000000.0);
+			if (samples.size() > rollingFrameCount) {
+				samples.pop_front();
+			}
+
+			if (traceEvents.size() < maxTraceEvents) {
+				traceEvents.push_back(timing);
+			}
+		}
+		return true;
+	}
+
+	// Function to get the scopes of the frame read last
+	const std::vector<ScopeTiming>& latest() const {
+		return latestTimings;
+	}
+
+	// Function to get the scope timings kept for the trace
+	const std::vector<ScopeTiming>& trace() const {
+		return traceEvents;
+	}
+
+	// Function to print the rolling statistics of each scope over the last frames
+	void printStatistics(std::ostream& stream) const {
+		stream << std::left << std::setw(24) << "gpu scope" << std::right << std::setw(10) << "mean ms" << std::setw(10) << "min ms" << std::setw(10) << "max ms" << std::setw(8) << "frames" << std::endl;
+		for (const auto& name : scopeOrder) {
+			const auto& samples = rollingSamples.at(name);
+			double total = 0.0, minimum = DBL_MAX, maximum = 0.0;
+			for (double sample : samples) {
+				total += sample;
+				minimum = std::min(minimum, sample);
+				maximum = std::max(maximum, sample);
+			}
+			stream << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(3)
+				<< std::setw(10) << total / samples.size() << std::setw(10) << minimum << std::setw(10) << maximum << std::setw(8) << samples.size() << std::endl;
+		}
+		stream.unsetf(std::ios::fixed);
+	}
+
+private:
+	// Scopes recorded in the command buffer of a swap chain image
+	struct ImageScopes {
+		std::vector<std::string> names;
+		std::vector<uint32_t> depths;
+		uint32_t openScopes = 0;
+
+		// Frame whose scopes are waiting to be read, or UINT64_MAX for none
+		uint64_t pendingFrame = UINT64_MAX;
+	};
+
+	// Function to get the query of the start of a scope. The end is the next query
+	uint32_t queryIndex(uint32_t image, uint32_t scope) const {
+		return (image * maxScopesPerImage + scope) * 2;
+	}
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	float timestampPeriod = 1.0f;
+	uint64_t timestampMask = 0;
+	std::vector<ImageScopes> images;
+	std::vector<ScopeTiming> latestTimings;
+	std::vector<ScopeTiming> traceEvents;
+	std::map<std::string, std::deque<double>> rollingSamples;
+	std::vector<std::string> scopeOrder;
+};
+
+// Deferred destruction queue
+// Vulkan objects retired while frames are still in flight are tagged with the frame counter at retirement
+// and destroyed only once every frame submitted before that point has completed on the GPU
+struct DeletionQueue
+{
+	// Retired object - frame counter at retirement and the function destroying the object
+	struct Entry
+	{
+		uint64_t retiredFrame;
+		std::function<void()> destroy;
+	};
+
+	// Retired objects in the order they were retired
+	std::deque<Entry> entries;
+
+	// Function to retire an object at the given frame counter
+	void push(uint64_t frame, std::function<void()>&& destroy)
+	{
+		entries.push_back({ frame, std::move(destroy) });
+	}
+
+	// Function to destroy the objects retired before the given number of completed frames
+	void flush(uint64_t completedFrames)
+	{
+		while (!entries.empty() && entries.front().retiredFrame <= completedFrames)
+		{
+			entries.front().destroy();
+			entries.pop_front();
+		}
+	}
+
+	// Function to destroy all retired objects. The device must not be using any of them
+	void flushAll()
+	{
+		while (!entries.empty())
+		{
+			entries.front().destroy();
+			entries.pop_front();
+		}
+	}
+};
+
+// Descriptor allocator
+// Descriptor set layouts are cached by their bindings, and descriptor sets by their layout and the resources written to them,
+// so asking again for the same set is a lookup. Sets come from a list of pools that grows when a pool runs out, and released sets are
+// recycled for the next set of their layout instead of being freed. Transient sets, written again every time they are used, come from the
+// pools of a frame slot without any lookup, and are all freed at once by resetting the pools of the slot when the frame slot comes round again
+class DescriptorAllocator
+{
+public:
+	// No of sets of the first pool. Every new pool holds twice as many as the previous one
+	static const uint32_t initialSetsPerPool = 64;
+
+	// Function to set the device the sets are allocated on and the no of frame slots of the transient sets
+	void create(VkDevice logicalDevice, uint32_t frameSlots) {
+		device = logicalDevice;
+		transientPools.assign(frameSlots, PoolList());
+	}
+
+	// Function to destroy the pools and the layouts. The device must not be using any of the sets
+	void destroy() {
+		destroyPools(persistentPools);
+		for (auto& pools : transientPools) {
+			destroyPools(pools);
+		}
+		for (const auto& layout : layouts) {
+			vkDestroyDescriptorSetLayout(device, layout.first, nullptr);
+		}
+		layouts.clear();
+		layoutCache.clear();
+		setCache.clear();
+	}
+
+	// Function to get the layout of a list of bindings, creating it on first use
+	// The flags of the bindings are only passed to the device when there are any
+	VkDescriptorSetLayout getLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings, const std::vector<VkDescriptorBindingFlagsEXT>& bindingFlags = {}) {
+		std::vector<uint64_t> key = { bindingFlags.size(), bindings.size() };
+		key.insert(key.end(), bindingFlags.begin(), bindingFlags.end());
+		for (const auto& binding : bindings) {
+			key.insert(key.end(), { binding.binding, static_cast<uint64_t>(binding.descriptorType), binding.descriptorCount, binding.stageFlags });
+		}
+		std::vector<CachedLayout>& cachedLayouts = layoutCache[hashKey(key)];
+		for (const auto& cached : cachedLayouts) {
+			if (cached.key == key) {
+				return cached.layout;
+			}
+		}
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+		bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+		bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.pNext = bindingFlags.empty() ? nullptr : &bindingFlagsInfo;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+
+		VkDescriptorSetLayout layout;
+		if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create descriptor set layout!");
+		}
+
+		// Keep the no of descriptors of each type, to know whether a set of the layout fits in a pool
+		LayoutInfo& info = layouts[layout];
+		for (const auto& binding : bindings) {
+			auto size = std::find_if(info.sizes.begin(), info.sizes.end(), [&](const VkDescriptorPoolSize& s) { return s.type == binding.descriptorType; });
+			if (size == info.sizes.end()) {
+				info.sizes.push_back({ binding.descriptorType, binding.descriptorCount });
+			}
+			else {
+				size->descriptorCount += binding.descriptorCount;
+			}
+		}
+		cachedLayouts.push_back({ key, layout });
+		return layout;
+	}
+
+	// Function to get a set of a layout with the resources of the writes, allocating and writing it when it is not cached
+	// The destination set of the writes is filled in here
+	VkDescriptorSet getSet(VkDescriptorSetLayout layout, std::vector<VkWriteDescriptorSet>& writes) {
+		std::vector<uint64_t> key = { handleKey(layout), writes.size() };
+		for (const auto& write : writes) {
+			key.insert(key.end(), { write.dstBinding, write.dstArrayElement, static_cast<uint64_t>(write.descriptorType), write.descriptorCount });
+			for (uint32_t i = 0; write.pBufferInfo != nullptr && i < write.descriptorCount; i++) {
+				key.insert(key.end(), { handleKey(write.pBufferInfo[i].buffer), write.pBufferInfo[i].offset, write.pBufferInfo[i].range });
+			}
+			for (uint32_t i = 0; write.pImageInfo != nullptr && i < write.descriptorCount; i++) {
+				key.insert(key.end(), { handleKey(write.pImageInfo[i].sampler), handleKey(write.pImageInfo[i].imageView), static_cast<uint64_t>(write.pImageInfo[i].imageLayout) });
+			}
+		}
+		std::vector<CachedSet>& cachedSets = setCache[hashKey(key)];
+		for (const auto& cached : cachedSets) {
+			if (cached.key == key) {
+				return cached.set;
+			}
+		}
+
+		// Reuse a released set of the layout before allocating a new one
+		VkDescriptorSet set;
+		std::vector<VkDescriptorSet>& freeSets = layouts[layout].freeSets;
+		if (!freeSets.empty()) {
+			set = freeSets.back();
+			freeSets.pop_back();
+		}
+		else {
+			set = allocate(persistentPools, layout);
+		}
+
+		for (auto& write : writes) {
+			write.dstSet = set;
+		}
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+		cachedSets.push_back({ key, layout, set });
+		return set;
+	}
+
+	// Function to take the cached sets out of the cache, when the resources written to them are about to be destroyed
+	// The sets are recycled with recycle once the frames using them have completed
+	std::vector<std::pair<VkDescriptorSetLayout, VkDescriptorSet>> releaseCachedSets() {
+		std::vector<std::pair<VkDescriptorSetLayout, VkDescriptorSet>> released;
+		for (const auto& bucket : setCache) {
+			for (const auto& cached : bucket.second) {
+				released.push_back({ cached.layout, cached.set });
+			}
+		}
+		setCache.clear();
+		return released;
+	}
+
+	// Function to make released sets available to the next sets of their layouts
+	void recycle(const std::vector<std::pair<VkDescriptorSetLayout, VkDescriptorSet>>& sets) {
+		for (const auto& set : sets) {
+			layouts[set.first].freeSets.push_back(set.second);
+		}
+	}
+
+	// Function to free the transient sets of a frame slot by resetting the pools they came from
+	// The frame that last used the slot must have completed
+	void beginFrame(uint32_t slot) {
+		PoolList& pools = transientPools[slot];
+		for (size_t i = 0; i < pools.pools.size() && i <= pools.current; i++) {
+			Pool& pool = pools.pools[i];
+			vkResetDescriptorPool(device, pool.pool, 0);
+			pool.setsLeft = pool.capacity.maxSets;
+			pool.descriptorsLeft = pool.capacity.sizes;
+		}
+		pools.current = 0;
+	}
+
+	// Function to allocate a set of a layout that is only used by the frame of a slot and write the resources of the writes to it
+	// The set is not cached, and is freed by the next beginFrame of the slot
+	VkDescriptorSet allocateTransient(uint32_t slot, VkDescriptorSetLayout layout, std::vector<VkWriteDescriptorSet>& writes) {
+		VkDescriptorSet set = allocate(transientPools[slot], layout);
+		for (auto& write : writes) {
+			write.dstSet = set;
+		}
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+		return set;
+	}
+
+	// Function to get the no of descriptor pools created
+	size_t poolCount() const {
+		size_t count = persistentPools.pools.size();
+		for (const auto& pools : transientPools) {
+			count += pools.pools.size();
+		}
+		return count;
+	}
+
+private:
+	// No of descriptors of each type in a layout, and its released sets
+	struct LayoutInfo {
+		std::vector<VkDescriptorPoolSize> sizes;
+		std::vector<VkDescriptorSet> freeSets;
+	};
+
+	// Pool with the no of sets and of descriptors of each type still free in it
+	// Vulkan 1.0 leaves allocating past the capacity of a pool undefined, so a set is only allocated from a pool it is known to fit in
+	struct Pool {
+		VkDescriptorPool pool;
+		uint32_t setsLeft;
+		std::vector<VkDescriptorPoolSize> descriptorsLeft;
+
+		// No of sets and of descriptors of each type the pool was created with, restored when the pool is reset
+		struct {
+			uint32_t maxSets;
+			std::vector<VkDescriptorPoolSize> sizes;
+		} capacity;
+	};
+
+	// Pools sets are allocated from in turn, with the one allocated from now
+	struct PoolList {
+		std::vector<Pool> pools;
+		size_t current = 0;
+	};
+
+	// Cached layout and set, with the bindings or the resources they were looked up with, compared on a hit of their hash
+	struct CachedLayout {
+		std::vector<uint64_t> key;
+		VkDescriptorSetLayout layout;
+	};
+	struct CachedSet {
+		std::vector<uint64_t> key;
+		VkDescriptorSetLayout layout;
+		VkDescriptorSet set;
+	};
+
+	// Function to get the value of a handle, whether the platform defines it as a pointer or as an integer
+	template <typename Handle>
+	static uint64_t handleKey(Handle handle) {
+		uint64_t value = 0;
+		memcpy(&value, &handle, sizeof(handle));
+		return value;
+	}
+
+	// Function to hash a cache key
+	static uint64_t hashKey(const std::vector<uint64_t>& key) {
+		return hashBytes(key.data(), key.size() * sizeof(uint64_t));
+	}
+
+	// Function to check whether a set of a layout fits in what is left of a pool
+	static bool fits(const Pool& pool, const LayoutInfo& layout) {
+		if (pool.setsLeft == 0) {
+			return false;
+		}
+		for (const auto& size : layout.sizes) {
+			auto left = std::find_if(pool.descriptorsLeft.begin(), pool.descriptorsLeft.end(), [&](const VkDescriptorPoolSize& s) { return s.type == size.type; });
+			if (left == pool.descriptorsLeft.end() || left->descriptorCount < size.descriptorCount) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Function to allocate a set from the current pool of a list, moving on to the next pool, or a new one, when the set does not fit in it
+	VkDescriptorSet allocate(PoolList& pools, VkDescriptorSetLayout layout) {
+		const LayoutInfo& info = layouts[layout];
+		while (pools.current < pools.pools.size() && !fits(pools.pools[pools.current], info)) {
+			pools.current++;
+		}
+		if (pools.current == pools.pools.size()) {
+			pools.pools.push_back(createPool(initialSetsPerPool << std::min<size_t>(pools.pools.size(), 10), info.sizes));
+		}
+
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = pools.pools[pools.current].pool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &layout;
+
+		VkDescriptorSet set;
+		if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate descriptor set!");
+		}
+
+		Pool& pool = pools.pools[pools.current];
+		pool.setsLeft--;
+		for (const auto& size : info.sizes) {
+			auto left = std::find_if(pool.descriptorsLeft.begin(), pool.descriptorsLeft.end(), [&](const VkDescriptorPoolSize& s) { return s.type == size.type; });
+			left->descriptorCount -= size.descriptorCount;
+		}
+		return set;
+	}
+
+	// Function to create a pool for a no of sets of typical layouts, with room for a few sets of the layout that needs it
+	// Typical sets have a couple of uniform buffers and samplers and a few storage buffers. Large arrays, like the bindless textures, are only counted for the few sets
+	Pool createPool(uint32_t setCount, const std::vector<VkDescriptorPoolSize>& layoutSizes) {
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, setCount * 2 },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, setCount * 4 },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount * 2 }
+		};
+		for (const auto& size : layoutSizes) {
+			auto poolSize = std::find_if(poolSizes.begin(), poolSizes.end(), [&](const VkDescriptorPoolSize& s) { return s.type == size.type; });
+			if (poolSize == poolSizes.end()) {
+				poolSizes.push_back({ size.type, size.descriptorCount * 4 });
+			}
+			else {
+				poolSize->descriptorCount += size.descriptorCount * 4;
+			}
+		}
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = setCount + 4;
+
+		Pool pool = { VK_NULL_HANDLE, poolInfo.maxSets, poolSizes, { poolInfo.maxSets, poolSizes } };
+		if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool.pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create descriptor pool!");
+		}
+		return pool;
+	}
+
+	// Function to destroy the pools of a list
+	void destroyPools(PoolList& pools) {
+		for (const Pool& pool : pools.pools) {
+			vkDestroyDescriptorPool(device, pool.pool, nullptr);
+		}
+		pools = PoolList();
+	}
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::map<uint64_t, std::vector<CachedLayout>> layoutCache;
+	std::map<VkDescriptorSetLayout, LayoutInfo> layouts;
+	std::map<uint64_t, std::vector<CachedSet>> setCache;
+	PoolList persistentPools;
+	std::vector<PoolList> transientPools;
+};
+
+// Maximum no of frames processed concurrently
+const int MAX_FRAMES_IN_FLIGHT = 2;
+
+// Validation layers to be enabled
+const std::vector<const char*> validationLayers = {
+	"VK_LAYER_KHRONOS_validation"
+};
+
+// Device extensions to be enabled
+const std::vector<const char*> deviceExtensions = {
+	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+};
+
+// SPIR-V binary loaded by the application, with the GLSL source compile.bat and compile.sh build it from
+struct ShaderSource
+{
+	const char* binary;
+	const char* source;
+};
+
+// Shaders loaded by the application. The bindless fragment shader is shader.frag built with BINDLESS defined
+const ShaderSource shaderSources[] = {
+	{ "shaders/vert.spv", "shader.vert" },
+	{ "shaders/depth.spv", "depth.vert" },
+	{ "shaders/frag.spv", "shader.frag" },
+	{ "shaders/frag_bindless.spv", "shader.frag" },
+	{ "shaders/cull.spv", "cull.comp" },
 };
 
 // Flag to specify whether Validation layers should be enabled or not
@@ -176,12 +3289,33 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 class HelloTriangleApplication {
 public:
 
+	// Constructor taking the settings parsed from the command line
+	explicit HelloTriangleApplication(const AppSettings& appSettings) : settings(appSettings) {
+	}
+
 	// Function to run the application.
 	// This function initializes the Vulkan objects and loops within mainLoop until window is closed. Cleanup is called to free the resources allocated
 	void run() {
 
-		// Initialize a Window
-		initWindow();
+		// Start tracing before loading, so that the loaders are traced as well
+		if (!settings.cpuTracePath.empty()) {
+#if CPU_TRACING
+			CpuTracer::instance().start();
+#else
+			std::cerr << "CPU tracing was compiled out, so no CPU scopes are recorded" << std::endl;
+#endif
+		}
+
+		// The software rasterizer needs neither a window nor Vulkan
+		if (settings.software) {
+			runSoftwareRenderer();
+			return;
+		}
+
+		// Initialize a Window unless rendering offscreen
+		if (!settings.headless) {
+			initWindow();
+		}
 
 		// Initializes Vulkan resources
 		initVulkan();
@@ -195,8 +3329,26 @@ public:
 
 private:
 
-	// Mesh loaded
-	Mesh m;
+	// Settings of the application
+	AppSettings settings;
+
+	// Meshes loaded
+	std::vector<Mesh> meshes;
+
+	// Ranges of the meshes in the shared vertex and index buffers
+	std::vector<MeshRange> meshRanges;
+
+	// Objects drawn in the scene
+	std::vector<SceneObject> sceneObjects;
+
+	// Lighting constants used for the frame
+	LightingConstants lightingConstants;
+
+	// Point lights around the flock, in the space of the scene transform
+	std::vector<PointLight> pointLights;
+
+	// Bins the point lights into the clusters of the view frustum every frame
+	LightClusterBuilder lightClusterBuilder;
 
 	// Instance to GLFW Window
 	GLFWwindow* window;
@@ -223,7 +3375,7 @@ private:
 	VkQueue presentQueue;
 
 	// Handle to Swap chain
-	VkSwapchainKHR swapChain;
+	VkSwapchainKHR swapChain = VK_NULL_HANDLE;
 
 	// Handles to swap chain images
 	std::vector<VkImage> swapChainImages;
@@ -234,6 +3386,100 @@ private:
 	// Swap chain extent
 	VkExtent2D swapChainExtent;
 
+	// Swap chain presentation mode
+	VkPresentModeKHR swapChainPresentMode;
+
+	// Memory of the offscreen images used as swap chain images when rendering headless
+	std::vector<VkDeviceMemory> offscreenImagesMemory;
+
+	// Host visible buffer the rendered image of a swap chain image is copied to, read once the frame has completed
+	struct ReadbackSlot {
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+
+		// Persistently mapped contents of the buffer
+		void* mapped;
+
+		// Size and channel order of the copied image
+		uint32_t width;
+		uint32_t height;
+		bool bgra;
+
+		// Flag to indicate that a frame was copied and not yet consumed, and the no of that frame
+		bool pending;
+		uint64_t frame;
+	};
+
+	// Readback slots for each swap chain image
+	std::vector<ReadbackSlot> readbackSlots;
+
+	// Threads writing the exported frames
+	std::unique_ptr<ImageWriterPool> imageWriter;
+
+	// Time the first exported frame was submitted
+	std::chrono::steady_clock::time_point exportStartTime;
+
+	// Timestamp queries around the passes and draw groups of each swap chain image
+	GpuProfiler gpuProfiler;
+
+	// Mesh drawn by each draw command, used to time the draws of each mesh as a group
+	std::vector<uint32_t> drawCommandMeshes;
+
+	// No of canonical views checked against their golden images and the no that failed
+	uint32_t goldenChecks = 0;
+	uint32_t goldenFailures = 0;
+
+	// Metrics of the frames, uploads and device memory, written to a text file for scraping
+	MetricsRegistry metrics;
+
+	// No of frames since the metrics file was last written
+	uint32_t framesSinceMetricsWrite = 0;
+
+	// Pipeline statistics query of each swap chain image, created when metrics are written and the device supports pipelineStatisticsQuery
+	VkQueryPool statisticsQueryPool = VK_NULL_HANDLE;
+	bool pipelineStatisticsSupported = false;
+
+	// Flag to indicate whether the last frame rendered to a swap chain image has metrics to read
+	std::vector<bool> metricsPending;
+
+	// Triangles drawn by the draw commands when no object is culled
+	uint64_t sceneTriangleCount = 0;
+
+	// Memory properties of the device, used to find the heap of each allocation
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+
+	// Heap and size of every live device memory allocation, and the totals of each heap
+	std::map<VkDeviceMemory, std::pair<uint32_t, VkDeviceSize>> liveAllocations;
+	std::vector<uint32_t> heapAllocationCounts;
+	std::vector<VkDeviceSize> heapAllocatedBytes;
+
+	// Flag to indicate whether VK_KHR_get_physical_device_properties2 is enabled, which the memory budget is queried through
+	bool physicalDeviceProperties2Enabled = false;
+
+	// Function to read the heap budgets and usage, loaded when VK_EXT_memory_budget is supported
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getPhysicalDeviceMemoryProperties2 = nullptr;
+
+	// Function to read the device and host clocks together, loaded when VK_EXT_calibrated_timestamps is supported
+	PFN_vkGetCalibratedTimestampsEXT getCalibratedTimestamps = nullptr;
+
+	// Nanoseconds per timestamp tick and the mask of the valid timestamp bits
+	float timestampPeriod = 1.0f;
+	uint64_t timestampMask = 0;
+
+	// Frame times measured by the benchmark in milliseconds
+	std::vector<double> cpuFrameTimes;
+	std::vector<double> gpuFrameTimes;
+
+	// Frame times of every step of the light sweep, by no of point lights
+	std::map<uint32_t, std::vector<double>> sweepCpuFrameTimes;
+	std::map<uint32_t, std::vector<double>> sweepGpuFrameTimes;
+
+	// Time the previous frame was submitted, used to measure the CPU frame time
+	std::chrono::steady_clock::time_point lastFrameTime;
+
+	// Flag to indicate whether anisotropic filtering is enabled on the device
+	bool samplerAnisotropySupported = false;
+
 	// Swap chain image views
 	std::vector<VkImageView> swapChainImageViews;
 
@@ -246,8 +3492,24 @@ private:
 	// Pipeline layout - uniforms
 	VkPipelineLayout pipelineLayout;
 
-	// Graphics pipeline
+	// Graphics pipeline of the enabled lighting stages
 	VkPipeline graphicsPipeline;
+	uint32_t graphicsPipelineStageMask = 0;
+
+	// Variants of the graphics pipeline created so far, by the mask of the lighting stages compiled into them
+	std::map<uint32_t, VkPipeline> pipelineVariants;
+
+	// Key of the depth only variant of the depth pre-pass among the pipeline variants
+	static const uint32_t depthOnlyVariant = 0x80000000u;
+
+	// Depth only pipeline of the depth pre-pass, when enabled
+	VkPipeline depthPrepassPipeline = VK_NULL_HANDLE;
+
+	// Key of the depth only variant rendering the shadow map among the pipeline variants
+	static const uint32_t shadowMapVariant = 0x40000000u;
+
+	// Pipeline cache shared by every pipeline, saved between runs
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
 
 	// Swap chain frame buffers
 	std::vector<VkFramebuffer> swapChainFramebuffers;
@@ -267,6 +3529,96 @@ private:
 	// Index Buffer Memory
 	VkDeviceMemory indexBufferMemory;
 
+	// Object Buffer - per object data of the scene objects
+	VkBuffer objectBuffer;
+
+	// Object Buffer Memory
+	VkDeviceMemory objectBufferMemory;
+
+	// Indirect draw commands - one indexed draw per scene object
+	std::vector<VkDrawIndexedIndirectCommand> drawCommands;
+
+	// Indirect Buffer - GPU visible copy of the draw commands
+	VkBuffer indirectBuffer;
+
+	// Indirect Buffer Memory
+	VkDeviceMemory indirectBufferMemory;
+
+	// Draw Count Buffer - no of draw commands read by the count variant of indirect drawing
+	VkBuffer drawCountBuffer;
+
+	// Draw Count Buffer Memory
+	VkDeviceMemory drawCountBufferMemory;
+
+	// Flags specifying which indirect drawing features the device supports
+	bool multiDrawIndirectSupported = false;
+	bool drawIndirectFirstInstanceSupported = false;
+
+	// Count variant of indexed indirect drawing, loaded when VK_KHR_draw_indirect_count is supported
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
+	// Flag to indicate whether the objects are culled in a compute pass before drawing
+	bool cullingEnabled = false;
+
+	// Mesh Draw Buffer - instanced draw of every mesh with no instances yet, copied to the culled draws before each culling pass
+	VkBuffer meshDrawBuffer;
+
+	// Mesh Draw Buffer Memory
+	VkDeviceMemory meshDrawBufferMemory;
+
+	// Culled Draw Buffers - draw of every mesh, with an instance per visible object added by the culling pass for each swap chain image
+	std::vector<VkBuffer> culledDrawBuffers;
+
+	// Culled Draw Buffers Memory
+	std::vector<VkDeviceMemory> culledDrawBuffersMemory;
+
+	// Culled Draw Order Buffers - visible objects compacted per mesh by the culling pass, addressed by the instance index of the culled draws
+	std::vector<VkBuffer> culledDrawOrderBuffers;
+
+	// Culled Draw Order Buffers Memory
+	std::vector<VkDeviceMemory> culledDrawOrderBuffersMemory;
+
+	// Culled Draw Count Buffers - no of meshes drawn and no of visible objects written by the culling pass. Host visible to be read back
+	std::vector<VkBuffer> culledDrawCountBuffers;
+
+	// Culled Draw Count Buffers Memory
+	std::vector<VkDeviceMemory> culledDrawCountBuffersMemory;
+
+	// Descriptor Set Layout of the culling pass
+	VkDescriptorSetLayout cullingDescriptorSetLayout;
+
+	// Pipeline layout of the culling pass
+	VkPipelineLayout cullingPipelineLayout;
+
+	// Compute pipeline of the culling pass
+	VkPipeline cullingPipeline;
+
+	// Descriptor sets of the culling pass for each swap chain image
+	std::vector<VkDescriptorSet> cullingDescriptorSets;
+
+	// Uniform values last written for each swap chain image, used to verify the culling pass
+	std::vector<UniformBufferObject> imageUniforms;
+
+	// Flags to indicate whether a culling result of a swap chain image is waiting to be verified
+	std::vector<bool> cullingResultPending;
+
+	// No of culling results verified and the no that did not match the CPU reference
+	uint32_t cullingChecks = 0;
+	uint32_t cullingMismatches = 0;
+
+	// Deadline of the next frame of the frame pacer
+	std::chrono::steady_clock::time_point nextFrameDeadline;
+
+	// Time the input of the current frame was sampled
+	std::chrono::steady_clock::time_point inputSampleTime;
+
+	// Time from sampling the input to returning from the present request of each frame
+	LatencyStats inputToPresentLatency;
+
+	// Time the first and last frames were presented, used to report the frame rate
+	std::chrono::steady_clock::time_point firstPresentTime;
+	std::chrono::steady_clock::time_point lastPresentTime;
+
 	// Uniform Buffers
 	std::vector<VkBuffer> uniformBuffers;
 
@@ -279,8 +3631,62 @@ private:
 	// Lighting Buffers Memory
 	std::vector<VkDeviceMemory> lightingBuffersMemory;
 
-	// Descriptor Pool to create descriptor sets
-	VkDescriptorPool descriptorPool;
+	// Order the objects are drawn in, as object indices addressed by the instance index of the draws
+	std::vector<VkBuffer> drawOrderBuffers;
+
+	// Draw order buffers Memory
+	std::vector<VkDeviceMemory> drawOrderBuffersMemory;
+
+	// Runs of consecutive objects sharing a mesh, as first object and no of objects, within which the draw order is sorted
+	std::vector<std::pair<uint32_t, uint32_t>> meshRuns;
+
+	// Draw order of the frame and the view depths it is sorted by, kept to sort without allocating
+	std::vector<uint32_t> drawOrder;
+	std::vector<float> drawDepths;
+
+	// Storage buffers of the point lights and their clusters
+	std::vector<VkBuffer> clusterBuffers;
+
+	// Storage buffers of the point lights and their clusters Memory
+	std::vector<VkDeviceMemory> clusterBuffersMemory;
+
+	// Shadow map of the light, with its memory and view
+	VkImage shadowMapImage;
+	VkDeviceMemory shadowMapImageMemory;
+	VkImageView shadowMapImageView;
+
+	// Sampler comparing the depth of a fragment with the shadow map
+	VkSampler shadowMapSampler;
+
+	// Depth only render pass and frame buffer of the shadow pass
+	VkRenderPass shadowRenderPass;
+	VkFramebuffer shadowFramebuffer;
+
+	// Uniform buffers with the light space matrices of the shadow pass, one per frame in flight
+	std::vector<VkBuffer> shadowUniformBuffers;
+	std::vector<VkDeviceMemory> shadowUniformBuffersMemory;
+
+	// Draw order of the shadow pass, which draws every object in scene order whatever the view
+	VkBuffer shadowDrawOrderBuffer;
+	VkDeviceMemory shadowDrawOrderBufferMemory;
+
+	// Command buffers of the shadow pass, one per frame in flight
+	std::vector<VkCommandBuffer> shadowCommandBuffers;
+
+	// Bounding sphere of all shadow casters, in the space of the scene transform
+	glm::vec4 shadowCasterBounds;
+
+	// Light position and scene transform of the current scene version, and the light space matrices computed from them
+	glm::vec4 sceneLightPosition = glm::vec4(0.0f);
+	glm::mat4 sceneModel = glm::mat4(1.0f);
+	UniformBufferObject shadowUniforms = {};
+
+	// Version of the scene, counted up whenever the light or the shadow casters move, and the version the shadow map holds
+	uint64_t sceneVersion = 1;
+	uint64_t shadowMapVersion = 0;
+
+	// Allocates the descriptor sets from pools and caches them and their layouts
+	DescriptorAllocator descriptorAllocator;
 
 	// Descriptor sets to bind each VkBuffer to the uniform buffer descriptor
 	std::vector<VkDescriptorSet> descriptorSets;
@@ -291,12 +3697,34 @@ private:
 	// Memory for Texture Image
 	VkDeviceMemory textureImageMemory;
 
+	// No of mip levels and format of the Texture Image
+	uint32_t textureMipLevels = 1;
+	VkFormat textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
 	// Texture Image View
 	VkImageView textureImageView;
 
 	// Texture Sampler
 	VkSampler textureSampler;
 
+	// Flag to indicate whether the textures are indexed from the bindless texture array through the materials
+	bool bindlessEnabled = false;
+
+	// No of descriptors of the bindless texture array
+	uint32_t bindlessTextureCount = 0;
+
+	// Views of the textures in the bindless texture array, indexed by the materials
+	std::vector<VkImageView> bindlessTextureViews;
+
+	// Materials of the meshes, one per mesh
+	std::vector<MaterialData> materials;
+
+	// Material Buffer - materials read by the fragment shader in bindless mode
+	VkBuffer materialBuffer;
+
+	// Material Buffer Memory
+	VkDeviceMemory materialBufferMemory;
+
 	// Depth Image
 	VkImage depthImage;
 
@@ -306,9 +3734,38 @@ private:
 	// Depth Image view
 	VkImageView depthImageView;
 
+	// No of samples per pixel of the colour and depth attachments
+	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	// Multisampled colour image, resolved into the swap chain image at the end of the render pass. Only with multisampling
+	VkImage colorImage = VK_NULL_HANDLE;
+	VkDeviceMemory colorImageMemory;
+	VkImageView colorImageView;
+
+	// Flag to indicate whether the scene is rendered at a dynamic resolution and upscaled into the swap chain images
+	bool dynamicResolutionEnabled = false;
+
+	// Controller of the scale of the dynamic resolution
+	ResolutionController resolutionController;
+
+	// Extent the scene is rendered at, the swap chain extent unless the resolution is dynamic
+	VkExtent2D renderExtent = {};
+
+	// Images the scene is rendered into at full size for each swap chain image, when the resolution is dynamic
+	// Only the rendered extent of them is used and upscaled
+	std::vector<VkImage> sceneColorImages;
+	std::vector<VkDeviceMemory> sceneColorImagesMemory;
+	std::vector<VkImageView> sceneColorImageViews;
+
 	// Command Buffers
 	std::vector<VkCommandBuffer> commandBuffers;
 
+	// Lighting stage mask of the graphics pipeline each command buffer was recorded with
+	std::vector<uint32_t> commandBufferStageMasks;
+
+	// Extent each command buffer renders the scene at
+	std::vector<VkExtent2D> commandBufferExtents;
+
 	// Semaphores to signal image is acquired for rendering
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 
@@ -324,19 +3781,26 @@ private:
 	// Index of current frame
 	size_t currentFrame = 0;
 
+	// No of frames submitted to the graphics queue so far
+	uint64_t frameCounter = 0;
+
+	// Vulkan objects waiting for the frames using them to complete before being destroyed
+	DeletionQueue deletionQueue;
+
 	// Flag to indicate whether frame buffer is resized due to window resizing
 	bool framebufferResized = false;
 
 	// Current translation and last translation values
-	GLfloat translate_x, translate_y;
-	GLfloat last_x, last_y;
+	// Initialized here as well as in initWindow, as there is no window when rendering offscreen
+	GLfloat translate_x = 0, translate_y = 0;
+	GLfloat last_x = 0, last_y = 0;
 
 	// Current rotation and last rotation values
-	GLfloat rotate_x, rotate_y;
-	GLfloat last_rotate_x, last_rotate_y;
+	GLfloat rotate_x = 0, rotate_y = 0;
+	GLfloat last_rotate_x = 0, last_rotate_y = 0;
 
 	// Current Width and Heigth
-	GLfloat width = WIDTH, height = HEIGHT;
+	GLfloat width = settings.width, height = settings.height;
 	// Structure to  store the indices of the Queue family
 	struct QueueFamilyIndices {
 		// Graphics family
@@ -380,7 +3844,7 @@ private:
 		// 3rd Parameter - Title of the Window
 		// 4th Parameter - Monitor to open the window
 		// 5th Parameter - Only relevant to OpenGL
-		window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan Duck", nullptr, nullptr);
+		window = glfwCreateWindow(settings.width, settings.height, "Vulkan Duck", nullptr, nullptr);
 		// Set the pointer to window in callback functions
 		glfwSetWindowUserPointer(window, this);
 
@@ -407,8 +3871,10 @@ private:
 		// Setup the Debug Messenger
 		setupDebugMessenger();
 
-		// Create the surface
-		createSurface();
+		// Create the surface unless rendering offscreen
+		if (!settings.headless) {
+			createSurface();
+		}
 
 		// Pick up a suitable GPU
 		pickPhysicalDevice();
@@ -416,9 +3882,15 @@ private:
 		// Create a logical device
 		createLogicalDevice();
 
+		// Set up the descriptor allocator, with a slot of transient sets per frame in flight
+		descriptorAllocator.create(device, MAX_FRAMES_IN_FLIGHT);
+
 		// Create Swap chain
 		createSwapChain();
 
+		// Start the dynamic resolution at full resolution. The GPU time of a frame is read once its swap chain image is reused
+		resolutionController.reset(1000.0 / settings.dynamicResolutionTargetFps, settings.minimumResolutionScale, static_cast<uint32_t>(swapChainImages.size()));
+
 		// Create Image Views
 		createImageViews();
 
@@ -428,19 +3900,28 @@ private:
 		// Create Descriptor Set layout
 		createDescriptorSetLayout();
 
+		// Create the pipeline cache, with the pipelines saved by the previous run
+		createPipelineCache();
+
 		// Create the graphics pipeline
 		createGraphicsPipeline();
 
+		// Create the compute pipeline culling the scene objects
+		createCullingPipeline();
+
 		// Create Command Pool
 		createCommandPool();
 
 		createDepthResources();
 
+		// Create the multisampled colour image
+		createColorResources();
+
 		// Create Frame Buffers
 		createFramebuffers();
 
-		// Parse the Object file
-		m = ParseObjFile("12248_Bird_v1_L2.obj");
+		// Load the meshes and place them in the scene
+		loadScene();
 
 		// Create texture image
 		createTextureImage("12248_Bird_v1_diff.ppm");
@@ -457,15 +3938,42 @@ private:
 		// Create Index Buffer
 		createIndexBuffer();
 
+		// Create the Object Buffer
+		createObjectBuffer();
+
+		// Create the Material Buffer
+		createMaterialBuffer();
+
+		// Create the Indirect Draw Buffer
+		createIndirectBuffer();
+
 		// Create the Uniform Buffers
 		createUniformBuffers();
 
-		// Create the Descriptor Pool to create descriptor sets
-		createDescriptorPool();
+		// Create the buffers written by the culling pass
+		createCullingBuffers();
+
+		// Create the shadow map and the resources of the shadow pass
+		createShadowResources();
+
+		// Create the buffers the rendered images are copied to for export
+		createReadbackBuffers();
+
+		// Create the timestamp queries measuring the GPU time of the frames
+		createGpuProfiler();
+
+		// Create the pipeline statistics queries of the metrics
+		createStatisticsQueries();
+		if (!settings.exportPath.empty()) {
+			imageWriter.reset(new ImageWriterPool(std::max(1u, settings.writerThreadCount)));
+		}
 
 		// Create descriptor sets
 		createDescriptorSets();
 
+		// Create descriptor sets of the culling pass
+		createCullingDescriptorSets();
+
 		// Create Command Buffers
 		createCommandBuffers();
 
@@ -478,10 +3986,26 @@ private:
 	void mainLoop() {
 
 		// Event loop to keep the application running until there is an error or window is closed
-		while (!glfwWindowShouldClose(window)) {
+		// Offscreen rendering has no window to close, so it stops after the requested no of frames
+		while (settings.headless || !glfwWindowShouldClose(window)) {
+
+			// Stop once the requested no of frames have been submitted
+			if (settings.frameCount > 0 && frameCounter >= settings.frameCount) {
+				break;
+			}
+
+			// Wait for the frame deadline before sampling the input, so that the input is as recent as possible when presented
+			{
+				TRACE_SCOPE("frame pacer");
+				waitForFrameDeadline();
+			}
 
 			// Checks for events like Window close by the user
-			glfwPollEvents();
+			if (!settings.headless) {
+				TRACE_SCOPE("poll events");
+				glfwPollEvents();
+			}
+			inputSampleTime = std::chrono::steady_clock::now();
 
 			// draw the frame
 			drawFrame();
@@ -489,33 +4013,116 @@ private:
 
 		// Wait for the logical device to complete operations
 		vkDeviceWaitIdle(device);
+
+		// Report the presentation statistics
+		reportPresentStatistics();
+
+		// Write the frames still in the readback slots
+		finishExport();
+		reportGoldenResults();
+
+		// Read the timestamps of the last frames
+		for (uint32_t i = 0; i < swapChainImages.size(); i++) {
+			collectGpuProfile(i);
+		}
+
+		// Report the benchmark
+		if (settings.benchmark) {
+			writeBenchmarkResults();
+		}
+
+		// Write the metrics of the last frames
+		for (uint32_t i = 0; i < swapChainImages.size(); i++) {
+			collectFrameMetrics(i);
+		}
+		writeMetrics();
+
+		// Report the GPU profile
+		if (settings.gpuProfiling) {
+			gpuProfiler.printStatistics(std::cout);
+			if (!settings.gpuTracePath.empty()) {
+				writeChromeTrace(settings.gpuTracePath, gpuTraceEvents(0));
+				std::cout << "GPU trace written to " << settings.gpuTracePath << std::endl;
+			}
+		}
+
+		// Write the CPU scopes of every thread with the GPU scopes placed on the CPU timeline
+		if (!settings.cpuTracePath.empty()) {
+#if CPU_TRACING
+			std::vector<TraceEvent> events = CpuTracer::instance().events();
+			std::vector<TraceEvent> gpuEvents = gpuTraceEvents(gpuClockOffset());
+			events.insert(events.end(), gpuEvents.begin(), gpuEvents.end());
+			writeChromeTrace(settings.cpuTracePath, events);
+			std::cout << "CPU and GPU trace written to " << settings.cpuTracePath << std::endl;
+#endif
+		}
+
+		// Report the verification of the culling pass
+		if (settings.verifyCulling && cullingEnabled) {
+			std::cout << "culling verification: " << cullingChecks - cullingMismatches << " of " << cullingChecks << " frames match the CPU reference" << std::endl;
+			if (cullingMismatches > 0) {
+				throw std::runtime_error("GPU culling does not match the CPU reference!");
+			}
+		}
 	}
 
 	// Function to destroy all Vulkan objects and free allocated resources
 	void cleanup() {
 
+		// Retire the swap chain and related components and destroy them along with all pending retired objects
 		cleanupSwapChain();
+		deletionQueue.flushAll();
 
 		vkDestroySampler(device, textureSampler, nullptr);
 
 		vkDestroyImageView(device, textureImageView, nullptr);
 
+		// Destroy the shadow map and the resources of the shadow pass
+		destroyShadowResources();
+
 		vkDestroyImage(device, textureImage, nullptr);
-		vkFreeMemory(device, textureImageMemory, nullptr);
+		freeMemory(textureImageMemory);
+
+		// Destroy the descriptor pools and layouts
+		descriptorAllocator.destroy();
+
+		// Save and destroy the pipeline cache
+		savePipelineCache();
+		vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+		// Destroy the culling pipeline
+		vkDestroyPipeline(device, cullingPipeline, nullptr);
+		vkDestroyPipelineLayout(device, cullingPipelineLayout, nullptr);
 
-		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+		// Destroy the mesh draw buffer
+		vkDestroyBuffer(device, meshDrawBuffer, nullptr);
+		freeMemory(meshDrawBufferMemory);
+
+		// Destroy the draw count buffer and the indirect buffer
+		vkDestroyBuffer(device, drawCountBuffer, nullptr);
+		freeMemory(drawCountBufferMemory);
+		vkDestroyBuffer(device, indirectBuffer, nullptr);
+		freeMemory(indirectBufferMemory);
+
+		// Destroy the object buffer
+		vkDestroyBuffer(device, objectBuffer, nullptr);
+		freeMemory(objectBufferMemory);
+
+		// Destroy the material buffer
+		vkDestroyBuffer(device, materialBuffer, nullptr);
+		freeMemory(materialBufferMemory);
 
 		// Destroy the index buffer
 		vkDestroyBuffer(device, indexBuffer, nullptr);
 
 		// Free index buffer memory
-		vkFreeMemory(device, indexBufferMemory, nullptr);
+		freeMemory(indexBufferMemory);
 
 		// Destroy the vertex buffer
 		vkDestroyBuffer(device, vertexBuffer, nullptr);
 
 		// Free vertex buffer memory
-		vkFreeMemory(device, vertexBufferMemory, nullptr);
+		freeMemory(vertexBufferMemory);
 
 		// Destroy the semaphores and fences
 		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
@@ -544,18 +4151,22 @@ private:
 
 		// Destroy the surface
 		// Using Vulkan function to destroy as GLFW doesn't offer a function to destroy the surface
-		vkDestroySurfaceKHR(instance, surface, nullptr);
+		if (!settings.headless) {
+			vkDestroySurfaceKHR(instance, surface, nullptr);
+		}
 
 		// Destroy the Vulkan instance
 		// 1st Parameter - instance to be destoyed
 		// 2nd Parameter - optional allocator callback
 		vkDestroyInstance(instance, nullptr);
 
-		// Destroy and cleanup the GLFW Window
-		glfwDestroyWindow(window);
+		if (!settings.headless) {
+			// Destroy and cleanup the GLFW Window
+			glfwDestroyWindow(window);
 
-		// Terminate GLFW
-		glfwTerminate();
+			// Terminate GLFW
+			glfwTerminate();
+		}
 	}
 
 	////////////////////////////
@@ -621,13 +4232,15 @@ private:
 	{
 		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
 		if (key == GLFW_KEY_A && action == GLFW_PRESS)
-			app->m.lightingConstants.ambientEnabled = !app->m.lightingConstants.ambientEnabled;
+			app->lightingConstants.ambientEnabled = !app->lightingConstants.ambientEnabled;
 		if (key == GLFW_KEY_D && action == GLFW_PRESS)
-			app->m.lightingConstants.DiffuseEnabled = !app->m.lightingConstants.DiffuseEnabled;
+			app->lightingConstants.DiffuseEnabled = !app->lightingConstants.DiffuseEnabled;
 		if (key == GLFW_KEY_S && action == GLFW_PRESS)
-			app->m.lightingConstants.specularEnabled = !app->m.lightingConstants.specularEnabled;
+			app->lightingConstants.specularEnabled = !app->lightingConstants.specularEnabled;
 		if (key == GLFW_KEY_T && action == GLFW_PRESS)
-			app->m.lightingConstants.textureEnabled = !app->m.lightingConstants.textureEnabled;
+			app->lightingConstants.textureEnabled = !app->lightingConstants.textureEnabled;
+		if (key == GLFW_KEY_P && action == GLFW_PRESS && app->gpuProfiler.enabled())
+			app->gpuProfiler.printStatistics(std::cout);
 	}
 
 
@@ -780,6 +4393,15 @@ private:
 		// Loop through the GPUs
 		for (const auto& device : devices) {
 
+			// Skip the GPUs not matching the requested name
+			if (!settings.deviceName.empty()) {
+				VkPhysicalDeviceProperties properties;
+				vkGetPhysicalDeviceProperties(device, &properties);
+				if (std::string(properties.deviceName).find(settings.deviceName) == std::string::npos) {
+					continue;
+				}
+			}
+
 			// Check whether this GPU is suitable to application
 			if (isDeviceSuitable(device)) {
 				// Set the current GPU and break so that the current GPU is not assigned with a different value
@@ -834,7 +4456,96 @@ private:
 		// Set of device features used in the application
 		VkPhysicalDeviceFeatures deviceFeatures = {};
 
-		deviceFeatures.samplerAnisotropy = VK_TRUE;
+		// Enable multi draw indirect and non zero first instance in indirect draws when supported
+		// Anisotropic filtering is required with a window and optional offscreen
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+		deviceFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+		samplerAnisotropySupported = supportedFeatures.samplerAnisotropy == VK_TRUE;
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+		drawIndirectFirstInstanceSupported = supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+
+		// Shader invocation counts are only reported with the metrics, so pipeline statistics are not enabled otherwise
+		pipelineStatisticsSupported = !settings.metricsPath.empty() && supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+		deviceFeatures.pipelineStatisticsQuery = pipelineStatisticsSupported ? VK_TRUE : VK_FALSE;
+
+		// Block compressed textures, unless the texture is uncompressed
+		if (settings.textureCompression != TextureCompression::Off) {
+			deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+			deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+		}
+
+		// Required extensions and the optional extensions supported by the device
+		// Offscreen rendering presents nothing, so it does not need the swap chain extension
+		std::vector<const char*> enabledExtensions;
+		if (!settings.headless) {
+			enabledExtensions.assign(deviceExtensions.begin(), deviceExtensions.end());
+		}
+		bool drawIndirectCountAvailable = isDeviceExtensionAvailable(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		if (drawIndirectCountAvailable) {
+			enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+		bool calibratedTimestampsAvailable = isDeviceExtensionAvailable(physicalDevice, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+		if (calibratedTimestampsAvailable) {
+			enabledExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+		}
+		bool memoryBudgetAvailable = physicalDeviceProperties2Enabled && isDeviceExtensionAvailable(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		if (memoryBudgetAvailable) {
+			enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+
+		// Bindless textures need a runtime sized, partially bound array of samplers indexed with non uniform indices
+		// Without them the texture is bound on its own at binding 2
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+		descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+		bindlessEnabled = false;
+		const char* bindlessUnavailableReason = "descriptor indexing is not supported";
+		if (settings.bindless && !physicalDeviceProperties2Enabled) {
+			bindlessUnavailableReason = VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME " is not available";
+		}
+		else if (settings.bindless && !isDeviceExtensionAvailable(physicalDevice, VK_KHR_MAINTENANCE3_EXTENSION_NAME)) {
+			bindlessUnavailableReason = VK_KHR_MAINTENANCE3_EXTENSION_NAME " is not supported";
+		}
+		else if (settings.bindless && isDeviceExtensionAvailable(physicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+			VkPhysicalDeviceFeatures2KHR features2 = {};
+			features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+			features2.pNext = &descriptorIndexingFeatures;
+			auto getPhysicalDeviceFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+			if (getPhysicalDeviceFeatures2 != nullptr) {
+				getPhysicalDeviceFeatures2(physicalDevice, &features2);
+				bindlessEnabled = descriptorIndexingFeatures.runtimeDescriptorArray == VK_TRUE
+					&& descriptorIndexingFeatures.descriptorBindingPartiallyBound == VK_TRUE
+					&& descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing == VK_TRUE;
+				bindlessUnavailableReason = "the descriptor indexing features it needs are not supported";
+			}
+			else {
+				bindlessUnavailableReason = "vkGetPhysicalDeviceFeatures2KHR is not available";
+			}
+		}
+		if (bindlessEnabled) {
+			enabledExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+			enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+			// Enable only the features the bindless textures use
+			descriptorIndexingFeatures = {};
+			descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+			descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+			descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+			descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
+			// The array is sized within the samplers and sampled images a stage and a set can use
+			// leaving room for the texture at binding 2 and the shadow map at binding 8
+			const uint32_t nonArraySamplers = 2;
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+			bindlessTextureCount = std::min({ maxBindlessTextures, properties.limits.maxPerStageDescriptorSamplers - nonArraySamplers, properties.limits.maxPerStageDescriptorSampledImages - nonArraySamplers,
+				properties.limits.maxDescriptorSetSamplers - nonArraySamplers, properties.limits.maxDescriptorSetSampledImages - nonArraySamplers });
+		}
+		else if (settings.bindless) {
+			std::cout << "bindless textures disabled: " << bindlessUnavailableReason << std::endl;
+		}
 
 		// Information for creating the logical device
 		VkDeviceCreateInfo createInfo = {};
@@ -848,10 +4559,13 @@ private:
 
 		// Set the device features information
 		createInfo.pEnabledFeatures = &deviceFeatures;
+		if (bindlessEnabled) {
+			createInfo.pNext = &descriptorIndexingFeatures;
+		}
 
 		// Set the extensions used
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+		createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 		// Check whether validation layers are enabled
 		if (enableValidationLayers) {
@@ -879,11 +4593,74 @@ private:
 
 		// Create the presentaion queue
 		vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+		// Timestamps are only valid when the graphics queue has valid timestamp bits
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+		uint32_t timestampValidBits = queueFamilies[indices.graphicsFamily.value()].timestampValidBits;
+		timestampPeriod = deviceProperties.limits.timestampPeriod;
+		timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (timestampValidBits == 0 ? 0 : (uint64_t(1) << timestampValidBits) - 1);
+
+		// Highest sample count up to the requested one that both the colour and depth attachments support
+		VkSampleCountFlags supportedSampleCounts = deviceProperties.limits.framebufferColorSampleCounts & deviceProperties.limits.framebufferDepthSampleCounts;
+		msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+		for (VkSampleCountFlagBits samples : { VK_SAMPLE_COUNT_8_BIT, VK_SAMPLE_COUNT_4_BIT, VK_SAMPLE_COUNT_2_BIT }) {
+			if (samples <= settings.sampleCount && (supportedSampleCounts & samples)) {
+				msaaSamples = samples;
+				break;
+			}
+		}
+		if (msaaSamples != settings.sampleCount) {
+			std::cout << "MSAA lowered to " << msaaSamples << " samples: " << settings.sampleCount << " samples are not supported" << std::endl;
+		}
+
+		// The shadow map is both a sampled image and the only attachment of its framebuffer, so it is sized within both limits
+		uint32_t maxShadowMapSize = std::min({ deviceProperties.limits.maxImageDimension2D, deviceProperties.limits.maxFramebufferWidth, deviceProperties.limits.maxFramebufferHeight });
+		if (settings.shadowMapSize > maxShadowMapSize) {
+			std::cout << "shadow map lowered to " << maxShadowMapSize << ": " << settings.shadowMapSize << " is not supported" << std::endl;
+			settings.shadowMapSize = maxShadowMapSize;
+		}
+
+		// Load the count variant of indexed indirect drawing
+		if (drawIndirectCountAvailable) {
+			cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+		}
+
+		// Load the calibrated timestamps used to place the GPU scopes on the CPU timeline
+		if (calibratedTimestampsAvailable) {
+			getCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(device, "vkGetCalibratedTimestampsEXT");
+		}
+
+		// Load the query of the heap budgets. It is an instance level function of the extended physical device properties
+		if (memoryBudgetAvailable) {
+			getPhysicalDeviceMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+		}
+
+		// The heaps the allocations are counted against
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		heapAllocationCounts.assign(memoryProperties.memoryHeapCount, 0);
+		heapAllocatedBytes.assign(memoryProperties.memoryHeapCount, 0);
+
+		// The culled draws address the object buffer through their first instance, which indirect draws only support with drawIndirectFirstInstance
+		cullingEnabled = settings.gpuCulling && drawIndirectFirstInstanceSupported;
+		if (settings.gpuCulling && !cullingEnabled) {
+			std::cout << "GPU culling disabled: drawIndirectFirstInstance is not supported" << std::endl;
+		}
 	}
 
 	// Function to create Swap chain
 	// Swap chain - A queue of images waiting to be presented in the screen
 	void createSwapChain() {
+		// Render into offscreen images standing in for the swap chain images
+		if (settings.headless) {
+			createOffscreenTargets();
+			return;
+		}
+
 		// Query swap chain support properties
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
@@ -896,8 +4673,11 @@ private:
 		// Choose swap extent
 		VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
-		// No of images in swap chain
+		// No of images in swap chain, either requested or one more than the minimum so that the driver does not stall the application
 		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+		if (settings.swapChainImageCount > 0) {
+			imageCount = std::max(settings.swapChainImageCount, swapChainSupport.capabilities.minImageCount);
+		}
 
 		// Check whether the image count exceeds the max image count
 		if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
@@ -932,6 +4712,20 @@ private:
 		// Specify the usage of the image in the swap chain
 		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+		// Exported frames are copied out of the swap chain images
+		if (!settings.exportPath.empty()) {
+			if (!(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+				throw std::runtime_error("failed to create swap chain images that can be exported!");
+			}
+			createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		}
+
+		// The scene is upscaled into the swap chain images with a blit when the resolution is dynamic
+		checkDynamicResolution(surfaceFormat.format, swapChainSupport.capabilities.supportedUsageFlags);
+		if (dynamicResolutionEnabled) {
+			createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		}
+
 		// Fetch the Queue families
 		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
@@ -964,8 +4758,8 @@ private:
 		// Set clipping to true
 		createInfo.clipped = VK_TRUE;
 
-		// Specify null as old swap chain
-		createInfo.oldSwapchain = VK_NULL_HANDLE;
+		// Specify the retired swap chain, if any, so that the presentation engine can hand over its resources without the device idling
+		createInfo.oldSwapchain = swapChain;
 
 		// Create the swap chain
 		// 1st Parameter - GPU
@@ -991,6 +4785,41 @@ private:
 
 		// store the extent
 		swapChainExtent = extent;
+		swapChainPresentMode = presentMode;
+	}
+
+	// Function to create the offscreen colour images rendered to instead of swap chain images
+	// One image per frame in flight, so that the fence of a frame also guards its image
+	void createOffscreenTargets() {
+		swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+		swapChainExtent = { settings.width, settings.height };
+
+		checkDynamicResolution(swapChainImageFormat, VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
+		swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+		offscreenImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			createImage(swapChainExtent.width, swapChainExtent.height, 1, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], offscreenImagesMemory[i]);
+		}
+	}
+
+	// Function to check whether the scene can be rendered at a dynamic resolution into images of the format of the swap chain
+	// The upscale blits with linear filtering and needs the GPU frame times, so it is disabled without them
+	void checkDynamicResolution(VkFormat format, VkImageUsageFlags supportedUsage) {
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+		VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+		dynamicResolutionEnabled = settings.dynamicResolution;
+		if (dynamicResolutionEnabled && timestampMask == 0) {
+			std::cout << "dynamic resolution disabled: timestamps are not supported" << std::endl;
+			dynamicResolutionEnabled = false;
+		}
+		if (dynamicResolutionEnabled && ((properties.optimalTilingFeatures & blitFeatures) != blitFeatures || !(supportedUsage & VK_IMAGE_USAGE_TRANSFER_DST_BIT))) {
+			std::cout << "dynamic resolution disabled: the swap chain images cannot be blitted into" << std::endl;
+			dynamicResolutionEnabled = false;
+		}
+		settings.dynamicResolution = dynamicResolutionEnabled;
 	}
 
 	// Function to create Image Views
@@ -999,19 +4828,23 @@ private:
 		swapChainImageViews.resize(swapChainImages.size());
 
 		for (uint32_t i = 0; i < swapChainImages.size(); i++) {
-			swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+			swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 		}
 	}
 
 	// Function to create render pass
 	// Render Pass - Information on no of color and depth buffers, no of samples to use and how the contents should be handled
+	// With multisampling the colour and depth attachments have several samples per pixel and are never stored
+	// The colour samples are resolved into the swap chain image, which is the third attachment, at the end of the subpass
 	void createRenderPass() {
+		bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
 		// Color buffer attachment information
 		VkAttachmentDescription colorAttachment = {};
 		// format of colour buffer attachment
 		colorAttachment.format = swapChainImageFormat;
 		// Number of samples
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		colorAttachment.samples = msaaSamples;
 		// Specify what to do with the data in the attachment before rendering
 		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 		// Specify what to do with the data in the attachment after rendering
@@ -1023,11 +4856,31 @@ private:
 		// Specify layout the image will have before the render pass
 		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		// Specify layout the image should transition to after render pass
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		// Offscreen images are left ready to be copied from, as they are never presented
+		// At a dynamic resolution the scene is left ready to be upscaled into the swap chain image
+		VkImageLayout renderedLayout = settings.headless || dynamicResolutionEnabled ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		colorAttachment.finalLayout = renderedLayout;
+
+		// The multisampled colour is only needed until it is resolved
+		if (multisampled) {
+			colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		}
+
+		// Swap chain image the multisampled colour is resolved into. Its contents are all overwritten by the resolve
+		VkAttachmentDescription resolveAttachment = {};
+		resolveAttachment.format = swapChainImageFormat;
+		resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		resolveAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		resolveAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		resolveAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		resolveAttachment.finalLayout = renderedLayout;
 
 		VkAttachmentDescription depthAttachment = {};
 		depthAttachment.format = findDepthFormat();
-		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depthAttachment.samples = msaaSamples;
 		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -1046,6 +4899,10 @@ private:
 		depthAttachmentRef.attachment = 1;
 		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
+		VkAttachmentReference resolveAttachmentRef = {};
+		resolveAttachmentRef.attachment = 2;
+		resolveAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
 		// Subpass desciption
 		VkSubpassDescription subpass = {};
 		// Specify where the subpass has to be executed
@@ -1055,6 +4912,8 @@ private:
 		// Specify the pointer to the color attachment reference
 		subpass.pColorAttachments = &colorAttachmentRef;
 		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+		// Specify the attachment the colour samples are resolved into
+		subpass.pResolveAttachments = multisampled ? &resolveAttachmentRef : nullptr;
 
 		// Subpass dependency to make the render pass wait for the color attachment output bit stage
 		VkSubpassDependency dependency = {};
@@ -1062,20 +4921,22 @@ private:
 		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 		dependency.dstSubpass = 0;
 		// Specify the operation to wait for. i.e, wait for the swap chain to read the image
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.srcAccessMask = 0;
+		// The colour and depth attachments are shared by the frames in flight, so also wait for the writes of the frame before to them
+		// At a dynamic resolution also wait for the upscale of the frame before to read the scene image
+		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | (dynamicResolutionEnabled ? VK_PIPELINE_STAGE_TRANSFER_BIT : 0);
+		dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 		// Specify the operation that should wait
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
-		std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
+		std::array<VkAttachmentDescription, 3> attachments = { colorAttachment, depthAttachment, resolveAttachment };
 
 		// Render pass create info
 		VkRenderPassCreateInfo renderPassInfo = {};
 		// Type of information stored in the structure
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		// No of attachments in the render pass
-		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		// No of attachments in the render pass, without the resolve attachment when not multisampled
+		renderPassInfo.attachmentCount = multisampled ? 3 : 2;
 		// Pointer to the attachment
 		renderPassInfo.pAttachments = attachments.data();
 		// No of subpasses
@@ -1087,31 +4948,96 @@ private:
 		// Pointer to the subpass dependency
 		renderPassInfo.pDependencies = &dependency;
 
-		// Create render pass
-		// 1st Parameter - GPU
-		// 2nd Parameter - Render pass create info
-		// 3rd Parameter - Custom Allocator
-		// 4th Parameter - Pointer to the created render pass
-		if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
-			// Throw runtime error exception as render pass creation failed
-			throw std::runtime_error("failed to create render pass!");
+		// Create render pass
+		// 1st Parameter - GPU
+		// 2nd Parameter - Render pass create info
+		// 3rd Parameter - Custom Allocator
+		// 4th Parameter - Pointer to the created render pass
+		if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+			// Throw runtime error exception as render pass creation failed
+			throw std::runtime_error("failed to create render pass!");
+		}
+	}
+
+	// Function to create the Graphics pipeline
+	// Graphics Pipeline - Sequence of operations with vertices & textures as input and pixels to render as output
+	void createGraphicsPipeline() {
+		// Pipeline layout create info
+		// Pipeline layout - Uniform values/Push constants specified during pipeline creation
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		// Type of information stored in the structure
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		// Number of uniforms
+		pipelineLayoutInfo.setLayoutCount = 1;
+
+		pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+
+		// Push constants with the transform and tint of the object drawn, used when every object is drawn on its own
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(DrawConstants);
+
+		// Number of push constants
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+		// Create the pipeline layout
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+			// Throw runtime error exception as pipeline layout creation failed
+			throw std::runtime_error("failed to create pipeline layout!");
+		}
+
+		// Create the variant of the lighting stages enabled now. The other variants are created when a stage is toggled
+		graphicsPipelineStageMask = lightingStageMask();
+		graphicsPipeline = getPipelineVariant(graphicsPipelineStageMask);
+		if (settings.depthPrepass) {
+			depthPrepassPipeline = getPipelineVariant(depthOnlyVariant);
 		}
 	}
 
-	// Function to create the Graphics pipeline
-	// Graphics Pipeline - Sequence of operations with vertices & textures as input and pixels to render as output
-	void createGraphicsPipeline() {
-		// Fetch the byte code of vertex shader
-		auto vertShaderCode = readFile("shaders/vert.spv");
+	// Function to get the mask of the enabled lighting stages, with a bit each for ambient, diffuse, specular and texture
+	uint32_t lightingStageMask() const {
+		return (lightingConstants.ambientEnabled > 0.5f ? 1u : 0u)
+			| (lightingConstants.DiffuseEnabled > 0.5f ? 2u : 0u)
+			| (lightingConstants.specularEnabled > 0.5f ? 4u : 0u)
+			| (lightingConstants.textureEnabled > 0.5f ? 8u : 0u);
+	}
+
+	// Function to get the graphics pipeline variant of a mask of lighting stages, creating it through the pipeline cache on first use
+	VkPipeline getPipelineVariant(uint32_t stageMask) {
+		auto variant = pipelineVariants.find(stageMask);
+		if (variant != pipelineVariants.end()) {
+			return variant->second;
+		}
+
+		TRACE_SCOPE("create pipeline variant");
+		VkPipeline pipeline = createPipelineVariant(stageMask);
+		pipelineVariants[stageMask] = pipeline;
+		return pipeline;
+	}
+
+	// Function to create a graphics pipeline with the lighting stages of a mask compiled into the fragment shader
+	// The depth only variant has just a vertex shader reading the positions, and writes depth but no colour
+	// The shadow map variant is a depth only variant rendering into the shadow map, with the depth biased away from the light
+	VkPipeline createPipelineVariant(uint32_t stageMask) {
+		bool shadowMap = stageMask == shadowMapVariant;
+		bool depthOnly = stageMask == depthOnlyVariant || shadowMap;
+		VkExtent2D extent = shadowMap ? VkExtent2D{ settings.shadowMapSize, settings.shadowMapSize } : swapChainExtent;
 
-		// Fetch the byte code of fragment shader
-		auto fragShaderCode = readFile("shaders/frag.spv");
+		// Fetch the byte code of vertex shader
+		auto vertShaderCode = readShader(depthOnly ? "shaders/depth.spv" : "shaders/vert.spv");
 
 		// Create Vertex shader module
 		VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
 
-		// Create Fragment shader module
-		VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+		// Fetch the byte code of fragment shader and create its module. Depth only variants have no fragment stage
+		// The bindless build of the fragment shader declares the texture array, which needs descriptor indexing
+		VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+		if (!depthOnly) {
+			auto fragShaderCode = readShader(bindlessEnabled ? "shaders/frag_bindless.spv" : "shaders/frag.spv");
+			fragShaderModule = createShaderModule(fragShaderCode);
+		}
 
 		// Vertex shader stage create info
 		VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
@@ -1135,6 +5061,32 @@ private:
 		// Specify the entry point
 		fragShaderStageInfo.pName = "main";
 
+		// Specialization constants enabling the ambient, diffuse, specular and texture stages of the fragment shader
+		std::array<VkBool32, 4> stagesEnabled;
+		std::array<VkSpecializationMapEntry, 4> specializationEntries;
+		for (uint32_t i = 0; i < 4; i++) {
+			stagesEnabled[i] = (stageMask >> i) & 1 ? VK_TRUE : VK_FALSE;
+			specializationEntries[i].constantID = i;
+			specializationEntries[i].offset = i * sizeof(VkBool32);
+			specializationEntries[i].size = sizeof(VkBool32);
+		}
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+		specializationInfo.pMapEntries = specializationEntries.data();
+		specializationInfo.dataSize = sizeof(stagesEnabled);
+		specializationInfo.pData = stagesEnabled.data();
+		fragShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+		// Specialization constant selecting the push constants or the object buffer as the source of the object data in the vertex shader
+		VkBool32 pushConstantDraws = settings.pushConstantDraws ? VK_TRUE : VK_FALSE;
+		VkSpecializationMapEntry vertexSpecializationEntry = { 0, 0, sizeof(VkBool32) };
+		VkSpecializationInfo vertexSpecializationInfo = {};
+		vertexSpecializationInfo.mapEntryCount = 1;
+		vertexSpecializationInfo.pMapEntries = &vertexSpecializationEntry;
+		vertexSpecializationInfo.dataSize = sizeof(pushConstantDraws);
+		vertexSpecializationInfo.pData = &pushConstantDraws;
+		vertShaderStageInfo.pSpecializationInfo = &vertexSpecializationInfo;
+
 		// Create an array to store vertex shader stage create info and fragment shader stage create info
 		VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
@@ -1151,7 +5103,7 @@ private:
 		// Details for loading vertex data
 		vertexInputInfo.vertexBindingDescriptionCount = 1;
 		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+		vertexInputInfo.vertexAttributeDescriptionCount = depthOnly ? 1 : static_cast<uint32_t>(attributeDescriptions.size());
 		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
 		// Information of kind of geometry drawn
@@ -1171,9 +5123,9 @@ private:
 		// starting y of viewport
 		viewport.y = 0.0f;
 		// width of viewport
-		viewport.width = (float)swapChainExtent.width;
+		viewport.width = (float)extent.width;
 		// height of viewport
-		viewport.height = (float)swapChainExtent.height;
+		viewport.height = (float)extent.height;
 		// min depth of viewport
 		viewport.minDepth = 0.0f;
 		// max depth of viewport
@@ -1185,7 +5137,7 @@ private:
 		// Scissor offset
 		scissor.offset = { 0, 0 };
 		// Scissor extent
-		scissor.extent = swapChainExtent;
+		scissor.extent = extent;
 
 		// Viewport State create info
 		VkPipelineViewportStateCreateInfo viewportState = {};
@@ -1218,17 +5170,18 @@ private:
 		// Specify the vertex order
 		rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 		// Should the rasterizer alter the depth values by adding a constant value or biasing them
-		rasterizer.depthBiasEnable = VK_FALSE;
-		rasterizer.depthBiasConstantFactor = 0.0f; // Optional
+		// The shadow map is biased so that surfaces facing the light do not shadow themselves
+		rasterizer.depthBiasEnable = shadowMap ? VK_TRUE : VK_FALSE;
+		rasterizer.depthBiasConstantFactor = shadowMap ? 1.25f : 0.0f;
 		rasterizer.depthBiasClamp = 0.0f; // Optional
-		rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+		rasterizer.depthBiasSlopeFactor = shadowMap ? 1.75f : 0.0f;
 
 		// Information to configure multisampling to perform anti-aliasing
 		VkPipelineMultisampleStateCreateInfo multisampling = {};
 		// Type of information stored in the structure
 		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
 		multisampling.sampleShadingEnable = VK_FALSE;
-		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		multisampling.rasterizationSamples = shadowMap ? VK_SAMPLE_COUNT_1_BIT : msaaSamples;
 		multisampling.minSampleShading = 1.0f; // Optional
 		multisampling.pSampleMask = nullptr; // Optional
 		multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
@@ -1242,10 +5195,16 @@ private:
 		depthStencil.depthBoundsTestEnable = VK_FALSE;
 		depthStencil.stencilTestEnable = VK_FALSE;
 
+		// After a depth pre-pass only the fragments matching the nearest depth are shaded, and the depth is left as it is
+		if (settings.depthPrepass && !depthOnly) {
+			depthStencil.depthWriteEnable = VK_FALSE;
+			depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+		}
+
 		// Colour blending configuration per attached framebuffer
 		// Colour blending - way to combine with colour already in framebuffer
 		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		colorBlendAttachment.colorWriteMask = depthOnly ? 0 : VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 		colorBlendAttachment.blendEnable = VK_FALSE;
 
 		// Global colour blending setting information
@@ -1254,7 +5213,7 @@ private:
 		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 		colorBlending.logicOpEnable = VK_FALSE;
 		colorBlending.logicOp = VK_LOGIC_OP_COPY;
-		colorBlending.attachmentCount = 1;
+		colorBlending.attachmentCount = shadowMap ? 0 : 1;
 		colorBlending.pAttachments = &colorBlendAttachment;
 		colorBlending.blendConstants[0] = 0.0f;
 		colorBlending.blendConstants[1] = 0.0f;
@@ -1262,9 +5221,10 @@ private:
 		colorBlending.blendConstants[3] = 0.0f;
 
 		// Dynamic states which can be changed without recreating the pipeline
+		// The scene pipelines set the viewport and scissor to the extent the scene is rendered at, which dynamic resolution changes
 		VkDynamicState dynamicStates[] = {
 	VK_DYNAMIC_STATE_VIEWPORT,
-	VK_DYNAMIC_STATE_LINE_WIDTH
+	VK_DYNAMIC_STATE_SCISSOR
 		};
 
 		// Dynamic state create info
@@ -1276,30 +5236,12 @@ private:
 		// Specify the array of dynamic states
 		dynamicState.pDynamicStates = dynamicStates;
 
-		// Pipeline layout create info
-		// Pipeline layout - Uniform values/Push constants specified during pipeline creation
-		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-		// Type of information stored in the structure
-		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		// Number of uniforms
-		pipelineLayoutInfo.setLayoutCount = 1;
-
-		pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-		// Number of push constants
-		pipelineLayoutInfo.pushConstantRangeCount = 0;
-
-		// Create the pipeline layout
-		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-			// Throw runtime error exception as pipeline layout creation failed
-			throw std::runtime_error("failed to create pipeline layout!");
-		}
-
 		// Graphics pipeline create info
 		VkGraphicsPipelineCreateInfo pipelineInfo = {};
 		// Type of information stored in the structure
 		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 		// No of shader stages
-		pipelineInfo.stageCount = 2;
+		pipelineInfo.stageCount = depthOnly ? 1 : 2;
 		// Pointer to shader stages
 		pipelineInfo.pStages = shaderStages;
 		// Specify the vertex input state
@@ -1317,11 +5259,11 @@ private:
 		// Specify the color blend state
 		pipelineInfo.pColorBlendState = &colorBlending;
 		// Specify the dynamic state
-		pipelineInfo.pDynamicState = nullptr; // Optional
+		pipelineInfo.pDynamicState = shadowMap ? nullptr : &dynamicState;
 		// Specify the pipeline layout
 		pipelineInfo.layout = pipelineLayout;
 		// Specify the render pass
-		pipelineInfo.renderPass = renderPass;
+		pipelineInfo.renderPass = shadowMap ? shadowRenderPass : renderPass;
 		// Specify the index of the render pass where this graphics pipeline will be used
 		pipelineInfo.subpass = 0;
 		// Specify the base pipeline to derive from
@@ -1335,16 +5277,76 @@ private:
 		// 3rd Parameter - Pipeline create info
 		// 4th Parameter - Custom allocator
 		// 5th Parameter - Pointer to the created graphics pipeline
-		if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+		VkPipeline pipeline;
+		if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
 			// Throw runtime error exception as graphics pipeline creation failed
 			throw std::runtime_error("failed to create graphics pipeline!");
 		}
 
 		// Destroy the fragment shader module
+		// Destroying a null handle, as depth only variants have, does nothing
 		vkDestroyShaderModule(device, fragShaderModule, nullptr);
 
 		// Destroy the vertex shader module
 		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+		return pipeline;
+	}
+
+	// Function to create the pipeline cache, filled with the data saved by a previous run on the same device and driver
+	void createPipelineCache() {
+		std::vector<char> cacheData;
+		if (!settings.pipelineCachePath.empty()) {
+			std::ifstream file(settings.pipelineCachePath, std::ios::ate | std::ios::binary);
+			if (file.is_open()) {
+				cacheData.resize(static_cast<size_t>(file.tellg()));
+				file.seekg(0);
+				file.read(cacheData.data(), cacheData.size());
+			}
+		}
+
+		// The header identifies the device and driver the data was saved by. Data of another one is ignored
+		// Header layout: size, version, vendor ID, device ID and the cache UUID
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+		const size_t headerSize = 16 + VK_UUID_SIZE;
+		if (cacheData.size() >= headerSize) {
+			uint32_t header[4];
+			memcpy(header, cacheData.data(), sizeof(header));
+			if (header[2] != deviceProperties.vendorID || header[3] != deviceProperties.deviceID ||
+				memcmp(cacheData.data() + 16, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+				cacheData.clear();
+			}
+		}
+		else {
+			cacheData.clear();
+		}
+
+		VkPipelineCacheCreateInfo cacheInfo = {};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheInfo.initialDataSize = cacheData.size();
+		cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+		if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline cache!");
+		}
+	}
+
+	// Function to save the data of the pipeline cache for the next run
+	void savePipelineCache() {
+		if (settings.pipelineCachePath.empty()) {
+			return;
+		}
+
+		size_t dataSize = 0;
+		vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr);
+		std::vector<char> cacheData(dataSize);
+		if (dataSize == 0 || vkGetPipelineCacheData(device, pipelineCache, &dataSize, cacheData.data()) != VK_SUCCESS) {
+			return;
+		}
+
+		std::ofstream file(settings.pipelineCachePath, std::ios::binary);
+		file.write(cacheData.data(), dataSize);
 	}
 
 	// Function to create Frame buffers
@@ -1357,10 +5359,13 @@ private:
 		for (size_t i = 0; i < swapChainImageViews.size(); i++) {
 
 			// Attachments for current image view
-			std::array<VkImageView, 2> attachments = {
-	swapChainImageViews[i],
-	depthImageView
-			};
+			// With multisampling the swap chain image is the resolve attachment after the multisampled colour and depth
+			// At a dynamic resolution the scene image of the swap chain image takes its place
+			VkImageView targetView = dynamicResolutionEnabled ? sceneColorImageViews[i] : swapChainImageViews[i];
+			std::vector<VkImageView> attachments = { targetView, depthImageView };
+			if (msaaSamples != VK_SAMPLE_COUNT_1_BIT) {
+				attachments = { colorImageView, depthImageView, targetView };
+			}
 
 			// Frame buffer create info
 			VkFramebufferCreateInfo framebufferInfo = {};
@@ -1403,8 +5408,8 @@ private:
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		// Specify the graphics queue family index as the commands are for drawing
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-		// Set the flag to zero as command buffers will be recorded only at the program start
-		poolInfo.flags = 0; // Optional
+		// Allow resetting single command buffers, as they are re-recorded one at a time when the graphics pipeline variant changes
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 		// Create command pool
 		// 1st Parameter - GPU
@@ -1417,6 +5422,29 @@ private:
 		}
 	}
 	
+	// Function to allocate device memory, counting the live allocations and bytes of each heap
+	VkResult allocateMemory(const VkMemoryAllocateInfo& allocInfo, VkDeviceMemory& memory) {
+		VkResult result = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+		if (result == VK_SUCCESS) {
+			uint32_t heapIndex = memoryProperties.memoryTypes[allocInfo.memoryTypeIndex].heapIndex;
+			liveAllocations[memory] = std::make_pair(heapIndex, allocInfo.allocationSize);
+			heapAllocationCounts[heapIndex]++;
+			heapAllocatedBytes[heapIndex] += allocInfo.allocationSize;
+		}
+		return result;
+	}
+
+	// Function to free device memory allocated with allocateMemory
+	void freeMemory(VkDeviceMemory memory) {
+		auto allocation = liveAllocations.find(memory);
+		if (allocation != liveAllocations.end()) {
+			heapAllocationCounts[allocation->second.first]--;
+			heapAllocatedBytes[allocation->second.first] -= allocation->second.second;
+			liveAllocations.erase(allocation);
+		}
+		vkFreeMemory(device, memory, nullptr);
+	}
+
 	// Function to create a buffer
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
 		VkBufferCreateInfo bufferInfo = {};
@@ -1437,7 +5465,7 @@ private:
 		allocInfo.allocationSize = memRequirements.size;
 		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
 
-		if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
+		if (allocateMemory(allocInfo, bufferMemory) != VK_SUCCESS) {
 			throw std::runtime_error("failed to allocate buffer memory!");
 		}
 
@@ -1445,7 +5473,7 @@ private:
 	}
 
 	// Function to create a image view
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
 		VkImageViewCreateInfo viewInfo = {};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 		viewInfo.image = image;
@@ -1453,7 +5481,7 @@ private:
 		viewInfo.format = format;
 		viewInfo.subresourceRange.aspectMask = aspectFlags;
 		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.levelCount = mipLevels;
 		viewInfo.subresourceRange.baseArrayLayer = 0;
 		viewInfo.subresourceRange.layerCount = 1;
 
@@ -1466,10 +5494,40 @@ private:
 	}
 
 	// Function to create depth resources for depth buffer
+	// The depth is never stored, so it is a transient attachment that may live in lazily allocated memory
 	void createDepthResources() {
 		VkFormat depthFormat = findDepthFormat();
-		createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-		depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+		createImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, transientAttachmentMemoryProperties(), depthImage, depthImageMemory, msaaSamples);
+		depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+	}
+
+	// Function to create the multisampled colour image resolved into the swap chain images
+	// Like the depth, it is never stored and may live in lazily allocated memory
+	// At a dynamic resolution the scene images of the swap chain images are created here too
+	void createColorResources() {
+		if (dynamicResolutionEnabled) {
+			sceneColorImages.resize(swapChainImages.size());
+			sceneColorImagesMemory.resize(swapChainImages.size());
+			sceneColorImageViews.resize(swapChainImages.size());
+			for (size_t i = 0; i < swapChainImages.size(); i++) {
+				createImage(swapChainExtent.width, swapChainExtent.height, 1, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sceneColorImages[i], sceneColorImagesMemory[i]);
+				sceneColorImageViews[i] = createImageView(sceneColorImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+			}
+		}
+
+		if (msaaSamples == VK_SAMPLE_COUNT_1_BIT) {
+			return;
+		}
+
+		createImage(swapChainExtent.width, swapChainExtent.height, 1, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, transientAttachmentMemoryProperties(), colorImage, colorImageMemory, msaaSamples);
+		colorImageView = createImageView(colorImage, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+	}
+
+	// Function to get the memory properties preferred for transient attachments
+	// Lazily allocated memory is only backed when the tiles of the attachment spill out of the GPU
+	// createImage falls back to device local memory when none of the memory types the image can live in is lazily allocated
+	VkMemoryPropertyFlags transientAttachmentMemoryProperties() {
+		return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
 	}
 		
 	// Function to find the suitable depth format
@@ -1495,95 +5553,730 @@ private:
 			}
 		}
 
-		throw std::runtime_error("failed to find supported format!");
+		throw std::runtime_error("failed to find supported format!");
+	}
+	
+	// Function to create descriptor sets for each Vk Buffer
+	// The sets come from the descriptor allocator, which writes them the first time they are asked for
+	void createDescriptorSets() {
+		descriptorSets.resize(swapChainImages.size());
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			VkDescriptorBufferInfo bufferInfo = {};
+			bufferInfo.buffer = uniformBuffers[i];
+			bufferInfo.offset = 0;
+			bufferInfo.range = sizeof(UniformBufferObject);
+
+			VkDescriptorBufferInfo lightingBufferInfo = {};
+			lightingBufferInfo.buffer = lightingBuffers[i];
+			lightingBufferInfo.offset = 0;
+			lightingBufferInfo.range = sizeof(LightingConstants);
+
+			VkDescriptorImageInfo imageInfo = {};
+			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo.imageView = textureImageView;
+			imageInfo.sampler = textureSampler;
+
+			VkDescriptorBufferInfo objectBufferInfo = {};
+			objectBufferInfo.buffer = objectBuffer;
+			objectBufferInfo.offset = 0;
+			objectBufferInfo.range = VK_WHOLE_SIZE;
+
+			VkDescriptorBufferInfo clusterBufferInfo = {};
+			clusterBufferInfo.buffer = clusterBuffers[i];
+			clusterBufferInfo.offset = 0;
+			clusterBufferInfo.range = VK_WHOLE_SIZE;
+
+			VkDescriptorBufferInfo drawOrderBufferInfo = {};
+			drawOrderBufferInfo.buffer = cullingEnabled ? culledDrawOrderBuffers[i] : drawOrderBuffers[i];
+			drawOrderBufferInfo.offset = 0;
+			drawOrderBufferInfo.range = VK_WHOLE_SIZE;
+
+			VkDescriptorImageInfo shadowMapInfo = {};
+			shadowMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			shadowMapInfo.imageView = shadowMapImageView;
+			shadowMapInfo.sampler = shadowMapSampler;
+
+			std::vector<VkWriteDescriptorSet> descriptorWrites(7, VkWriteDescriptorSet());
+
+			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[0].dstBinding = 0;
+			descriptorWrites[0].dstArrayElement = 0;
+			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			descriptorWrites[0].descriptorCount = 1;
+			descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[1].dstBinding = 1;
+			descriptorWrites[1].dstArrayElement = 0;
+			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			descriptorWrites[1].descriptorCount = 1;
+			descriptorWrites[1].pBufferInfo = &lightingBufferInfo;
+
+			descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[2].dstBinding = 2;
+			descriptorWrites[2].dstArrayElement = 0;
+			descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[2].descriptorCount = 1;
+			descriptorWrites[2].pImageInfo = &imageInfo;
+
+			descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[3].dstBinding = 3;
+			descriptorWrites[3].dstArrayElement = 0;
+			descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[3].descriptorCount = 1;
+			descriptorWrites[3].pBufferInfo = &objectBufferInfo;
+
+			descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[4].dstBinding = 4;
+			descriptorWrites[4].dstArrayElement = 0;
+			descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[4].descriptorCount = 1;
+			descriptorWrites[4].pBufferInfo = &clusterBufferInfo;
+
+			descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[5].dstBinding = 7;
+			descriptorWrites[5].dstArrayElement = 0;
+			descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[5].descriptorCount = 1;
+			descriptorWrites[5].pBufferInfo = &drawOrderBufferInfo;
+
+			descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[6].dstBinding = 8;
+			descriptorWrites[6].dstArrayElement = 0;
+			descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[6].descriptorCount = 1;
+			descriptorWrites[6].pImageInfo = &shadowMapInfo;
+
+			// The bindless texture array is partially bound, so only the loaded textures are written
+			std::vector<VkDescriptorImageInfo> textureInfos;
+			for (VkImageView view : bindlessTextureViews) {
+				textureInfos.push_back({ textureSampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+			}
+
+			VkDescriptorBufferInfo materialBufferInfo = {};
+			materialBufferInfo.buffer = materialBuffer;
+			materialBufferInfo.offset = 0;
+			materialBufferInfo.range = VK_WHOLE_SIZE;
+
+			if (bindlessEnabled) {
+				VkWriteDescriptorSet texturesWrite = {};
+				texturesWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				texturesWrite.dstBinding = 5;
+				texturesWrite.dstArrayElement = 0;
+				texturesWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				texturesWrite.descriptorCount = static_cast<uint32_t>(std::min<size_t>(textureInfos.size(), bindlessTextureCount));
+				texturesWrite.pImageInfo = textureInfos.data();
+				descriptorWrites.push_back(texturesWrite);
+
+				VkWriteDescriptorSet materialWrite = {};
+				materialWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				materialWrite.dstBinding = 6;
+				materialWrite.dstArrayElement = 0;
+				materialWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				materialWrite.descriptorCount = 1;
+				materialWrite.pBufferInfo = &materialBufferInfo;
+				descriptorWrites.push_back(materialWrite);
+			}
+
+			descriptorSets[i] = descriptorAllocator.getSet(descriptorSetLayout, descriptorWrites);
+		}
+	}
+
+	// Function to get the GPU scopes as trace events, shifted by an offset in nanoseconds
+	std::vector<TraceEvent> gpuTraceEvents(int64_t offsetNanoseconds) {
+		std::vector<TraceEvent> events;
+		for (const auto& timing : gpuProfiler.trace()) {
+			events.push_back({ timing.name, "gpu", "gpu", static_cast<uint64_t>(static_cast<int64_t>(timing.startNanoseconds) + offsetNanoseconds), static_cast<uint64_t>(timing.durationNanoseconds) });
+		}
+		return events;
+	}
+
+	// Function to find the offset from the GPU timestamp clock to the steady clock in nanoseconds
+	// Reads both clocks together with calibrated timestamps when the steady clock is CLOCK_MONOTONIC.
+	// Otherwise writes a timestamp in a command buffer and takes the midpoint of its submission and completion, accurate to the submission latency
+	int64_t gpuClockOffset() {
+#if defined(__linux__)
+		if (getCalibratedTimestamps != nullptr && isTimeDomainCalibrateable(VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT)) {
+			VkCalibratedTimestampInfoEXT timestampInfos[2] = {};
+			timestampInfos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+			timestampInfos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+			timestampInfos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+			timestampInfos[1].timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+
+			uint64_t timestamps[2];
+			uint64_t maxDeviation;
+			if (getCalibratedTimestamps(device, 2, timestampInfos, timestamps, &maxDeviation) == VK_SUCCESS) {
+				uint64_t gpuNanoseconds = static_cast<uint64_t>((timestamps[0] & timestampMask) * static_cast<double>(timestampPeriod));
+				return static_cast<int64_t>(timestamps[1]) - static_cast<int64_t>(gpuNanoseconds);
+			}
+		}
+#endif
+		if (timestampMask == 0) {
+			return 0;
+		}
+
+		VkQueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 1;
+
+		VkQueryPool queryPool;
+		if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create calibration query pool!");
+		}
+
+		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		vkCmdResetQueryPool(commandBuffer, queryPool, 0, 1);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+		uint64_t submitted = steadyClockNanoseconds();
+		endSingleTimeCommands(commandBuffer);
+		uint64_t completed = steadyClockNanoseconds();
+
+		uint64_t timestamp = 0;
+		vkGetQueryPoolResults(device, queryPool, 0, 1, sizeof(timestamp), &timestamp, sizeof(timestamp), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		vkDestroyQueryPool(device, queryPool, nullptr);
+
+		uint64_t gpuNanoseconds = static_cast<uint64_t>((timestamp & timestampMask) * static_cast<double>(timestampPeriod));
+		return static_cast<int64_t>(submitted + (completed - submitted) / 2) - static_cast<int64_t>(gpuNanoseconds);
+	}
+
+	// Function to check whether the device can read a host clock together with its own
+	bool isTimeDomainCalibrateable(VkTimeDomainEXT timeDomain) {
+		auto getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+		if (getTimeDomains == nullptr) {
+			return false;
+		}
+
+		uint32_t timeDomainCount = 0;
+		getTimeDomains(physicalDevice, &timeDomainCount, nullptr);
+		std::vector<VkTimeDomainEXT> timeDomains(timeDomainCount);
+		getTimeDomains(physicalDevice, &timeDomainCount, timeDomains.data());
+		return std::find(timeDomains.begin(), timeDomains.end(), timeDomain) != timeDomains.end();
+	}
+
+	// Function to create the GPU profiler for the swap chain images when profiling or benchmarking
+	void createGpuProfiler() {
+		if ((!settings.gpuProfiling && !settings.benchmark && settings.cpuTracePath.empty() && !settings.dynamicResolution) || timestampMask == 0) {
+			return;
+		}
+		gpuProfiler.create(device, static_cast<uint32_t>(swapChainImages.size()), timestampPeriod, timestampMask);
+	}
+
+	// Function to read the GPU scopes of the last frame rendered to a swap chain image
+	// The first scope spans the whole command buffer and gives the GPU frame time of the benchmark
+	void collectGpuProfile(uint32_t imageIndex) {
+		if (!gpuProfiler.collect(imageIndex)) {
+			return;
+		}
+
+		const auto& frameScope = gpuProfiler.latest().front();
+		recordFrameTime(gpuFrameTimes, sweepGpuFrameTimes, frameScope.frame, frameScope.durationNanoseconds / 1000000.0);
+
+		// The GPU frame time drives the scale of the dynamic resolution
+		if (dynamicResolutionEnabled) {
+			resolutionController.update(frameScope.durationNanoseconds / 1000000.0);
+		}
+	}
+
+	// Function to create the pipeline statistics queries of the swap chain images when metrics are written
+	void createStatisticsQueries() {
+		if (settings.metricsPath.empty()) {
+			return;
+		}
+		metricsPending.assign(swapChainImages.size(), false);
+
+		if (!pipelineStatisticsSupported) {
+			return;
+		}
+
+		VkQueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		queryPoolInfo.queryCount = static_cast<uint32_t>(swapChainImages.size());
+		queryPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+			| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+		if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &statisticsQueryPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline statistics query pool!");
+		}
+	}
+
+	// Function to record the metrics of the last frame rendered to a swap chain image, writing the metrics file every few frames
+	// The swap chain image must not be in use by the GPU
+	void collectFrameMetrics(uint32_t imageIndex) {
+		if (metricsPending.empty() || !metricsPending[imageIndex]) {
+			return;
+		}
+		metricsPending[imageIndex] = false;
+		metrics.add("frames_total", 1);
+
+		// The culling pass decides on the GPU how many meshes are drawn
+		uint64_t draws = cullingEnabled ? readCulledDrawCount(imageIndex) : drawCommands.size();
+		metrics.set("frame_draws", static_cast<double>(draws));
+		metrics.add("draws_total", static_cast<double>(draws));
+
+		// Without pipeline statistics the triangles are counted before culling
+		uint64_t triangles = sceneTriangleCount;
+		if (statisticsQueryPool != VK_NULL_HANDLE) {
+			// The results follow the order of the statistic bits: input assembly primitives, vertex shader invocations, clipping primitives, fragment shader invocations
+			uint64_t statistics[4];
+			if (vkGetQueryPoolResults(device, statisticsQueryPool, imageIndex, 1, sizeof(statistics), statistics, sizeof(statistics), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+				triangles = statistics[0];
+				metrics.set("frame_vertex_shader_invocations", static_cast<double>(statistics[1]));
+				metrics.set("frame_clipping_primitives", static_cast<double>(statistics[2]));
+				metrics.set("frame_fragment_shader_invocations", static_cast<double>(statistics[3]));
+			}
+		}
+		metrics.set("frame_triangles", static_cast<double>(triangles));
+		metrics.add("triangles_total", static_cast<double>(triangles));
+
+		framesSinceMetricsWrite++;
+		if (framesSinceMetricsWrite >= settings.metricsIntervalFrames) {
+			writeMetrics();
+		}
+	}
+
+	// Function to update the device memory metrics and write all metrics to the metrics file
+	void writeMetrics() {
+		if (settings.metricsPath.empty()) {
+			return;
+		}
+		framesSinceMetricsWrite = 0;
+
+		// The budget is the memory of a heap the application can use without degrading performance. Usage includes other processes
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+		budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		if (getPhysicalDeviceMemoryProperties2 != nullptr) {
+			VkPhysicalDeviceMemoryProperties2 properties = {};
+			properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+			properties.pNext = &budget;
+			getPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+		}
+
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			std::string heap = "{heap=\"" + std::to_string(i) + "\"}";
+			metrics.set("vulkan_memory_allocations" + heap, heapAllocationCounts[i]);
+			metrics.set("vulkan_memory_allocated_bytes" + heap, static_cast<double>(heapAllocatedBytes[i]));
+			metrics.set("vulkan_memory_heap_size_bytes" + heap, static_cast<double>(memoryProperties.memoryHeaps[i].size));
+			if (getPhysicalDeviceMemoryProperties2 != nullptr) {
+				metrics.set("vulkan_memory_heap_budget_bytes" + heap, static_cast<double>(budget.heapBudget[i]));
+				metrics.set("vulkan_memory_heap_usage_bytes" + heap, static_cast<double>(budget.heapUsage[i]));
+			}
+		}
+
+		metrics.set("vulkan_descriptor_pools", static_cast<double>(descriptorAllocator.poolCount()));
+
+		if (!metrics.writeTextFile(settings.metricsPath)) {
+			std::cerr << "failed to write metrics to " << settings.metricsPath << std::endl;
+		}
+	}
+
+	// Function to get the position along the scripted benchmark path, from 0 to 1 over the frames of the benchmark
+	// Depends only on the frame no so that every run renders the same frames. Every step of the light sweep replays the whole path
+	float benchmarkProgress() const {
+		uint64_t frames = std::max<uint64_t>(1, settings.lightSweep ? settings.lightSweepStepFrames : settings.frameCount);
+		return static_cast<float>(frameCounter % frames) / frames;
+	}
+
+	// Function to add the frame time of a frame to the benchmark statistics, and to those of its step of the light sweep
+	// The warmup frames at the start of the benchmark, and of every step of the sweep, are left out
+	void recordFrameTime(std::vector<double>& frameTimes, std::map<uint32_t, std::vector<double>>& sweepFrameTimes, uint64_t frame, double milliseconds) {
+		if (!settings.benchmark) {
+			return;
+		}
+		uint64_t stepFrame = settings.lightSweep ? frame % std::max<uint64_t>(1, settings.lightSweepStepFrames) : frame;
+		if (stepFrame < settings.benchmarkWarmupFrames) {
+			return;
+		}
+		frameTimes.push_back(milliseconds);
+		if (settings.lightSweep) {
+			sweepFrameTimes[activePointLightCount(frame)].push_back(milliseconds);
+		}
+	}
+
+	// Function to print the benchmark results and write them as JSON
+	void writeBenchmarkResults() {
+		FrameTimeSummary cpu = summarizeFrameTimes(cpuFrameTimes);
+		FrameTimeSummary gpu = summarizeFrameTimes(gpuFrameTimes);
+
+		auto printSummary = [](const char* name, const FrameTimeSummary& summary) {
+			std::cout << name << ": mean " << summary.mean << " ms, p50 " << summary.p50 << " ms, p95 " << summary.p95 << " ms, p99 " << summary.p99
+				<< " ms, variance " << summary.variance << " ms^2 over " << summary.count << " frames" << std::endl;
+		};
+		std::cout << "msaa: " << msaaSamples << " samples per pixel" << std::endl;
+		printSummary("cpu frame time", cpu);
+		if (gpu.count > 0) {
+			printSummary("gpu frame time", gpu);
+		}
+		else if (!settings.software) {
+			std::cout << "gpu frame time: timestamps not supported" << std::endl;
+		}
+		for (const auto& step : sweepCpuFrameTimes) {
+			std::cout << step.first << " point lights: cpu mean " << summarizeFrameTimes(step.second).mean << " ms";
+			if (sweepGpuFrameTimes.count(step.first) > 0) {
+				std::cout << ", gpu mean " << summarizeFrameTimes(sweepGpuFrameTimes[step.first]).mean << " ms";
+			}
+			std::cout << std::endl;
+		}
+
+		std::ofstream file(settings.benchmarkOutputPath);
+		if (!file.is_open()) {
+			throw std::runtime_error("failed to open benchmark output file!");
+		}
+
+		auto writeSummary = [&file](const FrameTimeSummary& summary) {
+			file << "{ \"count\": " << summary.count << ", \"mean\": " << summary.mean << ", \"variance\": " << summary.variance
+				<< ", \"min\": " << summary.minimum << ", \"max\": " << summary.maximum
+				<< ", \"p50\": " << summary.p50 << ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99 << " }";
+		};
+
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+		std::string deviceName;
+		for (const char* c = deviceProperties.deviceName; *c != '\0'; c++) {
+			if (*c == '"' || *c == '\\') {
+				deviceName += '\\';
+			}
+			deviceName += *c;
+		}
+
+		file.precision(6);
+		file << std::fixed;
+		file << "{\n";
+		file << "  \"device\": \"" << deviceName << "\",\n";
+		file << "  \"width\": " << swapChainExtent.width << ",\n";
+		file << "  \"height\": " << swapChainExtent.height << ",\n";
+		file << "  \"headless\": " << (settings.headless ? "true" : "false") << ",\n";
+		file << "  \"objects\": " << sceneObjects.size() << ",\n";
+		file << "  \"instancing\": " << (settings.instancing ? "true" : "false") << ",\n";
+		file << "  \"gpu_culling\": " << (cullingEnabled ? "true" : "false") << ",\n";
+		file << "  \"push_constants\": " << (settings.pushConstantDraws ? "true" : "false") << ",\n";
+		file << "  \"bindless\": " << (bindlessEnabled ? "true" : "false") << ",\n";
+		file << "  \"depth_prepass\": " << (settings.depthPrepass ? "true" : "false") << ",\n";
+		file << "  \"draw_sorting\": " << (settings.sortDraws ? "true" : "false") << ",\n";
+		file << "  \"shadows\": " << (settings.shadows ? "true" : "false") << ",\n";
+		file << "  \"shadow_map_size\": " << settings.shadowMapSize << ",\n";
+		file << "  \"msaa_samples\": " << msaaSamples << ",\n";
+		file << "  \"dynamic_resolution\": " << (dynamicResolutionEnabled ? "true" : "false") << ",\n";
+		file << "  \"resolution_scale\": " << (dynamicResolutionEnabled ? resolutionController.scale() : 1.0f) << ",\n";
+		file << "  \"frames\": " << settings.frameCount << ",\n";
+		file << "  \"warmup_frames\": " << settings.benchmarkWarmupFrames << ",\n";
+		file << "  \"point_lights\": " << settings.pointLightCount << ",\n";
+		if (settings.lightSweep) {
+			file << "  \"light_sweep\": [";
+			for (auto step = sweepCpuFrameTimes.begin(); step != sweepCpuFrameTimes.end(); ++step) {
+				file << (step == sweepCpuFrameTimes.begin() ? "\n" : ",\n") << "    { \"point_lights\": " << step->first << ", \"cpu_frame_time_ms\": ";
+				writeSummary(summarizeFrameTimes(step->second));
+				file << ", \"gpu_frame_time_ms\": ";
+				if (sweepGpuFrameTimes.count(step->first) > 0) {
+					writeSummary(summarizeFrameTimes(sweepGpuFrameTimes[step->first]));
+				}
+				else {
+					file << "null";
+				}
+				file << " }";
+			}
+			file << "\n  ],\n";
+		}
+		file << "  \"cpu_frame_time_ms\": ";
+		writeSummary(cpu);
+		file << ",\n";
+		file << "  \"gpu_frame_time_ms\": ";
+		if (gpu.count > 0) {
+			writeSummary(gpu);
+		}
+		else {
+			file << "null";
+		}
+		file << "\n}\n";
+
+		std::cout << "benchmark results written to " << settings.benchmarkOutputPath << std::endl;
+	}
+
+	// Function to create the readback slots for each swap chain image when exporting frames
+	// Cached memory is preferred as the CPU reads every byte of the buffers
+	void createReadbackBuffers() {
+		readbackSlots.clear();
+		if (settings.exportPath.empty() && settings.goldenDirectory.empty()) {
+			return;
+		}
+
+		bool bgra = swapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM || swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+		bool rgba = swapChainImageFormat == VK_FORMAT_R8G8B8A8_UNORM || swapChainImageFormat == VK_FORMAT_R8G8B8A8_SRGB;
+		if (!bgra && !rgba) {
+			throw std::runtime_error("failed to export frames of an unsupported swap chain format!");
+		}
+
+		VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		if (!isMemoryTypeAvailable(properties)) {
+			properties &= ~VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		}
+
+		VkDeviceSize size = static_cast<VkDeviceSize>(swapChainExtent.width) * swapChainExtent.height * 4;
+		readbackSlots.resize(swapChainImages.size());
+		for (auto& slot : readbackSlots) {
+			createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, properties, slot.buffer, slot.memory);
+			vkMapMemory(device, slot.memory, 0, size, 0, &slot.mapped);
+			slot.width = swapChainExtent.width;
+			slot.height = swapChainExtent.height;
+			slot.bgra = bgra;
+			slot.pending = false;
+			slot.frame = 0;
+		}
+	}
+
+	// Function to hand the image of a readback slot to the image writer
+	void consumeReadback(ReadbackSlot& slot) {
+		if (!slot.pending) {
+			return;
+		}
+		TRACE_SCOPE("consume readback");
+		slot.pending = false;
+
+		ImageWriteJob job;
+		job.path = exportFramePath(settings.exportPath, slot.frame);
+		job.width = slot.width;
+		job.height = slot.height;
+		job.bgra = slot.bgra;
+		const uint8_t* pixels = static_cast<const uint8_t*>(slot.mapped);
+		job.pixels.assign(pixels, pixels + static_cast<size_t>(slot.width) * slot.height * 4);
+		if (!settings.goldenDirectory.empty()) {
+			checkGolden(slot.frame, job);
+		}
+		if (imageWriter) {
+			imageWriter->submit(std::move(job));
+		}
+	}
+
+	// Function to set up the camera and the lighting toggles of the canonical view rendered in a frame
+	void applyCanonicalView(uint64_t frame) {
+		const CanonicalView& view = canonicalViews[frame % canonicalViewCount];
+		translate_x = view.translateX;
+		translate_y = view.translateY;
+		rotate_x = view.rotateX;
+		rotate_y = view.rotateY;
+		lightingConstants.ambientEnabled = view.ambient ? 1.0f : 0.0f;
+		lightingConstants.DiffuseEnabled = view.diffuse ? 1.0f : 0.0f;
+		lightingConstants.specularEnabled = view.specular ? 1.0f : 0.0f;
+		lightingConstants.textureEnabled = view.texture ? 1.0f : 0.0f;
+	}
+
+	// Function to compare the image rendered in a frame with the golden image of its canonical view, or to replace the golden image
+	// The rendered image and the amplified differences are written to the diff directory when the view fails
+	void checkGolden(uint64_t frame, ImageWriteJob image) {
+		const CanonicalView& view = canonicalViews[frame % canonicalViewCount];
+		std::string goldenPath = settings.goldenDirectory + "/" + view.name + ".ppm";
+		convertToRgba(image);
+
+		if (settings.goldenUpdate) {
+			image.path = goldenPath;
+			if (!writePpm(image)) {
+				throw std::runtime_error("failed to write golden image " + goldenPath + "!");
+			}
+			std::cout << "golden " << view.name << ": updated" << std::endl;
+			return;
+		}
+
+		goldenChecks++;
+		ImageWriteJob golden;
+		if (!readPpm(goldenPath, golden)) {
+			goldenFailures++;
+			std::cout << "golden " << view.name << ": FAILED, cannot read " << goldenPath << std::endl;
+			return;
+		}
+		if (golden.width != image.width || golden.height != image.height) {
+			goldenFailures++;
+			std::cout << "golden " << view.name << ": FAILED, golden is " << golden.width << "x" << golden.height << " but the image is " << image.width << "x" << image.height << std::endl;
+			return;
+		}
+
+		ImageWriteJob diff;
+		ImageComparison comparison = compareImages(golden, image, settings.goldenTolerance, diff);
+		double differingFraction = static_cast<double>(comparison.differingPixels) / (static_cast<double>(image.width) * image.height);
+		bool passed = differingFraction <= settings.goldenMaxDifferingPixels && comparison.ssim >= settings.goldenMinSsim;
+
+		std::cout << "golden " << view.name << ": " << (passed ? "passed" : "FAILED") << ", " << comparison.differingPixels << " differing pixels ("
+			<< differingFraction * 100.0 << "%), max difference " << comparison.maxDifference << ", mean difference " << comparison.meanDifference
+			<< ", SSIM " << comparison.ssim << std::endl;
+
+		if (!passed) {
+			goldenFailures++;
+			image.path = settings.goldenDiffDirectory + "/" + view.name + "_actual.png";
+			diff.path = settings.goldenDiffDirectory + "/" + view.name + "_diff.png";
+			if (!writePng(image) || !writePng(diff)) {
+				std::cerr << "failed to write the diff images of " << view.name << std::endl;
+			}
+		}
+	}
+
+	// Function to report the golden image check, failing when a view differs from its golden image
+	void reportGoldenResults() {
+		if (settings.goldenDirectory.empty() || settings.goldenUpdate) {
+			return;
+		}
+
+		std::cout << "golden image check: " << goldenChecks - goldenFailures << " of " << goldenChecks << " views passed" << std::endl;
+		if (goldenFailures > 0 || goldenChecks < canonicalViewCount) {
+			throw std::runtime_error("golden image check failed!");
+		}
 	}
-	
-	// Function to create descriptor pool to create descriptor sets
-	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 3> poolSizes = {};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
-		poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[2].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
 
-		VkDescriptorPoolCreateInfo poolInfo = {};
-		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());
+	// Function to write the remaining frames and report the export rate
+	void finishExport() {
+		if (readbackSlots.empty() && !imageWriter) {
+			return;
+		}
 
-		if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create descriptor pool!");
+		// Every frame has completed, so the slots retired with an old swap chain can be consumed along with the current ones
+		deletionQueue.flushAll();
+		for (auto& slot : readbackSlots) {
+			consumeReadback(slot);
+		}
+		if (!imageWriter) {
+			return;
+		}
+		imageWriter->finish();
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - exportStartTime).count();
+		uint32_t written = imageWriter->writtenCount;
+		std::cout << "exported " << written << " frames in " << seconds << " s";
+		if (seconds > 0.0) {
+			std::cout << " (" << written / seconds << " fps end to end)";
+		}
+		std::cout << std::endl;
+
+		if (imageWriter->failedCount > 0) {
+			throw std::runtime_error("failed to write exported frames!");
 		}
 	}
 
-	// Function to create descriptor sets for each Vk Buffer
-	void createDescriptorSets() {
-		std::vector<VkDescriptorSetLayout> layouts(swapChainImages.size(), descriptorSetLayout);
-		VkDescriptorSetAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = descriptorPool;
-		allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
-		allocInfo.pSetLayouts = layouts.data();
+	// Function to record the copy of a swap chain image to its readback slot after the render pass
+	void recordReadback(VkCommandBuffer commandBuffer, size_t imageIndex) {
+		// Layout the render pass or the upscale leaves the image in
+		VkImageLayout renderedLayout = settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
-		descriptorSets.resize(swapChainImages.size());
-		if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate descriptor sets!");
+		// Wait for the colour writes, or the upscale at a dynamic resolution, and move the image to the transfer source layout
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = dynamicResolutionEnabled ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.oldLayout = renderedLayout;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = swapChainImages[imageIndex];
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		VkPipelineStageFlags renderedStage = dynamicResolutionEnabled ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		vkCmdPipelineBarrier(commandBuffer, renderedStage, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkBufferImageCopy region = {};
+		region.bufferOffset = 0;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { swapChainExtent.width, swapChainExtent.height, 1 };
+		vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackSlots[imageIndex].buffer, 1, &region);
+
+		// Make the copy visible to the host
+		VkMemoryBarrier hostBarrier = {};
+		hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+		// Return swap chain images to the presentation layout
+		if (!settings.headless) {
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.dstAccessMask = 0;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 		}
+	}
+
+	// Function to create the descriptor sets of the culling pass for each swap chain image
+	void createCullingDescriptorSets() {
+		cullingDescriptorSets.resize(swapChainImages.size());
 
 		for (size_t i = 0; i < swapChainImages.size(); i++) {
-			VkDescriptorBufferInfo bufferInfo = {};
-			bufferInfo.buffer = uniformBuffers[i];
-			bufferInfo.offset = 0;
-			bufferInfo.range = sizeof(UniformBufferObject);
+			// Uniform buffer, object buffer, culled draw order, culled draws, culled draw counts and draw order
+			std::array<VkDescriptorBufferInfo, 6> bufferInfos = {};
+			bufferInfos[0] = { uniformBuffers[i], 0, sizeof(UniformBufferObject) };
+			bufferInfos[1] = { objectBuffer, 0, VK_WHOLE_SIZE };
+			bufferInfos[2] = { culledDrawOrderBuffers[i], 0, VK_WHOLE_SIZE };
+			bufferInfos[3] = { culledDrawBuffers[i], 0, VK_WHOLE_SIZE };
+			bufferInfos[4] = { culledDrawCountBuffers[i], 0, VK_WHOLE_SIZE };
+			bufferInfos[5] = { drawOrderBuffers[i], 0, VK_WHOLE_SIZE };
+
+			std::vector<VkWriteDescriptorSet> descriptorWrites(6, VkWriteDescriptorSet());
+			for (uint32_t j = 0; j < descriptorWrites.size(); j++) {
+				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[j].dstBinding = j;
+				descriptorWrites[j].dstArrayElement = 0;
+				descriptorWrites[j].descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				descriptorWrites[j].descriptorCount = 1;
+				descriptorWrites[j].pBufferInfo = &bufferInfos[j];
+			}
 
-			VkDescriptorBufferInfo lightingBufferInfo = {};
-			lightingBufferInfo.buffer = lightingBuffers[i];
-			lightingBufferInfo.offset = 0;
-			lightingBufferInfo.range = sizeof(LightingConstants);
+			cullingDescriptorSets[i] = descriptorAllocator.getSet(cullingDescriptorSetLayout, descriptorWrites);
+		}
+	}
 
-			VkDescriptorImageInfo imageInfo = {};
-			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageInfo.imageView = textureImageView;
-			imageInfo.sampler = textureSampler;
+	// Function to create the compute pipeline culling the scene objects against the view frustum
+	// Binding 0 - uniform buffer with the view and projection, 1 - objects, 2 - culled draw order, 3 - culled draws, 4 - culled draw counts, 5 - draw order
+	void createCullingPipeline() {
+		std::vector<VkDescriptorSetLayoutBinding> bindings(6, VkDescriptorSetLayoutBinding());
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			bindings[i].pImmutableSamplers = nullptr;
+		}
 
-			std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+		cullingDescriptorSetLayout = descriptorAllocator.getLayout(bindings);
 
-			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[0].dstSet = descriptorSets[i];
-			descriptorWrites[0].dstBinding = 0;
-			descriptorWrites[0].dstArrayElement = 0;
-			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			descriptorWrites[0].descriptorCount = 1;
-			descriptorWrites[0].pBufferInfo = &bufferInfo;
+		// The no of objects is passed as a push constant
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(uint32_t);
 
-			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[1].dstSet = descriptorSets[i];
-			descriptorWrites[1].dstBinding = 1;
-			descriptorWrites[1].dstArrayElement = 0;
-			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			descriptorWrites[1].descriptorCount = 1;
-			descriptorWrites[1].pBufferInfo = &lightingBufferInfo;
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &cullingDescriptorSetLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-			descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[2].dstSet = descriptorSets[i];
-			descriptorWrites[2].dstBinding = 2;
-			descriptorWrites[2].dstArrayElement = 0;
-			descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			descriptorWrites[2].descriptorCount = 1;
-			descriptorWrites[2].pImageInfo = &imageInfo;
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullingPipelineLayout) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling pipeline layout!");
+		}
 
-			try
-			{
-				vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-			}
-			catch (...)
-			{
+		auto computeShaderCode = readShader("shaders/cull.spv");
+		VkShaderModule computeShaderModule = createShaderModule(computeShaderCode);
 
-			}
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = computeShaderModule;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = cullingPipelineLayout;
+
+		if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &cullingPipeline) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling pipeline!");
 		}
+
+		vkDestroyShaderModule(device, computeShaderModule, nullptr);
 	}
 
 	// Function to create Uniform Buffers
@@ -1598,59 +6291,434 @@ private:
 		lightingBuffers.resize(swapChainImages.size());
 		lightingBuffersMemory.resize(swapChainImages.size());
 
+		// The point lights and their clusters change every frame, so they are written by the CPU like the uniforms
+		clusterBuffers.resize(swapChainImages.size());
+		clusterBuffersMemory.resize(swapChainImages.size());
 
 		for (size_t i = 0; i < swapChainImages.size(); i++) {
 			createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
 			createBuffer(lightingBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, lightingBuffers[i], lightingBuffersMemory[i]);
+			createBuffer(clusterBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, clusterBuffers[i], clusterBuffersMemory[i]);
 		}
 	}
 
-	// Function to create Index Buffer
-	void createIndexBuffer() {
-		VkDeviceSize bufferSize = sizeof(m.indices[0]) * m.indices.size();
+	// Function to place the point lights over the area of the flock, each reaching a few of its birds
+	void placePointLights() {
+		// Fixed seed so that every run places the lights identically
+		std::mt19937 generator(4096);
+		std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> shade(0.2f, 1.0f);
+
+		// Distance between neighbouring birds of the flock, and the half width of the flock with a bird to spare
+		const float spacing = 30.0f;
+		uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(settings.instanceCount))));
+		float extent = (side / 2.0f + 1.0f) * spacing;
+
+		pointLights.resize(settings.pointLightCount);
+		for (auto& light : pointLights) {
+			light.position = glm::vec4(offset(generator) * extent, offset(generator) * extent, offset(generator) * spacing * 2.0f, spacing * 2.0f);
+			light.colour = glm::vec4(shade(generator), shade(generator), shade(generator), 1.0f);
+		}
+	}
+
+	// Function to load the meshes and their material, and place them in the scene
+	void loadScene() {
+		// Parse the Object file
+		meshes.push_back(ParseObjFile("12248_Bird_v1_L2.obj"));
+
+		// Use the material of the first mesh to light the scene
+		lightingConstants = meshes[0].lightingConstants;
+
+		// Place the meshes in the scene
+		buildScene();
+
+		// Place the point lights around them
+		placePointLights();
+	}
+
+	// Function to place the loaded meshes in the scene
+	// The first copy of a mesh keeps its original placement and the rest form a flock around it
+	// Copies of the same mesh are stored next to each other so that they can be drawn with one instanced draw
+	void buildScene() {
+		// Fixed seed so that every run places the flock identically
+		std::mt19937 generator(12248);
+		std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+		std::uniform_real_distribution<float> shade(0.6f, 1.0f);
+
+		// Distance between neighbouring birds of the flock
+		const float spacing = 30.0f;
+
+		// No of birds along a side of the flock
+		uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(settings.instanceCount))));
+
+		sceneObjects.clear();
+		for (uint32_t i = 0; i < meshes.size(); i++) {
+			for (uint32_t j = 0; j < settings.instanceCount; j++) {
+				SceneObject object = {};
+				object.meshIndex = i;
+				object.model = glm::mat4(1.0f);
+				object.tint = glm::vec4(1.0f);
+
+				if (j > 0) {
+					// Place the bird on a jittered grid centred on the first bird, with a random heading and shade
+					float x = (static_cast<float>(j % side) - side / 2.0f + offset(generator) * 0.3f) * spacing;
+					float y = (static_cast<float>(j / side) - side / 2.0f + offset(generator) * 0.3f) * spacing;
+					float z = offset(generator) * spacing;
+					object.model = glm::translate(glm::mat4(1.0f), glm::vec3(x, y, z)) * glm::rotate(glm::mat4(1.0f), glm::radians(angle(generator)), glm::vec3(0.0f, 0.0f, 1.0f));
+					object.tint = glm::vec4(shade(generator), shade(generator), shade(generator), 1.0f);
+				}
+
+				sceneObjects.push_back(object);
+			}
+		}
+
+		// Runs of objects sharing a mesh, which the draws of the mesh address through their instance index
+		meshRuns.clear();
+		for (uint32_t i = 0; i < sceneObjects.size(); i++) {
+			if (i == 0 || sceneObjects[i].meshIndex != sceneObjects[i - 1].meshIndex) {
+				meshRuns.push_back({ i, 0 });
+			}
+			meshRuns.back().second++;
+		}
+	}
 
+	// Function to create a device local buffer and fill it with data through a staging buffer
+	void createDeviceLocalBuffer(const void* contents, VkDeviceSize bufferSize, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+		TRACE_SCOPE("upload buffer");
 		VkBuffer stagingBuffer;
 		VkDeviceMemory stagingBufferMemory;
 		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
 		void* data;
 		vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, m.indices.data(), (size_t)bufferSize);
+		memcpy(data, contents, (size_t)bufferSize);
 		vkUnmapMemory(device, stagingBufferMemory);
+		metrics.add("vulkan_upload_bytes_total{kind=\"staging\"}", static_cast<double>(bufferSize));
 
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
 
-		copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+		copyBuffer(stagingBuffer, buffer, bufferSize);
 
 		vkDestroyBuffer(device, stagingBuffer, nullptr);
-		vkFreeMemory(device, stagingBufferMemory, nullptr);
+		freeMemory(stagingBufferMemory);
+	}
+
+	// Function to create Index Buffer
+	// Indices of all meshes are packed into a single index buffer and the range of every mesh is recorded
+	void createIndexBuffer() {
+		std::vector<int> indices;
+		int32_t vertexOffset = 0;
+
+		meshRanges.clear();
+		for (const auto& mesh : meshes) {
+			MeshRange range = {};
+			range.firstIndex = static_cast<uint32_t>(indices.size());
+			range.indexCount = static_cast<uint32_t>(mesh.indices.size());
+			range.vertexOffset = vertexOffset;
+			range.boundingSphere = computeBoundingSphere(mesh.vertices);
+			meshRanges.push_back(range);
+
+			indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+			vertexOffset += static_cast<int32_t>(mesh.vertices.size());
+		}
+
+		VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+		createDeviceLocalBuffer(indices.data(), bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
 	}
 
 	// Function to create Vertex Buffer
+	// Vertices of all meshes are packed into a single vertex buffer shared by every draw
 	void createVertexBuffer() {
+		std::vector<Vertex> vertices;
+		for (const auto& mesh : meshes) {
+			vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+		}
 
-		VkDeviceSize bufferSize = sizeof(m.vertices[0]) * m.vertices.size();
+		VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+		createDeviceLocalBuffer(vertices.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+	}
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+	// Function to create the Object Buffer
+	// The vertex shader reads the data of the object being drawn using the instance index
+	void createObjectBuffer() {
+		std::vector<ObjectData> objects(sceneObjects.size());
+		for (size_t i = 0; i < sceneObjects.size(); i++) {
+			objects[i].model = sceneObjects[i].model;
+			objects[i].tint = sceneObjects[i].tint;
+			objects[i].boundingSphere = meshRanges[sceneObjects[i].meshIndex].boundingSphere;
+			objects[i].meshIndex = sceneObjects[i].meshIndex;
+			objects[i].materialIndex = sceneObjects[i].meshIndex;
+		}
 
-		void* data;
-		vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, m.vertices.data(), (size_t)bufferSize);
-		vkUnmapMemory(device, stagingBufferMemory);
+		VkDeviceSize bufferSize = sizeof(objects[0]) * objects.size();
+		createDeviceLocalBuffer(objects.data(), bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, objectBuffer, objectBufferMemory);
+	}
+
+	// Function to create the Material Buffer and the list of bindless textures
+	// Every mesh has a material, and all of them use the one loaded texture for now
+	void createMaterialBuffer() {
+		bindlessTextureViews = { textureImageView };
 
-		createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+		materials.assign(meshes.size(), MaterialData());
+		for (auto& material : materials) {
+			material.textureIndex = 0;
+		}
 
-		copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+		VkDeviceSize bufferSize = sizeof(materials[0]) * materials.size();
+		createDeviceLocalBuffer(materials.data(), bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, materialBuffer, materialBufferMemory);
+	}
 
-		vkDestroyBuffer(device, stagingBuffer, nullptr);
-		vkFreeMemory(device, stagingBufferMemory, nullptr);
+	// Function to create the Indirect Draw Buffer
+	// Every scene object gets an indexed draw whose first instance is the index of the object in the object buffer
+	// With instancing, consecutive objects sharing a mesh are merged into one draw with an instance per object
+	void createIndirectBuffer() {
+		drawCommands.clear();
+		drawCommandMeshes.clear();
+		for (uint32_t i = 0; i < sceneObjects.size(); i++) {
+			const MeshRange& range = meshRanges[sceneObjects[i].meshIndex];
+
+			// Add an instance to the previous draw when it draws the same mesh
+			if (settings.instancing && i > 0 && sceneObjects[i - 1].meshIndex == sceneObjects[i].meshIndex) {
+				drawCommands.back().instanceCount++;
+				continue;
+			}
+
+			VkDrawIndexedIndirectCommand command = {};
+			command.indexCount = range.indexCount;
+			command.instanceCount = 1;
+			command.firstIndex = range.firstIndex;
+			command.vertexOffset = range.vertexOffset;
+			command.firstInstance = i;
+			drawCommands.push_back(command);
+			drawCommandMeshes.push_back(sceneObjects[i].meshIndex);
+		}
+
+		VkDeviceSize bufferSize = sizeof(drawCommands[0]) * drawCommands.size();
+		createDeviceLocalBuffer(drawCommands.data(), bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, indirectBuffer, indirectBufferMemory);
+
+		sceneTriangleCount = 0;
+		for (const auto& command : drawCommands) {
+			sceneTriangleCount += static_cast<uint64_t>(command.indexCount / 3) * command.instanceCount;
+		}
+
+		uint32_t drawCount = static_cast<uint32_t>(drawCommands.size());
+		createDeviceLocalBuffer(&drawCount, sizeof(drawCount), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, drawCountBuffer, drawCountBufferMemory);
+
+		// Instanced draw of every mesh, used as template by the culling pass
+		// The culled draw order holds a range of the size of the no of objects of each mesh, which the draw of the mesh starts at
+		std::vector<VkDrawIndexedIndirectCommand> meshDraws;
+		for (const auto& range : meshRanges) {
+			VkDrawIndexedIndirectCommand command = {};
+			command.indexCount = range.indexCount;
+			command.instanceCount = 0;
+			command.firstIndex = range.firstIndex;
+			command.vertexOffset = range.vertexOffset;
+			command.firstInstance = 0;
+			meshDraws.push_back(command);
+		}
+		for (const auto& object : sceneObjects) {
+			for (size_t mesh = object.meshIndex + 1; mesh < meshDraws.size(); mesh++) {
+				meshDraws[mesh].firstInstance++;
+			}
+		}
+
+		VkDeviceSize meshDrawBufferSize = sizeof(meshDraws[0]) * meshDraws.size();
+		createDeviceLocalBuffer(meshDraws.data(), meshDrawBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, meshDrawBuffer, meshDrawBufferMemory);
+	}
+
+	// Function to create the buffers written by the culling pass for each swap chain image
+	// The draw buffers hold one draw per mesh, and the culled draw order has room for every scene object so that none is dropped when everything is visible
+	void createCullingBuffers() {
+		culledDrawBuffers.resize(swapChainImages.size());
+		culledDrawBuffersMemory.resize(swapChainImages.size());
+		culledDrawOrderBuffers.resize(swapChainImages.size());
+		culledDrawOrderBuffersMemory.resize(swapChainImages.size());
+		culledDrawCountBuffers.resize(swapChainImages.size());
+		culledDrawCountBuffersMemory.resize(swapChainImages.size());
+		imageUniforms.resize(swapChainImages.size());
+		cullingResultPending.assign(swapChainImages.size(), false);
+
+		// Draw order of every image, starting in scene order
+		drawOrder.resize(sceneObjects.size());
+		for (uint32_t i = 0; i < drawOrder.size(); i++) {
+			drawOrder[i] = i;
+		}
+		drawOrderBuffers.resize(swapChainImages.size());
+		drawOrderBuffersMemory.resize(swapChainImages.size());
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			createBuffer(sizeof(uint32_t) * drawOrder.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, drawOrderBuffers[i], drawOrderBuffersMemory[i]);
+			writeDrawOrder(static_cast<uint32_t>(i));
+		}
+
+		VkDeviceSize drawBufferSize = sizeof(VkDrawIndexedIndirectCommand) * meshRanges.size();
+
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			createBuffer(drawBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledDrawBuffers[i], culledDrawBuffersMemory[i]);
+			createBuffer(sizeof(uint32_t) * sceneObjects.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledDrawOrderBuffers[i], culledDrawOrderBuffersMemory[i]);
+			createBuffer(sizeof(uint32_t) * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, culledDrawCountBuffers[i], culledDrawCountBuffersMemory[i]);
+		}
+	}
+
+	// Function to create the shadow map of the light and the resources of the shadow pass
+	// None of them depend on the swap chain, so they live until cleanup and the shadow map survives a resize
+	void createShadowResources() {
+		// Depth format that can be rendered to and sampled with comparisons
+		VkFormat shadowMapFormat = findSupportedFormat(
+			{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM },
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+		);
+		createImage(settings.shadowMapSize, settings.shadowMapSize, 1, shadowMapFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowMapImage, shadowMapImageMemory);
+		shadowMapImageView = createImageView(shadowMapImage, shadowMapFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+
+		// Linear filtering of the comparisons blends the four nearest texels, and everything outside the map is lit
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		samplerInfo.anisotropyEnable = VK_FALSE;
+		samplerInfo.maxAnisotropy = 1;
+		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		samplerInfo.unnormalizedCoordinates = VK_FALSE;
+		samplerInfo.compareEnable = VK_TRUE;
+		samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerInfo.mipLodBias = 0.0f;
+		samplerInfo.minLod = 0.0f;
+		samplerInfo.maxLod = 0.0f;
+
+		if (vkCreateSampler(device, &samplerInfo, nullptr, &shadowMapSampler) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create shadow map sampler!");
+		}
+
+		// The shadow map is cleared and written, then left ready to be sampled by the lit pass
+		VkAttachmentDescription depthAttachment = {};
+		depthAttachment.format = shadowMapFormat;
+		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkAttachmentReference depthAttachmentRef = {};
+		depthAttachmentRef.attachment = 0;
+		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 0;
+		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+		// Wait for the frames before to stop sampling the shadow map before writing it, and for the writes before this frame samples it
+		std::array<VkSubpassDependency, 2> dependencies = {};
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependencies[0].srcAccessMask = 0;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		VkRenderPassCreateInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = 1;
+		renderPassInfo.pAttachments = &depthAttachment;
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
+
+		if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &shadowRenderPass) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create shadow render pass!");
+		}
+
+		VkFramebufferCreateInfo framebufferInfo = {};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = shadowRenderPass;
+		framebufferInfo.attachmentCount = 1;
+		framebufferInfo.pAttachments = &shadowMapImageView;
+		framebufferInfo.width = settings.shadowMapSize;
+		framebufferInfo.height = settings.shadowMapSize;
+		framebufferInfo.layers = 1;
+
+		if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &shadowFramebuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create shadow framebuffer!");
+		}
+
+		// The light space matrices are written by the frame that renders the shadow map, so every frame in flight has its own
+		shadowUniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+		shadowUniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			createBuffer(sizeof(UniformBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, shadowUniformBuffers[i], shadowUniformBuffersMemory[i]);
+		}
+
+		std::vector<uint32_t> sceneOrder(sceneObjects.size());
+		for (uint32_t i = 0; i < sceneOrder.size(); i++) {
+			sceneOrder[i] = i;
+		}
+		createDeviceLocalBuffer(sceneOrder.data(), sizeof(uint32_t) * sceneOrder.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, shadowDrawOrderBuffer, shadowDrawOrderBufferMemory);
+
+		shadowCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = static_cast<uint32_t>(shadowCommandBuffers.size());
+		if (vkAllocateCommandBuffers(device, &allocInfo, shadowCommandBuffers.data()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate shadow command buffers!");
+		}
+
+		// Sphere around the bounding spheres of all objects, centred on the middle of their centres
+		// The objects are only moved and turned, so their bounding spheres keep the radius of their mesh
+		glm::vec3 minimum(FLT_MAX);
+		glm::vec3 maximum(-FLT_MAX);
+		for (const auto& object : sceneObjects) {
+			glm::vec3 centre = glm::vec3(object.model * glm::vec4(glm::vec3(meshRanges[object.meshIndex].boundingSphere), 1.0f));
+			minimum = glm::min(minimum, centre);
+			maximum = glm::max(maximum, centre);
+		}
+		glm::vec3 sceneCentre = (minimum + maximum) * 0.5f;
+		float sceneRadius = 0.0f;
+		for (const auto& object : sceneObjects) {
+			const glm::vec4& sphere = meshRanges[object.meshIndex].boundingSphere;
+			glm::vec3 centre = glm::vec3(object.model * glm::vec4(glm::vec3(sphere), 1.0f));
+			sceneRadius = std::max(sceneRadius, glm::length(centre - sceneCentre) + sphere.w);
+		}
+		shadowCasterBounds = glm::vec4(sceneCentre, sceneRadius);
+	}
+
+	// Function to destroy the shadow map and the resources of the shadow pass
+	void destroyShadowResources() {
+		vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(shadowCommandBuffers.size()), shadowCommandBuffers.data());
+		vkDestroyBuffer(device, shadowDrawOrderBuffer, nullptr);
+		freeMemory(shadowDrawOrderBufferMemory);
+		for (size_t i = 0; i < shadowUniformBuffers.size(); i++) {
+			vkDestroyBuffer(device, shadowUniformBuffers[i], nullptr);
+			freeMemory(shadowUniformBuffersMemory[i]);
+		}
+		vkDestroyFramebuffer(device, shadowFramebuffer, nullptr);
+		vkDestroyRenderPass(device, shadowRenderPass, nullptr);
+		vkDestroySampler(device, shadowMapSampler, nullptr);
+		vkDestroyImageView(device, shadowMapImageView, nullptr);
+		vkDestroyImage(device, shadowMapImage, nullptr);
+		freeMemory(shadowMapImageMemory);
 	}
 
 	// Function to parse obj file and generate a mesh
 	Mesh ParseObjFile(const char* filename)
 	{
+		TRACE_SCOPE("ParseObjFile");
 		std::vector<Vec3> positions;
 		std::vector<Vec3> normals;
 		std::vector<Vec3> texCoords;
@@ -1775,31 +6843,186 @@ private:
 				inputFile >> r >> g >> b;
 				lightingConstants.lightSpecular =  glm::vec4(r, g, b, 1.0); 
 			}
-			else if (tempString == "Kd")
-			{
-				float r, g, b;
-				inputFile >> r >> g >> b;
-				lightingConstants.lightDiffuse = glm::vec4(r, g, b, 1.0); 
+			else if (tempString == "Kd")
+			{
+				float r, g, b;
+				inputFile >> r >> g >> b;
+				lightingConstants.lightDiffuse = glm::vec4(r, g, b, 1.0); 
+			}
+			else if (inputFile.eof())
+				break;
+		}
+
+		// Set the intensities of the light
+		lightingConstants.ambientIntensity = 0.2;
+		lightingConstants.specularIntensity = 5.3;
+		lightingConstants.diffuseIntensity = 0.7;
+
+		// Set the position of the light
+		lightingConstants.lightPosition = glm::vec4(0.0f, -200.0f, 260.0f, 1.0f);
+		return lightingConstants;
+	}
+
+	// Function to get the Vulkan format of a texture compression
+	static VkFormat textureCompressionFormat(TextureCompression compression) {
+		switch (compression) {
+		case TextureCompression::Bc1:
+			return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+		case TextureCompression::Bc3:
+			return VK_FORMAT_BC3_SRGB_BLOCK;
+		case TextureCompression::Bc7:
+			return VK_FORMAT_BC7_SRGB_BLOCK;
+		case TextureCompression::Etc2:
+			return VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK;
+		default:
+			return VK_FORMAT_R8G8B8A8_SRGB;
+		}
+	}
+
+	// Function to choose the compression of the texture
+	// A compressed format is used when its feature is enabled on the device and it can be sampled with linear filtering
+	TextureCompression chooseTextureCompression() {
+		if (settings.textureCompression == TextureCompression::Off) {
+			return TextureCompression::Off;
+		}
+
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+		auto isSupported = [&](TextureCompression compression) {
+			VkBool32 feature = compression == TextureCompression::Etc2 ? supportedFeatures.textureCompressionETC2 : supportedFeatures.textureCompressionBC;
+			VkFormatProperties formatProperties;
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, textureCompressionFormat(compression), &formatProperties);
+			VkFormatFeatureFlags sampledFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+			return feature == VK_TRUE && (formatProperties.optimalTilingFeatures & sampledFeatures) == sampledFeatures;
+		};
+
+		if (settings.textureCompression != TextureCompression::Auto) {
+			if (isSupported(settings.textureCompression)) {
+				return settings.textureCompression;
+			}
+			std::cout << "Texture compression is not supported by the device, using an uncompressed texture" << std::endl;
+			return TextureCompression::Off;
+		}
+		for (TextureCompression compression : { TextureCompression::Bc7, TextureCompression::Etc2 }) {
+			if (isSupported(compression)) {
+				return compression;
+			}
+		}
+		return TextureCompression::Off;
+	}
+
+	// Function to create texture image
+	void createTextureImage(const char* filename) {
+		TRACE_SCOPE("createTextureImage");
+
+		int texWidth, texHeight;
+		std::vector<unsigned char> texels = LoadTexture(filename, texWidth, texHeight);
+
+		// Compressed textures can not be blitted, so their levels are always filtered on the CPU
+		TextureCompression compression = chooseTextureCompression();
+		textureFormat = textureCompressionFormat(compression);
+
+		// Levels of the texture. The GPU blits them from the base level when the format supports linear filtering of blits,
+		// otherwise they are filtered on the CPU and uploaded with the base level
+		MipmapGeneration mipmapGeneration = settings.mipmapGeneration;
+		if (compression != TextureCompression::Off && mipmapGeneration != MipmapGeneration::Off) {
+			mipmapGeneration = MipmapGeneration::Cpu;
+		}
+		if (mipmapGeneration == MipmapGeneration::Auto || mipmapGeneration == MipmapGeneration::Gpu) {
+			VkFormatProperties formatProperties;
+			vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_SRGB, &formatProperties);
+			VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+			if ((formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures) {
+				mipmapGeneration = MipmapGeneration::Gpu;
+			}
+			else {
+				if (settings.mipmapGeneration == MipmapGeneration::Gpu) {
+					std::cout << "Texture format does not support linear blits, generating mipmaps on the CPU" << std::endl;
+				}
+				mipmapGeneration = MipmapGeneration::Cpu;
+			}
+		}
+		textureMipLevels = mipmapGeneration == MipmapGeneration::Off ? 1 : mipLevelCount(texWidth, texHeight);
+
+		// The blocks of a compressed texture are read from the cache file next to the texture,
+		// and compressed and written to it when the texture or the format changed
+		CompressedTextureHeader header = {};
+		std::vector<unsigned char> blocks;
+		const char* compressionNames[] = { "auto", "bc1", "bc3", "bc7", "etc2", "off" };
+		std::string cachePath = std::string(filename) + "." + compressionNames[static_cast<uint32_t>(compression)] + ".tex";
+		if (compression != TextureCompression::Off) {
+			memcpy(header.magic, "PTEX", 4);
+			header.version = 1;
+			header.format = static_cast<uint32_t>(compression);
+			header.width = texWidth;
+			header.height = texHeight;
+			header.levelCount = textureMipLevels;
+			header.sourceHash = hashBytes(texels);
+		}
+
+		std::vector<MipLevel> levels;
+		levels.push_back({ static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 0 });
+		if (mipmapGeneration == MipmapGeneration::Cpu) {
+			for (uint32_t level = 1; level < textureMipLevels; level++) {
+				levels.push_back({ std::max(1u, levels[0].width >> level), std::max(1u, levels[0].height >> level), 0 });
+			}
+		}
+
+		if (compression != TextureCompression::Off) {
+			std::vector<MipLevel> compressedLevels = BlockCompressor::compressedLevels(compression, levels);
+			blocks.resize(BlockCompressor::compressedSize(compression, levels));
+			if (!readCompressedTexture(cachePath, header, blocks)) {
+				TRACE_SCOPE("compress texture");
+				if (mipmapGeneration == MipmapGeneration::Cpu) {
+					texels = MipChainGenerator(true, std::thread::hardware_concurrency()).generate(texels, texWidth, texHeight, levels);
+				}
+				blocks = BlockCompressor(compression, std::thread::hardware_concurrency()).compress(texels, levels);
+				writeCompressedTexture(cachePath, header, blocks);
 			}
-			else if (inputFile.eof())
-				break;
+			texels.swap(blocks);
+			levels = compressedLevels;
+		}
+		else if (mipmapGeneration == MipmapGeneration::Cpu) {
+			TRACE_SCOPE("generate mipmaps");
+			texels = MipChainGenerator(true, std::thread::hardware_concurrency()).generate(texels, texWidth, texHeight, levels);
 		}
+		VkDeviceSize imageSize = texels.size();
 
-		// Set the intensities of the light
-		lightingConstants.ambientIntensity = 0.2;
-		lightingConstants.specularIntensity = 5.3;
-		lightingConstants.diffuseIntensity = 0.7;
+		VkBuffer stagingBuffer;
+		VkDeviceMemory stagingBufferMemory;
 
-		// Set the position of the light
-		lightingConstants.lightPosition = glm::vec4(0.0f, -200.0f, 260.0f, 1.0f);
-		return lightingConstants;
-	}
+		createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
-	// Function to create texture image
-	void createTextureImage(const char* filename) {
+		void* data;
+		vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+		memcpy(data, texels.data(), static_cast<size_t>(imageSize));
+		vkUnmapMemory(device, stagingBufferMemory);
+		metrics.add("vulkan_upload_bytes_total{kind=\"staging\"}", static_cast<double>(imageSize));
+
+		// Only the blits read from the texture in transfers
+		VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		if (mipmapGeneration == MipmapGeneration::Gpu) {
+			usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		}
+		createImage(texWidth, texHeight, textureMipLevels, textureFormat, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+
+		transitionImageLayout(textureImage, textureFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, textureMipLevels);
+		copyBufferToImage(stagingBuffer, textureImage, levels);
+
+		if (mipmapGeneration == MipmapGeneration::Gpu) {
+			generateMipmaps(textureImage, texWidth, texHeight, textureMipLevels);
+		}
+		else {
+			transitionImageLayout(textureImage, textureFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, textureMipLevels);
+		}
+
+		vkDestroyBuffer(device, stagingBuffer, nullptr);
+		freeMemory(stagingBufferMemory);
 
-		int texWidth, texHeight, texChannels;
+	}
 
+	// Function to load the texels of a PPM texture as RGBA
+	std::vector<unsigned char> LoadTexture(const char* filename, int& texWidth, int& texHeight) {
 		std::ifstream inputFile;
 		inputFile.open(filename);
 		if (!inputFile.is_open())
@@ -1843,7 +7066,6 @@ private:
 		//uint32_t* texels = new uint32_t[size];
 		unsigned char* texels = new unsigned char[size * 4];
 		unsigned char maxr = 0;
-		VkDeviceSize imageSize = texWidth * texHeight * 4;
 		int i = 0;
 		while (i < size)
 		{
@@ -1865,35 +7087,15 @@ private:
 			throw std::runtime_error("failed to load texture image!");
 		}
 
-
-
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-
-		createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-		void* data;
-		vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-		memcpy(data, texels, static_cast<size_t>(imageSize));
-		vkUnmapMemory(device, stagingBufferMemory);
-
-		//inputFile.close();
-
-		createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-
-		transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-
-		transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-		vkDestroyBuffer(device, stagingBuffer, nullptr);
-		vkFreeMemory(device, stagingBufferMemory, nullptr);
-
+		std::vector<unsigned char> result(texels, texels + size * 4);
+		delete[] fileContents;
+		delete[] texels;
+		return result;
 	}
 
 	// Function to create texture image view
 	void createTextureImageView() {
-		textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+		textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, textureMipLevels);
 	}
 
 	// Function to create texture sampler
@@ -1906,7 +7108,7 @@ private:
 		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		samplerInfo.anisotropyEnable = VK_TRUE;
+		samplerInfo.anisotropyEnable = samplerAnisotropySupported ? VK_TRUE : VK_FALSE;
 		samplerInfo.maxAnisotropy = 16;
 		samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
 		samplerInfo.unnormalizedCoordinates = VK_FALSE;
@@ -1915,7 +7117,7 @@ private:
 		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 		samplerInfo.mipLodBias = 0.0f;
 		samplerInfo.minLod = 0.0f;
-		samplerInfo.maxLod = 0.0f;
+		samplerInfo.maxLod = static_cast<float>(textureMipLevels);
 
 		if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create texture sampler!");
@@ -1923,52 +7125,117 @@ private:
 	}
 
 	// Function to copy buffer to image
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
+	// Every level is a tightly packed region of the buffer, copied with a single command
+	void copyBufferToImage(VkBuffer buffer, VkImage image, const std::vector<MipLevel>& levels) {
 		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
-		VkBufferImageCopy region = {};
-		region.bufferOffset = 0;
-		region.bufferRowLength = 0;
-		region.bufferImageHeight = 0;
-
-		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		region.imageSubresource.mipLevel = 0;
-		region.imageSubresource.baseArrayLayer = 0;
-		region.imageSubresource.layerCount = 1;
-
-		region.imageOffset = { 0, 0, 0 };
-		region.imageExtent = {
-			width,
-			height,
-			1
-		};
+		std::vector<VkBufferImageCopy> regions(levels.size());
+		for (size_t i = 0; i < levels.size(); i++) {
+			VkBufferImageCopy& region = regions[i];
+			region.bufferOffset = levels[i].offset;
+			region.bufferRowLength = 0;
+			region.bufferImageHeight = 0;
+
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = static_cast<uint32_t>(i);
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent = {
+				levels[i].width,
+				levels[i].height,
+				1
+			};
+		}
 
 		vkCmdCopyBufferToImage(
 			commandBuffer,
 			buffer,
 			image,
 			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&region
+			static_cast<uint32_t>(regions.size()),
+			regions.data()
 		);
 		endSingleTimeCommands(commandBuffer);
 	}
 
+	// Function to fill the mip levels of an image by blitting every level from the previous one with linear filtering
+	// Level 0 must be in the transfer destination layout. Every level ends in the shader read only layout
+	void generateMipmaps(VkImage image, int32_t width, int32_t height, uint32_t mipLevels) {
+		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = image;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.subresourceRange.levelCount = 1;
+
+		for (uint32_t i = 1; i < mipLevels; i++) {
+			// Wait for the previous level to be written and make it the source of the blit
+			barrier.subresourceRange.baseMipLevel = i - 1;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+			int32_t levelWidth = std::max(1, width >> (i - 1));
+			int32_t levelHeight = std::max(1, height >> (i - 1));
+
+			VkImageBlit blit = {};
+			blit.srcOffsets[0] = { 0, 0, 0 };
+			blit.srcOffsets[1] = { levelWidth, levelHeight, 1 };
+			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.srcSubresource.mipLevel = i - 1;
+			blit.srcSubresource.baseArrayLayer = 0;
+			blit.srcSubresource.layerCount = 1;
+			blit.dstOffsets[0] = { 0, 0, 0 };
+			blit.dstOffsets[1] = { std::max(1, levelWidth / 2), std::max(1, levelHeight / 2), 1 };
+			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.dstSubresource.mipLevel = i;
+			blit.dstSubresource.baseArrayLayer = 0;
+			blit.dstSubresource.layerCount = 1;
+			vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+			// The previous level is complete
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+
+		// The last level is only ever written
+		barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		endSingleTimeCommands(commandBuffer);
+	}
+
 	// Function to create image
-	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+	void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT) {
 		VkImageCreateInfo imageInfo = {};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 		imageInfo.imageType = VK_IMAGE_TYPE_2D;
 		imageInfo.extent.width = width;
 		imageInfo.extent.height = height;
 		imageInfo.extent.depth = 1;
-		imageInfo.mipLevels = 1;
+		imageInfo.mipLevels = mipLevels;
 		imageInfo.arrayLayers = 1;
 		imageInfo.format = format;
 		imageInfo.tiling = tiling;
 		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		imageInfo.usage = usage;
-		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.samples = samples;
 		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
 		if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
@@ -1978,12 +7245,17 @@ private:
 		VkMemoryRequirements memRequirements;
 		vkGetImageMemoryRequirements(device, image, &memRequirements);
 
+		// Lazily allocated memory is a preference, dropped when none of the memory types the image can live in has it
+		if ((properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !isMemoryTypeAvailable(properties, memRequirements.memoryTypeBits)) {
+			properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		}
+
 		VkMemoryAllocateInfo allocInfo = {};
 		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 		allocInfo.allocationSize = memRequirements.size;
 		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
 
-		if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
+		if (allocateMemory(allocInfo, imageMemory) != VK_SUCCESS) {
 			throw std::runtime_error("failed to allocate image memory!");
 		}
 
@@ -2012,6 +7284,7 @@ private:
 
 	// Function to end single time commands in command buffer
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+		TRACE_SCOPE("single time commands");
 		vkEndCommandBuffer(commandBuffer);
 
 		VkSubmitInfo submitInfo = {};
@@ -2040,6 +7313,19 @@ private:
 		throw std::runtime_error("failed to find suitable memory type!");
 	}
 
+	// Function to check whether any memory type of the device, out of the types in the filter, has the properties
+	bool isMemoryTypeAvailable(VkMemoryPropertyFlags properties, uint32_t typeFilter = ~0u) {
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return true;
+			}
+		}
+		return false;
+	}
+
 	// Function to copy the contents from one buffer to another
 	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
 		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
@@ -2052,7 +7338,7 @@ private:
 	}
 
 	// Function to transition image layout
-	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
+	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
 		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
 		VkImageMemoryBarrier barrier = {};
@@ -2064,7 +7350,7 @@ private:
 		barrier.image = image;
 		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		barrier.subresourceRange.baseMipLevel = 0;
-		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.levelCount = mipLevels;
 		barrier.subresourceRange.baseArrayLayer = 0;
 		barrier.subresourceRange.layerCount = 1;
 
@@ -2115,7 +7401,7 @@ private:
 		lightingLayoutBinding.binding = 1;
 		lightingLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 		lightingLayoutBinding.descriptorCount = 1;
-		lightingLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		lightingLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 		lightingLayoutBinding.pImmutableSamplers = nullptr; // Optional
 
 		VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
@@ -2125,21 +7411,66 @@ private:
 		samplerLayoutBinding.pImmutableSamplers = nullptr;
 		samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-		std::array<VkDescriptorSetLayoutBinding, 3> bindings = { uboLayoutBinding, lightingLayoutBinding, samplerLayoutBinding };
-
-		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-		layoutInfo.pBindings = bindings.data();
-
-		if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create descriptor set layout!");
+		VkDescriptorSetLayoutBinding objectLayoutBinding = {};
+		objectLayoutBinding.binding = 3;
+		objectLayoutBinding.descriptorCount = 1;
+		objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		objectLayoutBinding.pImmutableSamplers = nullptr;
+		objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkDescriptorSetLayoutBinding clusterLayoutBinding = {};
+		clusterLayoutBinding.binding = 4;
+		clusterLayoutBinding.descriptorCount = 1;
+		clusterLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		clusterLayoutBinding.pImmutableSamplers = nullptr;
+		clusterLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorSetLayoutBinding drawOrderLayoutBinding = {};
+		drawOrderLayoutBinding.binding = 7;
+		drawOrderLayoutBinding.descriptorCount = 1;
+		drawOrderLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		drawOrderLayoutBinding.pImmutableSamplers = nullptr;
+		drawOrderLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkDescriptorSetLayoutBinding shadowMapLayoutBinding = {};
+		shadowMapLayoutBinding.binding = 8;
+		shadowMapLayoutBinding.descriptorCount = 1;
+		shadowMapLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		shadowMapLayoutBinding.pImmutableSamplers = nullptr;
+		shadowMapLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, lightingLayoutBinding, samplerLayoutBinding, objectLayoutBinding, clusterLayoutBinding, drawOrderLayoutBinding, shadowMapLayoutBinding };
+
+		// In bindless mode the textures of all materials are in one array, of which only the loaded textures are written
+		VkDescriptorSetLayoutBinding texturesLayoutBinding = {};
+		texturesLayoutBinding.binding = 5;
+		texturesLayoutBinding.descriptorCount = bindlessTextureCount;
+		texturesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		texturesLayoutBinding.pImmutableSamplers = nullptr;
+		texturesLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorSetLayoutBinding materialLayoutBinding = {};
+		materialLayoutBinding.binding = 6;
+		materialLayoutBinding.descriptorCount = 1;
+		materialLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		materialLayoutBinding.pImmutableSamplers = nullptr;
+		materialLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		std::vector<VkDescriptorBindingFlagsEXT> bindingFlags;
+		if (bindlessEnabled) {
+			bindings.push_back(texturesLayoutBinding);
+			bindings.push_back(materialLayoutBinding);
+			bindingFlags.assign(bindings.size(), 0);
+			bindingFlags[bindings.size() - 2] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
 		}
+
+		descriptorSetLayout = descriptorAllocator.getLayout(bindings, bindingFlags);
 	}
 
 	// Function to create command buffers
 	// Command Buffers - All drawing operations are recorded in a command buffer
 	void createCommandBuffers() {
+		TRACE_SCOPE("createCommandBuffers");
 		// resize the command buffers collection
 		commandBuffers.resize(swapChainFramebuffers.size());
 
@@ -2163,87 +7494,502 @@ private:
 			throw std::runtime_error("failed to allocate command buffers!");
 		}
 
-		// Loop through the command buffers
+		// Record the command buffers
+		commandBufferStageMasks.assign(commandBuffers.size(), 0);
+		commandBufferExtents.assign(commandBuffers.size(), VkExtent2D());
+		updateRenderExtent();
 		for (size_t i = 0; i < commandBuffers.size(); i++) {
-			// Command buffer begin info to start command buffer recording
-			VkCommandBufferBeginInfo beginInfo = {};
-			// Type of information stored in the structure
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			// Specify how the command buffer is used
-			beginInfo.flags = 0; // Optional
-			// Specify which state to inherit from, in case of secondary command buffer
-			beginInfo.pInheritanceInfo = nullptr; // Optional
-
-			// Start record the command buffer
-			// 1st Parameter - command buffer to start recording
-			// 2nd Parameter - Begin info
-			if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
-				// Throw runtime error exception
-				throw std::runtime_error("failed to begin recording command buffer!");
-			}
-
-			// Render pass begin info to start the render pass
-			VkRenderPassBeginInfo renderPassInfo = {};
-			// Type of information stored in the structure
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			// Specify the render pass to start
-			renderPassInfo.renderPass = renderPass;
-			// Specify the swap chain frame buffers
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			// Specify the area where shader loads and stores take place
-			renderPassInfo.renderArea.offset = { 0, 0 };
-			renderPassInfo.renderArea.extent = swapChainExtent;
-			// Set the clear colour for the background
-			// Set the number of clear colours
-			// Specify the pointer to the clear colour
-
-			std::array<VkClearValue, 2> clearValues = {};
-			clearValues[0].color = { 0.8f, 0.6f, 0.0f, 1.0f };
-			clearValues[1].depthStencil = { 1.0f, 0 };
-
-			renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
-
-			// Start the render pass
-			// 1st Parameter - command buffer to record the commands to
-			// 2nd Parameter - render pass begin info
-			// 3rd Parameter - whether the drawing commands are executed inline or executed from a secondary command buffers
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			// Bind the graphics pipeline
-			// 1st Parameter - command buffer 
-			// 2nd Parameter - whether the pipeline object is graphics pipeline or compute pipeline
-			// 3rd Parameter - graphics pipeline
+			recordCommandBuffer(i);
+		}
+	}
+
+	// Function to record the command buffer of a swap chain image with the current graphics pipeline variant
+	// The command buffer must not be in use, as it is reset when recording begins
+	void recordCommandBuffer(size_t i) {
+		commandBufferStageMasks[i] = graphicsPipelineStageMask;
+		commandBufferExtents[i] = renderExtent;
+
+		// Command buffer begin info to start command buffer recording
+		VkCommandBufferBeginInfo beginInfo = {};
+		// Type of information stored in the structure
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		// Specify how the command buffer is used
+		beginInfo.flags = 0; // Optional
+		// Specify which state to inherit from, in case of secondary command buffer
+		beginInfo.pInheritanceInfo = nullptr; // Optional
+
+		// Start record the command buffer
+		// 1st Parameter - command buffer to start recording
+		// 2nd Parameter - Begin info
+		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
+			// Throw runtime error exception
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+
+		// Profile the whole frame and each pass
+		uint32_t image = static_cast<uint32_t>(i);
+		gpuProfiler.beginCommandBuffer(commandBuffers[i], image);
+		uint32_t frameScope = gpuProfiler.beginScope(commandBuffers[i], image, "frame");
+
+		// Cull the scene objects before the render pass
+		if (cullingEnabled) {
+			uint32_t cullingScope = gpuProfiler.beginScope(commandBuffers[i], image, "culling");
+			recordCulling(commandBuffers[i], i);
+			gpuProfiler.endScope(commandBuffers[i], image, cullingScope);
+		}
+
+		uint32_t renderPassScope = gpuProfiler.beginScope(commandBuffers[i], image, "render pass");
+
+		// Count the primitives and shader invocations of the render pass
+		if (statisticsQueryPool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(commandBuffers[i], statisticsQueryPool, image, 1);
+			vkCmdBeginQuery(commandBuffers[i], statisticsQueryPool, image, 0);
+		}
+
+		// Render pass begin info to start the render pass
+		VkRenderPassBeginInfo renderPassInfo = {};
+		// Type of information stored in the structure
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		// Specify the render pass to start
+		renderPassInfo.renderPass = renderPass;
+		// Specify the swap chain frame buffers
+		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+		// Specify the area where shader loads and stores take place
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = renderExtent;
+		// Set the clear colour for the background
+		// Set the number of clear colours
+		// Specify the pointer to the clear colour
+
+		std::array<VkClearValue, 2> clearValues = {};
+		clearValues[0].color = { 0.8f, 0.6f, 0.0f, 1.0f };
+		clearValues[1].depthStencil = { 1.0f, 0 };
+
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+
+		// Start the render pass
+		// 1st Parameter - command buffer to record the commands to
+		// 2nd Parameter - render pass begin info
+		// 3rd Parameter - whether the drawing commands are executed inline or executed from a secondary command buffers
+		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		// Bind the graphics pipeline
+		// 1st Parameter - command buffer 
+		// 2nd Parameter - whether the pipeline object is graphics pipeline or compute pipeline
+		// 3rd Parameter - graphics pipeline
+		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+		// Render the scene into the extent it is rendered at, the top left corner of the attachments at a dynamic resolution
+		VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(renderExtent.width), static_cast<float>(renderExtent.height), 0.0f, 1.0f };
+		VkRect2D scissor = { { 0, 0 }, renderExtent };
+		vkCmdSetViewport(commandBuffers[i], 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffers[i], 0, 1, &scissor);
+
+		VkBuffer vertexBuffers[] = { vertexBuffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+
+		vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+		// Draw the polygon - triangle
+		// 1st Parameter - command buffer
+		// 2nd Parameter - vertex count
+		// 3rd Parameter - instance count
+		// 4th Parameter - first vertex
+		// 5th Parameter - first instance
+		//vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
+
+		vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+
+		// Lay down the depth of all scene objects first, so that the lit draws only shade the fragments left visible
+		if (depthPrepassPipeline != VK_NULL_HANDLE) {
+			uint32_t depthPrepassScope = gpuProfiler.beginScope(commandBuffers[i], image, "depth pre-pass");
+			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipeline);
+			recordSceneDraws(commandBuffers[i], i);
 			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+			gpuProfiler.endScope(commandBuffers[i], image, depthPrepassScope);
+		}
+
+		// Draw all scene objects from the indirect buffer
+		recordSceneDraws(commandBuffers[i], i);
+
+		// End the render pass recording
+		vkCmdEndRenderPass(commandBuffers[i]);
+		if (statisticsQueryPool != VK_NULL_HANDLE) {
+			vkCmdEndQuery(commandBuffers[i], statisticsQueryPool, image);
+		}
+		gpuProfiler.endScope(commandBuffers[i], image, renderPassScope);
+
+		// Scale the scene up into the swap chain image
+		if (dynamicResolutionEnabled) {
+			uint32_t upscaleScope = gpuProfiler.beginScope(commandBuffers[i], image, "upscale");
+			recordUpscale(commandBuffers[i], i);
+			gpuProfiler.endScope(commandBuffers[i], image, upscaleScope);
+		}
+
+		// Copy the rendered image out for export
+		if (!readbackSlots.empty()) {
+			uint32_t readbackScope = gpuProfiler.beginScope(commandBuffers[i], image, "readback");
+			recordReadback(commandBuffers[i], i);
+			gpuProfiler.endScope(commandBuffers[i], image, readbackScope);
+		}
+
+		gpuProfiler.endScope(commandBuffers[i], image, frameScope);
+
+		// Make the culled draw count visible to the host for verification
+		if (cullingEnabled) {
+			VkMemoryBarrier hostBarrier = {};
+			hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffers[i], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		// End the command buffer recording
+		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+			// Throw runtime error exception as command buffer recording cannot be ended
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
+
+
+	// Function to record the bilinear upscale of the scene image of a swap chain image into the swap chain image
+	// Leaves the swap chain image in the layout the render pass leaves it in without dynamic resolution
+	void recordUpscale(VkCommandBuffer commandBuffer, size_t imageIndex) {
+		// Wait for the acquire of the swap chain image, which the frame waits for at the colour attachment output stage
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = swapChainImages[imageIndex];
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+
+		// The render pass has left the scene image in the transfer source layout
+		// Its colour writes and the multisample resolve into it still have to finish before the blit reads it
+		VkImageMemoryBarrier sceneBarrier = barrier;
+		sceneBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		sceneBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		sceneBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		sceneBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		sceneBarrier.image = sceneColorImages[imageIndex];
+
+		std::array<VkImageMemoryBarrier, 2> barriers = { barrier, sceneBarrier };
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+		VkImageBlit blit = {};
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1 };
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = 0;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = 1;
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { static_cast<int32_t>(swapChainExtent.width), static_cast<int32_t>(swapChainExtent.height), 1 };
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = 0;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount = 1;
+		vkCmdBlitImage(commandBuffer, sceneColorImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+		// Make the swap chain image ready to be presented, or copied out when offscreen
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	// Function to get the extent of the scene rendered in the next frame, from the scale of the dynamic resolution
+	void updateRenderExtent() {
+		renderExtent = dynamicResolutionEnabled ? resolutionController.extent(swapChainExtent) : swapChainExtent;
+	}
+
+	// Function to allocate the set of the shadow pass of a frame in flight from the transient sets of its slot
+	// The set has the light space matrices in place of the camera and every object in scene order
+	// The shadow pass only reads the matrices, the objects and the draw order, so the other bindings are left unwritten
+	VkDescriptorSet allocateShadowDescriptorSet(uint32_t frame) {
+		std::array<VkDescriptorBufferInfo, 3> bufferInfos = {};
+		bufferInfos[0] = { shadowUniformBuffers[frame], 0, sizeof(UniformBufferObject) };
+		bufferInfos[1] = { objectBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[2] = { shadowDrawOrderBuffer, 0, VK_WHOLE_SIZE };
+		std::array<uint32_t, 3> bindings = { 0, 3, 7 };
+
+		std::vector<VkWriteDescriptorSet> descriptorWrites(bufferInfos.size(), VkWriteDescriptorSet());
+		for (size_t j = 0; j < bufferInfos.size(); j++) {
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstBinding = bindings[j];
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[j].descriptorCount = 1;
+			descriptorWrites[j].pBufferInfo = &bufferInfos[j];
+		}
+
+		metrics.add("vulkan_transient_descriptor_sets_total", 1);
+		return descriptorAllocator.allocateTransient(frame, descriptorSetLayout, descriptorWrites);
+	}
+
+	// Function to record the shadow pass of a frame in flight, writing its light space matrices first
+	// Draws every object whatever the view, as objects outside the view still cast shadows into it
+	// With shadows disabled the shadow map is only cleared, once, so that it is in the layout the lit pass samples it in
+	void recordShadowMap(uint32_t frame) {
+		void* data;
+		vkMapMemory(device, shadowUniformBuffersMemory[frame], 0, sizeof(shadowUniforms), 0, &data);
+		memcpy(data, &shadowUniforms, sizeof(shadowUniforms));
+		vkUnmapMemory(device, shadowUniformBuffersMemory[frame]);
+		metrics.add("vulkan_upload_bytes_total{kind=\"uniform\"}", sizeof(shadowUniforms));
+
+		VkCommandBuffer commandBuffer = shadowCommandBuffers[frame];
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording shadow command buffer!");
+		}
+
+		VkClearValue clearValue = {};
+		clearValue.depthStencil = { 1.0f, 0 };
+
+		VkRenderPassBeginInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = shadowRenderPass;
+		renderPassInfo.framebuffer = shadowFramebuffer;
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = { settings.shadowMapSize, settings.shadowMapSize };
+		renderPassInfo.clearValueCount = 1;
+		renderPassInfo.pClearValues = &clearValue;
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		if (settings.shadows) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, getPipelineVariant(shadowMapVariant));
 
 			VkBuffer vertexBuffers[] = { vertexBuffer };
 			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			VkDescriptorSet shadowDescriptorSet = allocateShadowDescriptorSet(frame);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &shadowDescriptorSet, 0, nullptr);
+
+			if (settings.pushConstantDraws) {
+				for (const auto& object : sceneObjects) {
+					const MeshRange& range = meshRanges[object.meshIndex];
+					DrawConstants constants = { object.model, object.tint, object.meshIndex };
+					vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+					vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, range.firstIndex, range.vertexOffset, 0);
+				}
+			}
+			else {
+				for (const auto& command : drawCommands) {
+					vkCmdDrawIndexed(commandBuffer, command.indexCount, command.instanceCount, command.firstIndex, command.vertexOffset, command.firstInstance);
+				}
+			}
+		}
 
-			vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdEndRenderPass(commandBuffer);
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record shadow command buffer!");
+		}
+	}
+
+	// Function to record the culling pass
+	// Resets the draw of every mesh to no instances and clears the counts, then adds an instance for every object whose bounding sphere intersects the view frustum
+	void recordCulling(VkCommandBuffer commandBuffer, size_t imageIndex) {
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = sizeof(VkDrawIndexedIndirectCommand) * meshRanges.size();
+		vkCmdCopyBuffer(commandBuffer, meshDrawBuffer, culledDrawBuffers[imageIndex], 1, &copyRegion);
+		vkCmdFillBuffer(commandBuffer, culledDrawCountBuffers[imageIndex], 0, VK_WHOLE_SIZE, 0);
+
+		// Wait for the resets before the compute shader adds the instances
+		VkMemoryBarrier clearBarrier = {};
+		clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+		// Run one invocation per object in work groups of 64
+		uint32_t objectCount = static_cast<uint32_t>(sceneObjects.size());
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullingPipelineLayout, 0, 1, &cullingDescriptorSets[imageIndex], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, cullingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(objectCount), &objectCount);
+		vkCmdDispatch(commandBuffer, (objectCount + 63) / 64, 1, 1);
+
+		// Wait for the culled draws before the indirect draws read them, and for the culled draw order before the vertex shaders read it
+		VkMemoryBarrier drawBarrier = {};
+		drawBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &drawBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Function to record the draws of all scene objects
+	// Uses the count variant when available, a single multi draw when supported and one indirect draw per object otherwise
+	void recordSceneDraws(VkCommandBuffer commandBuffer, size_t imageIndex) {
+		uint32_t drawCount = static_cast<uint32_t>(drawCommands.size());
+		uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+		uint32_t image = static_cast<uint32_t>(imageIndex);
+
+		// Draw the instanced draw of every mesh written by the culling pass
+		// The meshes without a visible object are left in place with no instances and draw nothing, so the count variant is not needed
+		// The no of instances of each mesh is only known on the GPU, so the culled draws are timed as one group
+		if (cullingEnabled) {
+			uint32_t culledDrawsScope = gpuProfiler.beginScope(commandBuffer, image, "culled draws");
+			uint32_t meshDrawCount = static_cast<uint32_t>(meshRanges.size());
+			if (multiDrawIndirectSupported) {
+				vkCmdDrawIndexedIndirect(commandBuffer, culledDrawBuffers[imageIndex], 0, meshDrawCount, stride);
+			}
+			else {
+				for (uint32_t i = 0; i < meshDrawCount; i++) {
+					vkCmdDrawIndexedIndirect(commandBuffer, culledDrawBuffers[imageIndex], i * stride, 1, stride);
+				}
+			}
+			gpuProfiler.endScope(commandBuffer, image, culledDrawsScope);
+			return;
+		}
+
+		// Draw every object on its own, with its transform and tint pushed before the draw instead of read from the object buffer
+		if (settings.pushConstantDraws) {
+			uint32_t pushConstantDrawsScope = gpuProfiler.beginScope(commandBuffer, image, "push constant draws");
+			for (const auto& object : sceneObjects) {
+				const MeshRange& range = meshRanges[object.meshIndex];
+				DrawConstants constants = { object.model, object.tint, object.meshIndex };
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+				vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, range.firstIndex, range.vertexOffset, 0);
+			}
+			gpuProfiler.endScope(commandBuffer, image, pushConstantDrawsScope);
+			return;
+		}
 
-			// Draw the polygon - triangle
-			// 1st Parameter - command buffer
-			// 2nd Parameter - vertex count
-			// 3rd Parameter - instance count
-			// 4th Parameter - first vertex
-			// 5th Parameter - first instance
-			//vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
+		// When profiling with --gpu-profile, time the draws of each mesh as a group. The draws of a mesh are consecutive
+		// The split changes the draws measured, so the frame timings of the benchmark and the dynamic resolution keep the indirect draws below
+		if (settings.gpuProfiling && gpuProfiler.enabled()) {
+			for (uint32_t first = 0; first < drawCount;) {
+				uint32_t count = 1;
+				while (first + count < drawCount && drawCommandMeshes[first + count] == drawCommandMeshes[first]) {
+					count++;
+				}
 
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
-			vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(m.indices.size()), 1, 0, 0, 0);
+				uint32_t groupScope = gpuProfiler.beginScope(commandBuffer, image, "draw mesh " + std::to_string(drawCommandMeshes[first]));
+				recordDrawRange(commandBuffer, first, count);
+				gpuProfiler.endScope(commandBuffer, image, groupScope);
+				first += count;
+			}
+			return;
+		}
 
-			// End the render pass recording
-			vkCmdEndRenderPass(commandBuffers[i]);
+		// Indirect draws can only address the object buffer through a non zero first instance when the device supports it
+		if (!drawIndirectFirstInstanceSupported) {
+			for (const auto& command : drawCommands) {
+				vkCmdDrawIndexed(commandBuffer, command.indexCount, command.instanceCount, command.firstIndex, command.vertexOffset, command.firstInstance);
+			}
+		}
+		else if (cmdDrawIndexedIndirectCount != nullptr && multiDrawIndirectSupported) {
+			cmdDrawIndexedIndirectCount(commandBuffer, indirectBuffer, 0, drawCountBuffer, 0, drawCount, stride);
+		}
+		else if (multiDrawIndirectSupported) {
+			vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, 0, drawCount, stride);
+		}
+		else {
+			for (uint32_t i = 0; i < drawCount; i++) {
+				vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, i * stride, 1, stride);
+			}
+		}
+	}
 
-			// End the command buffer recording
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				// Throw runtime error exception as command buffer recording cannot be ended
-				throw std::runtime_error("failed to record command buffer!");
+	// Function to record a range of the draw commands without the count variant
+	void recordDrawRange(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count) {
+		uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+		if (!drawIndirectFirstInstanceSupported) {
+			for (uint32_t i = first; i < first + count; i++) {
+				const auto& command = drawCommands[i];
+				vkCmdDrawIndexed(commandBuffer, command.indexCount, command.instanceCount, command.firstIndex, command.vertexOffset, command.firstInstance);
+			}
+		}
+		else if (multiDrawIndirectSupported) {
+			vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, first * stride, count, stride);
+		}
+		else {
+			for (uint32_t i = first; i < first + count; i++) {
+				vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, i * stride, 1, stride);
 			}
 		}
 	}
 
+	// Function to read the no of meshes drawn by the last culling pass of a swap chain image
+	// The swap chain image must not be in use by the GPU
+	uint32_t readCulledDrawCount(uint32_t imageIndex) {
+		return readCulledCount(imageIndex, 0);
+	}
+
+	// Function to read the no of objects found visible by the last culling pass of a swap chain image
+	// The swap chain image must not be in use by the GPU
+	uint32_t readCulledObjectCount(uint32_t imageIndex) {
+		return readCulledCount(imageIndex, 1);
+	}
+
+	// Function to read one of the counts written by the last culling pass of a swap chain image
+	uint32_t readCulledCount(uint32_t imageIndex, uint32_t index) {
+		uint32_t count;
+		void* data;
+		vkMapMemory(device, culledDrawCountBuffersMemory[imageIndex], sizeof(count) * index, sizeof(count), 0, &data);
+		memcpy(&count, data, sizeof(count));
+		vkUnmapMemory(device, culledDrawCountBuffersMemory[imageIndex]);
+		return count;
+	}
+
+	// Function to compare the no of visible objects written by the last culling pass of a swap chain image with a CPU reference
+	// The swap chain image must not be in use by the GPU
+	void verifyCulling(uint32_t imageIndex) {
+		if (!cullingResultPending[imageIndex]) {
+			return;
+		}
+		cullingResultPending[imageIndex] = false;
+
+		// Read back the no of visible objects
+		uint32_t gpuCount = readCulledObjectCount(imageIndex);
+
+		// Cull the objects on the CPU with the uniform values the GPU used
+		const UniformBufferObject& ubo = imageUniforms[imageIndex];
+		glm::vec4 planes[6];
+		extractFrustumPlanes(ubo.proj * ubo.view, planes);
+
+		// Objects within a small tolerance of a frustum plane may go either way because of floating point differences
+		uint32_t visibleCount = 0;
+		uint32_t borderlineCount = 0;
+		for (const auto& object : sceneObjects) {
+			glm::mat4 modelMatrix = ubo.model * object.model;
+			glm::vec4 sphere = meshRanges[object.meshIndex].boundingSphere;
+			glm::vec3 centre(modelMatrix * glm::vec4(glm::vec3(sphere), 1.0f));
+			float scale = std::max(std::max(glm::length(glm::vec3(modelMatrix[0])), glm::length(glm::vec3(modelMatrix[1]))), glm::length(glm::vec3(modelMatrix[2])));
+			float distance = sphereFrustumDistance(planes, centre, sphere.w * scale);
+
+			float tolerance = 1e-3f * (1.0f + sphere.w * scale);
+			if (distance >= tolerance) {
+				visibleCount++;
+			}
+			else if (distance > -tolerance) {
+				borderlineCount++;
+			}
+		}
+
+		cullingChecks++;
+		if (gpuCount < visibleCount || gpuCount > visibleCount + borderlineCount) {
+			cullingMismatches++;
+			std::cerr << "culling mismatch: GPU drew " << gpuCount << " objects, CPU reference expects " << visibleCount;
+			if (borderlineCount > 0) {
+				std::cerr << " to " << visibleCount + borderlineCount;
+			}
+			std::cerr << std::endl;
+		}
+	}
 
 	// Function to create semaphores and fences
 	// Semaphores - A synchronization method where operations are synchronized within or across command queues
@@ -2341,17 +8087,22 @@ private:
 	// Function that returns the list of extenstions based on whether validation layers are enabled or not
 	std::vector<const char*> getRequiredExtensions() {
 
-		// Stores the no of extensions
-		uint32_t glfwExtensionCount = 0;
+		// A list of extensions
+		std::vector<const char*> extensions;
 
-		// Stores the reference to the extensions
-		const char** glfwExtensions;
+		// The surface extensions required by GLFW are not needed when rendering offscreen
+		if (!settings.headless) {
+			// Stores the no of extensions
+			uint32_t glfwExtensionCount = 0;
 
-		// GLFW function to fetch the extensions required
-		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+			// Stores the reference to the extensions
+			const char** glfwExtensions;
 
-		// A list of extensions
-		std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+			// GLFW function to fetch the extensions required
+			glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+			extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		}
 
 		// Check whether validation layers are enabled
 		if (enableValidationLayers) {
@@ -2359,6 +8110,21 @@ private:
 			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 		}
 
+		// The extended physical device queries are enabled whenever the instance offers them
+		// The bindless textures query descriptor indexing and the metrics query the memory budget through them
+		{
+			uint32_t availableCount = 0;
+			vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, nullptr);
+			std::vector<VkExtensionProperties> availableExtensions(availableCount);
+			vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, availableExtensions.data());
+			for (const auto& extension : availableExtensions) {
+				if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+					extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+					physicalDeviceProperties2Enabled = true;
+				}
+			}
+		}
+
 		// Return the extensions
 		return extensions;
 	}
@@ -2394,6 +8160,11 @@ private:
 		// Fetch the queue family indices supported
 		QueueFamilyIndices indices = findQueueFamilies(device);
 
+		// Offscreen rendering accepts any device with a graphics queue, including software implementations
+		if (settings.headless) {
+			return indices.isComplete();
+		}
+
 		// Flag to check Device extension support
 		bool extensionsSupported = checkDeviceExtensionSupport(device);
 
@@ -2453,12 +8224,18 @@ private:
 			}
 
 			// Check whether queue family supports presentation to the surface
+			// Without a surface the graphics queue stands in for the presentation queue
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			if (settings.headless) {
+				presentSupport = indices.graphicsFamily.has_value();
+			}
+			else {
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			}
 
 			if (presentSupport) {
 				// Assign the index of the presentation family
-				indices.presentFamily = i;
+				indices.presentFamily = settings.headless ? indices.graphicsFamily.value() : i;
 			}
 
 			// Break if there is a value assigned to indices
@@ -2529,17 +8306,32 @@ private:
 	}
 
 	// Function to choose the presentation mode for the swap chain
+	// Picks the first mode of the presentation policy supported by the surface. FIFO is always supported and used as the last resort
 	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
-		// Loop through the available presentation modes
-		for (const auto& availablePresentMode : availablePresentModes) {
-			// Check if the presentation mode supports triple buffering
-			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-				// Return the presentation mode supporting triple buffering
-				return availablePresentMode;
+		// Modes of the policy in order of preference
+		std::vector<VkPresentModeKHR> preferredPresentModes;
+		switch (settings.presentPolicy) {
+		case PresentPolicy::Uncapped:
+			preferredPresentModes = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR };
+			break;
+		case PresentPolicy::Relaxed:
+			preferredPresentModes = { VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+			break;
+		case PresentPolicy::Mailbox:
+			preferredPresentModes = { VK_PRESENT_MODE_MAILBOX_KHR };
+			break;
+		case PresentPolicy::Vsync:
+			break;
+		}
+
+		// Loop through the preferred presentation modes
+		for (const auto& preferredPresentMode : preferredPresentModes) {
+			if (std::find(availablePresentModes.begin(), availablePresentModes.end(), preferredPresentMode) != availablePresentModes.end()) {
+				return preferredPresentMode;
 			}
 		}
 
-		// Return FIFO presentation mode when no presentation mode supports triple buffering
+		// Return FIFO presentation mode when no preferred presentation mode is supported
 		return VK_PRESENT_MODE_FIFO_KHR;
 	}
 
@@ -2618,6 +8410,25 @@ private:
 		return buffer;
 	}
 
+	// Function to read the SPIR-V binary of a shader, built from its GLSL source by compile.bat or compile.sh
+	// A binary older than its source is still read, with a warning, as the shaders are only compiled by the build step
+	static std::vector<char> readShader(const std::string& binary) {
+		const ShaderSource* shader = std::find_if(std::begin(shaderSources), std::end(shaderSources), [&](const ShaderSource& s) { return binary == s.binary; });
+		if (shader == std::end(shaderSources)) {
+			throw std::runtime_error("failed to find the source of shader " + binary + "!");
+		}
+
+		std::error_code error;
+		if (!std::filesystem::exists(shader->binary, error)) {
+			throw std::runtime_error("failed to open shader " + binary + ", compile the shaders with compile.bat or compile.sh!");
+		}
+		if (std::filesystem::exists(shader->source, error) && std::filesystem::last_write_time(shader->binary, error) < std::filesystem::last_write_time(shader->source, error)) {
+			std::cerr << "warning: " << shader->binary << " is older than " << shader->source << ", compile the shaders with compile.bat or compile.sh" << std::endl;
+		}
+
+		return readFile(binary);
+	}
+
 	// Function to create shader module
 	// This function takes byte code of the shader as paramter and returns the shader module
 	VkShaderModule createShaderModule(const std::vector<char>& code) {
@@ -2641,8 +8452,24 @@ private:
 			throw std::runtime_error("failed to create shader module!");
 		}
 
-		// Return shader module
-		return shaderModule;
+		// Return shader module
+		return shaderModule;
+	}
+
+	// Function to check whether the device supports an optional extension
+	bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName) {
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+		for (const auto& extension : availableExtensions) {
+			if (strcmp(extension.extensionName, extensionName) == 0) {
+				return true;
+			}
+		}
+		return false;
 	}
 
 	// Function to check whether the device supports all required extensions
@@ -2672,22 +8499,120 @@ private:
 	// Main Loop Functions //
 	////////////////////////
 
+	// Function to wait for the deadline of the next frame when the frame rate is capped
+	// Sleeps until shortly before the deadline and yields for the rest, as sleeps often overshoot by a millisecond or more
+	void waitForFrameDeadline() {
+		if (settings.frameRateCap <= 0.0) {
+			return;
+		}
+
+		auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / settings.frameRateCap));
+		auto now = std::chrono::steady_clock::now();
+
+		// Restart the schedule on the first frame or when a whole period behind, instead of rendering a burst of frames to catch up
+		if (nextFrameDeadline == std::chrono::steady_clock::time_point() || now - nextFrameDeadline > period) {
+			nextFrameDeadline = now;
+		}
+		else if (now < nextFrameDeadline) {
+			std::this_thread::sleep_until(nextFrameDeadline - std::chrono::milliseconds(1));
+			while (std::chrono::steady_clock::now() < nextFrameDeadline) {
+				std::this_thread::yield();
+			}
+		}
+
+		nextFrameDeadline += period;
+	}
+
+	// Function to record the latency from sampling the input to the present request of the current frame
+	// Core Vulkan does not report when the image reaches the display, so this covers the acquire, recording and submission, and any blocking in the present call
+	void recordPresentLatency() {
+		auto presentTime = std::chrono::steady_clock::now();
+		inputToPresentLatency.add(std::chrono::duration<double, std::milli>(presentTime - inputSampleTime).count());
+		if (inputToPresentLatency.count == 1) {
+			firstPresentTime = presentTime;
+		}
+		lastPresentTime = presentTime;
+	}
+
+	// Function to print the presentation mode, the frame rate and the input to present latency
+	void reportPresentStatistics() {
+		if (inputToPresentLatency.count == 0) {
+			return;
+		}
+
+		double seconds = std::chrono::duration<double>(lastPresentTime - firstPresentTime).count();
+		if (settings.headless) {
+			std::cout << "present mode: offscreen, " << swapChainImages.size() << " images";
+		}
+		else {
+			std::cout << "present mode: " << presentModeName(swapChainPresentMode) << ", " << swapChainImages.size() << " swap chain images";
+		}
+		if (settings.frameRateCap > 0.0) {
+			std::cout << ", capped at " << settings.frameRateCap << " fps";
+		}
+		std::cout << std::endl;
+
+		if (seconds > 0.0) {
+			std::cout << "frame rate: " << (inputToPresentLatency.count - 1) / seconds << " fps over " << inputToPresentLatency.count << " frames" << std::endl;
+		}
+
+		std::cout << "input to present latency: mean " << inputToPresentLatency.mean() << " ms, min " << inputToPresentLatency.minimum << " ms, max " << inputToPresentLatency.maximum << " ms" << std::endl;
+	}
+
+	// Function to get the name of a presentation mode
+	static const char* presentModeName(VkPresentModeKHR presentMode) {
+		switch (presentMode) {
+		case VK_PRESENT_MODE_IMMEDIATE_KHR:
+			return "immediate";
+		case VK_PRESENT_MODE_MAILBOX_KHR:
+			return "mailbox";
+		case VK_PRESENT_MODE_FIFO_KHR:
+			return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+			return "fifo relaxed";
+		default:
+			return "unknown";
+		}
+	}
+
 	// Function to draw the frame on the screen
 	// Acquires the image from the swap chain and executes command buffer and returns the image to swap chain for presentation
 	void drawFrame() {
+		TRACE_SCOPE("drawFrame");
 
 		// Wait for frame to finish
-		vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+		{
+			TRACE_SCOPE("wait for frame fence");
+			vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+		}
+
+		// The last frame of this slot has completed, so its transient descriptor sets can be freed
+		descriptorAllocator.beginFrame(currentFrame);
+
+		// Every frame up to (frameCounter - MAX_FRAMES_IN_FLIGHT) has completed, so destroy the objects retired before them
+		if (frameCounter + 1 >= MAX_FRAMES_IN_FLIGHT) {
+			deletionQueue.flush(frameCounter + 1 - MAX_FRAMES_IN_FLIGHT);
+		}
 
 		// index of swap chain image
 		uint32_t imageIndex;
-		// Acquire image from swap chain
-		// 1st Parameter - GPU
-		// 2nd Parameter - Swap chain
-		// 3rd Parameter - timeout in nanoseconds for an image to become available
-		// 4th & 5th Parameter - synchronization object to signal when presentation engine used this image
-		// 6th Parameter - index of swap chain image
-		VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+		// Offscreen images are used in turn, one per frame in flight
+		VkResult result = VK_SUCCESS;
+		if (settings.headless) {
+			imageIndex = currentFrame;
+		}
+		else {
+			TRACE_SCOPE("acquire image");
+
+			// Acquire image from swap chain
+			// 1st Parameter - GPU
+			// 2nd Parameter - Swap chain
+			// 3rd Parameter - timeout in nanoseconds for an image to become available
+			// 4th & 5th Parameter - synchronization object to signal when presentation engine used this image
+			// 6th Parameter - index of swap chain image
+			result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+		}
 
 		// Check whether swap chain has become incompatible with the surface
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
@@ -2702,18 +8627,68 @@ private:
 
 		// Check if a previous frame is using this image (i.e. there is its fence to wait on)
 		if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+			TRACE_SCOPE("wait for image fence");
+
 			// Wait for the fences
 			vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
 		}
+
+		// The previous frame rendered to this image has completed, so its culling result can be verified and its image exported
+		if (settings.verifyCulling && cullingEnabled) {
+			verifyCulling(imageIndex);
+		}
+		if (!readbackSlots.empty()) {
+			consumeReadback(readbackSlots[imageIndex]);
+		}
+		collectGpuProfile(imageIndex);
+		collectFrameMetrics(imageIndex);
+
 		// Mark the image as now being in use by this frame
 		imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 
+		// The golden image check renders a canonical view in every frame
+		if (!settings.goldenDirectory.empty()) {
+			applyCanonicalView(frameCounter);
+		}
+
+		// Switch to the pipeline variant of the enabled lighting stages when a stage was toggled
+		// The command buffer of the image is idle, so it is re-recorded when it binds another variant
+		uint32_t stageMask = lightingStageMask();
+		if (stageMask != graphicsPipelineStageMask) {
+			graphicsPipeline = getPipelineVariant(stageMask);
+			graphicsPipelineStageMask = stageMask;
+		}
+		// Likewise when the scale of the dynamic resolution moved since the command buffer was recorded
+		updateRenderExtent();
+		if (commandBufferStageMasks[imageIndex] != graphicsPipelineStageMask || commandBufferExtents[imageIndex].width != renderExtent.width || commandBufferExtents[imageIndex].height != renderExtent.height) {
+			TRACE_SCOPE("record command buffer");
+			recordCommandBuffer(imageIndex);
+		}
+		if (dynamicResolutionEnabled) {
+			metrics.set("render_resolution_scale", resolutionController.scale());
+		}
+
 		// Update the uniform buffer to have the current model view projection matrices
 		updateUniformBuffer(imageIndex);
 
+		// Sort the objects front to back for the view of the frame
+		if (settings.sortDraws) {
+			updateDrawOrder(imageIndex);
+		}
+
 		// Update the uniform buffer to have the current ambient, specular, diffuse values
 		updateLightingConstants(imageIndex);
 
+		// Render the shadow map ahead of the frame only when the light or the shadow casters moved since it was last rendered
+		bool renderShadowMap = shadowMapVersion != sceneVersion;
+		if (renderShadowMap) {
+			TRACE_SCOPE("record shadow map");
+			recordShadowMap(currentFrame);
+			shadowMapVersion = sceneVersion;
+			metrics.add("shadow_map_renders_total", 1);
+		}
+		VkCommandBuffer frameCommandBuffers[] = { shadowCommandBuffers[currentFrame], commandBuffers[imageIndex] };
+
 		// Submit info to submit to command buffer
 		VkSubmitInfo submitInfo = {};
 		// Type of information stored in the structure
@@ -2722,20 +8697,20 @@ private:
 		VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
 		// Pipeline stage to wait
 		VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-		// Set the no of semaphores
-		submitInfo.waitSemaphoreCount = 1;
+		// Set the no of semaphores. Offscreen images are not acquired, so there is nothing to wait for
+		submitInfo.waitSemaphoreCount = settings.headless ? 0 : 1;
 		// Set the semaphores to wait for
 		submitInfo.pWaitSemaphores = waitSemaphores;
 		// Set the stages to wait
 		submitInfo.pWaitDstStageMask = waitStages;
-		// Set the no of command buffers to submit
-		submitInfo.commandBufferCount = 1;
+		// Set the no of command buffers to submit, with the shadow pass first when it was recorded
+		submitInfo.commandBufferCount = renderShadowMap ? 2 : 1;
 		// Set the pointer to command buffers to submit
-		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+		submitInfo.pCommandBuffers = renderShadowMap ? frameCommandBuffers : &commandBuffers[imageIndex];
 		// Semaphores to signal after command buffer execution
 		VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-		// Set the no of semaphores to signal
-		submitInfo.signalSemaphoreCount = 1;
+		// Set the no of semaphores to signal. Offscreen images are not presented, so there is nothing to signal
+		submitInfo.signalSemaphoreCount = settings.headless ? 0 : 1;
 		// Set the semaphores to signal
 		submitInfo.pSignalSemaphores = signalSemaphores;
 
@@ -2747,9 +8722,47 @@ private:
 		// 2nd Parameter - No of submit infos
 		// 3rd Parameter - pointer to submit infos
 		// 4th Parameter - optional fence signaled when command buffer is executed
-		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
-			// Throw runtime error exception as the submission of command buffer to graphics queue failed
-			throw std::runtime_error("failed to submit draw command buffer!");
+		{
+			TRACE_SCOPE("submit");
+			if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+				// Throw runtime error exception as the submission of command buffer to graphics queue failed
+				throw std::runtime_error("failed to submit draw command buffer!");
+			}
+		}
+
+		// The image of this frame is exported once the image is reused
+		if (!readbackSlots.empty()) {
+			if (frameCounter == 0) {
+				exportStartTime = std::chrono::steady_clock::now();
+			}
+			readbackSlots[imageIndex].pending = true;
+			readbackSlots[imageIndex].frame = frameCounter;
+		}
+
+		// Measure the CPU frame time as the time between submissions, and note the frame whose GPU scopes the image now holds
+		if (settings.benchmark) {
+			auto now = std::chrono::steady_clock::now();
+			if (frameCounter > 0) {
+				recordFrameTime(cpuFrameTimes, sweepCpuFrameTimes, frameCounter - 1, std::chrono::duration<double, std::milli>(now - lastFrameTime).count());
+			}
+			lastFrameTime = now;
+		}
+		gpuProfiler.markSubmitted(imageIndex, frameCounter);
+		if (!metricsPending.empty()) {
+			metricsPending[imageIndex] = true;
+		}
+
+		// Count the submitted frame so that objects retired from now on wait for it
+		frameCounter++;
+
+		// The culling result of this frame can be verified once the image is reused
+		cullingResultPending[imageIndex] = cullingEnabled;
+
+		// The offscreen image is complete once the frame finishes. There is nothing to present
+		if (settings.headless) {
+			recordPresentLatency();
+			currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+			return;
 		}
 
 		// Configuring the presentation using present info
@@ -2772,7 +8785,13 @@ private:
 		presentInfo.pResults = nullptr;
 
 		// Submit a request to present the image to swap chain
-		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		{
+			TRACE_SCOPE("present");
+			result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		}
+
+		// Measure the latency from sampling the input to the present request
+		recordPresentLatency();
 
 		// Check whether the swap chain has become incompatible with the surface or the surface properties no longer match or frame buffer is resized
 		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
@@ -2794,27 +8813,234 @@ private:
 
 	// Function to update uniform buffer values
 	void updateUniformBuffer(uint32_t currentImage) {
-		
-		UniformBufferObject ubo = {};
-		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(-10.0f , 0.0f + translate_x * 2, -15.0f + translate_y * 2)) * glm::rotate(glm::mat4(1.0f), glm::radians(10.0f) * rotate_y, glm::vec3(0.0f,1.0f , 0.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(10.0f) * rotate_x, glm::vec3(0.0f, 0.0f, 1.0f));
-		//ubo.view = glm::lookAt(glm::vec3(0.0f, -100.0f, 100.0f), glm::vec3(0.0f, 0.0f, 40.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.view = glm::lookAt(glm::vec3(85.0f, 2.0f, 100.0f), glm::vec3(0.0f, 0.0f, 40.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 1000.0f);
-		ubo.proj[1][1] *= -1;
+		TRACE_SCOPE("updateUniformBuffer");
+
+		UniformBufferObject ubo = computeUniforms();
+
+		// Keep the values to verify the culling pass against them
+		imageUniforms[currentImage] = ubo;
 
 		void* data;
 		vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
 		memcpy(data, &ubo, sizeof(ubo));
 		vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
+		metrics.add("vulkan_upload_bytes_total{kind=\"uniform\"}", sizeof(ubo));
+	}
+
+	// Function to sort the objects of every mesh front to back by the view depth of their bounding sphere centres
+	// Objects only swap places with objects of the same mesh, as the draws of a mesh address a fixed range of instance indices
+	void updateDrawOrder(uint32_t currentImage) {
+		TRACE_SCOPE("updateDrawOrder");
+
+		const UniformBufferObject& ubo = imageUniforms[currentImage];
+		glm::mat4 modelView = ubo.view * ubo.model;
+		drawDepths.resize(sceneObjects.size());
+		for (size_t i = 0; i < sceneObjects.size(); i++) {
+			const glm::vec4& sphere = meshRanges[sceneObjects[i].meshIndex].boundingSphere;
+			drawDepths[i] = -(modelView * sceneObjects[i].model * glm::vec4(sphere.x, sphere.y, sphere.z, 1.0f)).z;
+		}
+		for (const auto& run : meshRuns) {
+			std::sort(drawOrder.begin() + run.first, drawOrder.begin() + run.first + run.second, [this](uint32_t a, uint32_t b) { return drawDepths[a] < drawDepths[b]; });
+		}
+
+		writeDrawOrder(currentImage);
+	}
+
+	// Function to write the draw order to the draw order buffer of a swap chain image
+	void writeDrawOrder(uint32_t currentImage) {
+		VkDeviceSize size = sizeof(uint32_t) * drawOrder.size();
+		void* data;
+		vkMapMemory(device, drawOrderBuffersMemory[currentImage], 0, size, 0, &data);
+		memcpy(data, drawOrder.data(), static_cast<size_t>(size));
+		vkUnmapMemory(device, drawOrderBuffersMemory[currentImage]);
+		metrics.add("vulkan_upload_bytes_total{kind=\"draw_order\"}", static_cast<double>(size));
+	}
+
+	// Function to compute the model view projection matrices of the current frame
+	UniformBufferObject computeUniforms() const {
+		UniformBufferObject ubo = {};
+		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(-10.0f , 0.0f + translate_x * 2, -15.0f + translate_y * 2)) * glm::rotate(glm::mat4(1.0f), glm::radians(10.0f) * rotate_y, glm::vec3(0.0f,1.0f , 0.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(10.0f) * rotate_x, glm::vec3(0.0f, 0.0f, 1.0f));
+		//ubo.view = glm::lookAt(glm::vec3(0.0f, -100.0f, 100.0f), glm::vec3(0.0f, 0.0f, 40.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		ubo.view = glm::lookAt(glm::vec3(85.0f, 2.0f, 100.0f), glm::vec3(0.0f, 0.0f, 40.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+
+		// The benchmark ignores the mouse and orbits the camera around the flock, bobbing up and down twice per orbit
+		if (settings.benchmark) {
+			float angle = glm::radians(360.0f) * benchmarkProgress();
+			glm::vec3 eye(85.0f * std::cos(angle), 85.0f * std::sin(angle), 100.0f + 20.0f * std::sin(2.0f * angle));
+			ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(-10.0f, 0.0f, -15.0f));
+			ubo.view = glm::lookAt(eye, glm::vec3(0.0f, 0.0f, 40.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		}
+		ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, nearPlaneDistance, farPlaneDistance);
+		ubo.proj[1][1] *= -1;
+		return ubo;
 	}
 
 	// Function to update lighting constant values
 	void updateLightingConstants(uint32_t currentImage) {
-		
+		TRACE_SCOPE("updateLightingConstants");
+
+		animateLight();
+		lightingConstants.viewLightPosition = imageUniforms[currentImage].view * lightingConstants.lightPosition;
+
+		// Light space of the shadow map, and the matrix from the view space of the frame to it
+		updateShadowLight(imageUniforms[currentImage]);
+
+		// Cluster grid over the swap chain image, and the point lights binned into it
+		uint32_t lightCount = activePointLightCount(frameCounter);
+		glm::vec2 slice = LightClusterBuilder::sliceScaleBias();
+		lightingConstants.clusterGrid = glm::uvec4(clusterTilesX, clusterTilesY, clusterSlices, lightCount);
+		lightingConstants.clusterScale = glm::vec4(clusterTilesX / static_cast<float>(renderExtent.width), clusterTilesY / static_cast<float>(renderExtent.height), slice.x, slice.y);
+		if (lightCount > 0) {
+			updateLightClusters(currentImage, lightCount);
+		}
+
 		void* lightData;
-		vkMapMemory(device, lightingBuffersMemory[currentImage], 0, sizeof(m.lightingConstants), 0, &lightData);
-		memcpy(lightData, &m.lightingConstants, sizeof(m.lightingConstants));
+		vkMapMemory(device, lightingBuffersMemory[currentImage], 0, sizeof(lightingConstants), 0, &lightData);
+		memcpy(lightData, &lightingConstants, sizeof(lightingConstants));
 		vkUnmapMemory(device, lightingBuffersMemory[currentImage]);
+		metrics.add("vulkan_upload_bytes_total{kind=\"uniform\"}", sizeof(lightingConstants));
+	}
+
+	// Function to bin the point lights of the frame into clusters and write them to the point light buffer of a swap chain image
+	void updateLightClusters(uint32_t currentImage, uint32_t lightCount) {
+		TRACE_SCOPE("updateLightClusters");
+
+		const UniformBufferObject& ubo = imageUniforms[currentImage];
+		lightClusterBuilder.build(pointLights, lightCount, ubo.view * ubo.model, ubo.proj);
+
+		VkDeviceSize lightBytes = lightClusterBuilder.viewLights.size() * sizeof(PointLight);
+		VkDeviceSize rangeBytes = lightClusterBuilder.ranges.size() * sizeof(uint32_t);
+		VkDeviceSize indexBytes = lightClusterBuilder.indices.size() * sizeof(uint32_t);
+
+		void* data;
+		vkMapMemory(device, clusterBuffersMemory[currentImage], 0, clusterBufferSize, 0, &data);
+		memcpy(data, lightClusterBuilder.viewLights.data(), static_cast<size_t>(lightBytes));
+		memcpy(static_cast<char*>(data) + clusterRangesOffset, lightClusterBuilder.ranges.data(), static_cast<size_t>(rangeBytes));
+		memcpy(static_cast<char*>(data) + clusterIndicesOffset, lightClusterBuilder.indices.data(), static_cast<size_t>(indexBytes));
+		vkUnmapMemory(device, clusterBuffersMemory[currentImage]);
+		metrics.add("vulkan_upload_bytes_total{kind=\"lights\"}", static_cast<double>(lightBytes + rangeBytes + indexBytes));
+	}
+
+	// Function to count a new scene version when the light or the shadow casters moved, and to find the light space of its shadow map
+	// The shadow map looks from the light at the sphere around all shadow casters, fitting the sphere into its view
+	void updateShadowLight(const UniformBufferObject& ubo) {
+		if (settings.shadows && (lightingConstants.lightPosition != sceneLightPosition || ubo.model != sceneModel)) {
+			sceneLightPosition = lightingConstants.lightPosition;
+			sceneModel = ubo.model;
+			sceneVersion++;
+
+			glm::vec3 light = glm::vec3(sceneLightPosition);
+			glm::vec3 centre = glm::vec3(sceneModel * glm::vec4(glm::vec3(shadowCasterBounds), 1.0f));
+			float radius = shadowCasterBounds.w;
+			glm::vec3 direction = centre - light;
+			float distance = std::max(glm::length(direction), nearPlaneDistance);
+
+			// A light inside the sphere cannot see all of it, so the view is limited to 150 degrees
+			float halfAngle = distance > radius ? std::asin(radius / distance) : glm::radians(75.0f);
+			halfAngle = std::min(halfAngle, glm::radians(75.0f));
+			glm::vec3 up = std::abs(direction.z) > 0.99f * distance ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+
+			shadowUniforms.model = sceneModel;
+			shadowUniforms.view = glm::lookAt(light, centre, up);
+			shadowUniforms.proj = glm::perspective(2.0f * halfAngle, 1.0f, std::max(distance - radius, nearPlaneDistance), distance + radius);
+			shadowUniforms.proj[1][1] *= -1;
+		}
+
+		// Scale and bias from clip space to the texture coordinates of the shadow map, keeping the depth
+		glm::mat4 shadowBias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f, 0.5f, 0.0f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f, 0.5f, 1.0f));
+		lightingConstants.shadowMatrix = shadowBias * shadowUniforms.proj * shadowUniforms.view * glm::inverse(ubo.view);
+		lightingConstants.shadowParams = glm::vec4(settings.shadows ? 1.0f : 0.0f, 1.0f / settings.shadowMapSize, 0.0f, 0.0f);
+	}
+
+	// Function to get the no of point lights lit in a frame
+	// The light sweep doubles them every step, starting from one
+	uint32_t activePointLightCount(uint64_t frame) const {
+		if (settings.lightSweep && settings.lightSweepStepFrames > 0) {
+			return std::min(settings.pointLightCount, 1u << (frame / settings.lightSweepStepFrames));
+		}
+		return settings.pointLightCount;
+	}
+
+	// Function to move the light of the current frame
+	void animateLight() {
+		// The benchmark circles the light around the flock in the opposite direction to the camera
+		if (settings.benchmark) {
+			float angle = -glm::radians(360.0f) * benchmarkProgress();
+			glm::vec4 basePosition = meshes[0].lightingConstants.lightPosition;
+			lightingConstants.lightPosition = glm::vec4(basePosition.x * std::cos(angle) - basePosition.y * std::sin(angle), basePosition.x * std::sin(angle) + basePosition.y * std::cos(angle), basePosition.z, 1.0f);
+		}
+	}
+
+	// Function to render the frames on the CPU with the software rasterizer
+	// Reproduces the shaders without a Vulkan device, as a reference for the lighting and a fallback where there is no GPU
+	// The shadow map and the point lights are not reproduced, so parseCommandLine turns them off on this path and for the golden images
+	void runSoftwareRenderer() {
+		loadScene();
+
+		int texWidth, texHeight;
+		SoftwareTexture texture;
+		texture.load(LoadTexture("12248_Bird_v1_diff.ppm", texWidth, texHeight), static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+
+		// The projection follows the aspect ratio of the frame
+		swapChainExtent = { settings.width, settings.height };
+
+		uint32_t threadCount = settings.softwareThreadCount > 0 ? settings.softwareThreadCount : std::max(1u, std::thread::hardware_concurrency());
+		SoftwareRasterizer rasterizer(threadCount);
+		rasterizer.resize(settings.width, settings.height);
+
+		if (!settings.exportPath.empty()) {
+			imageWriter.reset(new ImageWriterPool(std::max(1u, settings.writerThreadCount)));
+			exportStartTime = std::chrono::steady_clock::now();
+		}
+
+		double totalMilliseconds = 0.0;
+		uint64_t totalTriangles = 0;
+		uint64_t totalFragments = 0;
+		for (frameCounter = 0; frameCounter < settings.frameCount; frameCounter++) {
+			TRACE_SCOPE("software frame");
+			animateLight();
+			if (!settings.goldenDirectory.empty()) {
+				applyCanonicalView(frameCounter);
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			rasterizer.render(meshes, sceneObjects, computeUniforms(), lightingConstants, texture);
+			double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			totalMilliseconds += milliseconds;
+			totalTriangles += rasterizer.lastFrame().trianglesSubmitted;
+			totalFragments += rasterizer.lastFrame().fragmentsShaded;
+			recordFrameTime(cpuFrameTimes, sweepCpuFrameTimes, frameCounter, milliseconds);
+
+			if (imageWriter || !settings.goldenDirectory.empty()) {
+				ImageWriteJob job;
+				job.path = imageWriter ? exportFramePath(settings.exportPath, frameCounter) : std::string();
+				job.width = settings.width;
+				job.height = settings.height;
+				job.bgra = false;
+				job.pixels = rasterizer.pixels();
+				if (!settings.goldenDirectory.empty()) {
+					checkGolden(frameCounter, job);
+				}
+				if (imageWriter) {
+					imageWriter->submit(std::move(job));
+				}
+			}
+		}
+
+		// Report the throughput of the rasterizer
+		std::cout << "software rasterizer: " << frameCounter << " frames of " << settings.width << "x" << settings.height << " on " << threadCount << " threads";
+		if (totalMilliseconds > 0.0) {
+			std::cout << ", " << totalMilliseconds / std::max<uint64_t>(1, frameCounter) << " ms per frame, "
+				<< totalTriangles / totalMilliseconds / 1000.0 << " Mtriangles/s, " << totalFragments / totalMilliseconds / 1000.0 << " Mfragments/s";
+		}
+		std::cout << std::endl;
+
+		finishExport();
+		reportGoldenResults();
+		if (settings.benchmark) {
+			writeBenchmarkResults();
+		}
 	}
 
 	// Function to recreate swap chain and other components when window is resized
@@ -2830,10 +9056,9 @@ private:
 			// Wait for the window to be maximized
 			glfwWaitEvents();
 		}
-		// Wait for the device to complete its operations
-		vkDeviceWaitIdle(device);
 
-		// Cleanup existing swap chain and dependent components
+		// Retire existing swap chain and dependent components
+		// They are destroyed by the deletion queue once the frames in flight complete, so the device is not idled
 		cleanupSwapChain();
 
 		// Create swap chain
@@ -2847,75 +9072,468 @@ private:
 
 		createDepthResources();
 
+		createColorResources();
+
 		// Create frame buffers
 		createFramebuffers();
 
 
 		createUniformBuffers();
 
-		createDescriptorPool();
+		createCullingBuffers();
+
+		createReadbackBuffers();
+
+		createGpuProfiler();
+		createStatisticsQueries();
 
 		createDescriptorSets();
 
+		createCullingDescriptorSets();
+
 		// Create command buffers
 		createCommandBuffers();
+
+		// The new swap chain images are not used by any frame yet
+		imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
 	}
 
 	////////////////////////
 	// Cleanup Functions //
 	//////////////////////
 
-	// Cleanup function to destroy swap chain and related components
+	// Cleanup function to retire swap chain and related components
+	// The objects are handed to the deletion queue and destroyed once the frames submitted so far have completed
 	void cleanupSwapChain() {
 		
-		// Destroy the depth image view, depth image and depth memory
-		vkDestroyImageView(device, depthImageView, nullptr);
-		vkDestroyImage(device, depthImage, nullptr);
-		vkFreeMemory(device, depthImageMemory, nullptr);
+		// Retire the depth image view, depth image and depth memory
+		retireImage(depthImage, depthImageMemory, depthImageView);
 
-		// Destroy the frame buffers
-		for (auto framebuffer : swapChainFramebuffers) {
-			vkDestroyFramebuffer(device, framebuffer, nullptr);
+		// Retire the multisampled colour image
+		if (colorImage != VK_NULL_HANDLE) {
+			retireImage(colorImage, colorImageMemory, colorImageView);
+			colorImage = VK_NULL_HANDLE;
 		}
 
-		// Destroy the graphics pipeline
-		vkDestroyPipeline(device, graphicsPipeline, nullptr);
+		// Retire the scene images of the dynamic resolution
+		for (size_t i = 0; i < sceneColorImages.size(); i++) {
+			retireImage(sceneColorImages[i], sceneColorImagesMemory[i], sceneColorImageViews[i]);
+		}
+		sceneColorImages.clear();
+		sceneColorImagesMemory.clear();
+		sceneColorImageViews.clear();
 
-		// Destroy the pipeline layout
-		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		// Retire the frame buffers
+		for (auto framebuffer : swapChainFramebuffers) {
+			deletionQueue.push(frameCounter, [this, framebuffer]() { vkDestroyFramebuffer(device, framebuffer, nullptr); });
+		}
 
-		// Destroy the render pass
-		vkDestroyRenderPass(device, renderPass, nullptr);
+		// Retire the command buffers recorded against the frame buffers
+		std::vector<VkCommandBuffer> retiredCommandBuffers = commandBuffers;
+		deletionQueue.push(frameCounter, [this, retiredCommandBuffers]() {
+			vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(retiredCommandBuffers.size()), retiredCommandBuffers.data());
+		});
+
+		// Retire the graphics pipeline variants, the pipeline layout and the render pass
+		// The variants are created again for the new swap chain when they are used
+		std::map<uint32_t, VkPipeline> retiredPipelines;
+		retiredPipelines.swap(pipelineVariants);
+		VkPipelineLayout retiredPipelineLayout = pipelineLayout;
+		VkRenderPass retiredRenderPass = renderPass;
+		deletionQueue.push(frameCounter, [this, retiredPipelines, retiredPipelineLayout, retiredRenderPass]() {
+			for (const auto& variant : retiredPipelines) {
+				vkDestroyPipeline(device, variant.second, nullptr);
+			}
+			vkDestroyPipelineLayout(device, retiredPipelineLayout, nullptr);
+			vkDestroyRenderPass(device, retiredRenderPass, nullptr);
+		});
 
-		// Destroy the image views
+		// Retire the image views
 		for (auto imageView : swapChainImageViews) {
-			vkDestroyImageView(device, imageView, nullptr);
+			deletionQueue.push(frameCounter, [this, imageView]() { vkDestroyImageView(device, imageView, nullptr); });
 		}
 
-		// Destroy the swap chain
-		vkDestroySwapchainKHR(device, swapChain, nullptr);
+		// Retire the swap chain, or the offscreen images standing in for it
+		// The handle stays in swapChain so that it can be passed as the old swap chain when the swap chain is recreated
+		if (settings.headless) {
+			for (size_t i = 0; i < swapChainImages.size(); i++) {
+				VkImage image = swapChainImages[i];
+				VkDeviceMemory imageMemory = offscreenImagesMemory[i];
+				deletionQueue.push(frameCounter, [this, image, imageMemory]() {
+					vkDestroyImage(device, image, nullptr);
+					freeMemory(imageMemory);
+				});
+			}
+		}
+		else {
+			VkSwapchainKHR retiredSwapChain = swapChain;
+			deletionQueue.push(frameCounter, [this, retiredSwapChain]() { vkDestroySwapchainKHR(device, retiredSwapChain, nullptr); });
+		}
 
-		// Cleanup the uniform buffer and lighting constants buffer
+		// Retire the uniform buffer, lighting constants buffer and point light buffer
 		for (size_t i = 0; i < swapChainImages.size(); i++) {
-			vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-			vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+			retireBuffer(uniformBuffers[i], uniformBuffersMemory[i]);
+			retireBuffer(lightingBuffers[i], lightingBuffersMemory[i]);
+			retireBuffer(clusterBuffers[i], clusterBuffersMemory[i]);
+		}
+
+		// Retire the buffers written by the culling pass and the draw order buffers
+		for (size_t i = 0; i < culledDrawBuffers.size(); i++) {
+			retireBuffer(culledDrawBuffers[i], culledDrawBuffersMemory[i]);
+			retireBuffer(culledDrawOrderBuffers[i], culledDrawOrderBuffersMemory[i]);
+			retireBuffer(culledDrawCountBuffers[i], culledDrawCountBuffersMemory[i]);
+			retireBuffer(drawOrderBuffers[i], drawOrderBuffersMemory[i]);
+		}
+
+		// Retire the pipeline statistics queries. Statistics of frames still in flight are not reported
+		if (statisticsQueryPool != VK_NULL_HANDLE) {
+			VkQueryPool retiredQueryPool = statisticsQueryPool;
+			deletionQueue.push(frameCounter, [this, retiredQueryPool]() { vkDestroyQueryPool(device, retiredQueryPool, nullptr); });
+			statisticsQueryPool = VK_NULL_HANDLE;
+		}
+
+		// Retire the profiler query pool. Scopes of frames still in flight are not measured
+		if (gpuProfiler.enabled()) {
+			VkQueryPool retiredQueryPool = gpuProfiler.releaseQueryPool();
+			deletionQueue.push(frameCounter, [this, retiredQueryPool]() { vkDestroyQueryPool(device, retiredQueryPool, nullptr); });
+		}
 
-			vkDestroyBuffer(device, lightingBuffers[i], nullptr);
-			vkFreeMemory(device, lightingBuffersMemory[i], nullptr);
+		// Retire the readback slots. A frame still waiting in a slot is exported once it has completed
+		for (auto& slot : readbackSlots) {
+			ReadbackSlot retiredSlot = slot;
+			deletionQueue.push(frameCounter, [this, retiredSlot]() mutable {
+				consumeReadback(retiredSlot);
+				vkDestroyBuffer(device, retiredSlot.buffer, nullptr);
+				freeMemory(retiredSlot.memory);
+			});
 		}
+		readbackSlots.clear();
+
+		// Recycle the descriptor sets, which refer to the retired buffers, once the frames using them have completed
+		auto releasedSets = descriptorAllocator.releaseCachedSets();
+		deletionQueue.push(frameCounter, [this, releasedSets]() { descriptorAllocator.recycle(releasedSets); });
+	}
+
+	// Function to retire a buffer and its memory until the frames in flight have completed
+	void retireBuffer(VkBuffer buffer, VkDeviceMemory bufferMemory) {
+		deletionQueue.push(frameCounter, [this, buffer, bufferMemory]() {
+			vkDestroyBuffer(device, buffer, nullptr);
+			freeMemory(bufferMemory);
+		});
+	}
 
-		// Destroy the descriptor pool
-		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	// Function to retire an image, its memory and its view until the frames in flight have completed
+	void retireImage(VkImage image, VkDeviceMemory imageMemory, VkImageView imageView) {
+		deletionQueue.push(frameCounter, [this, image, imageMemory, imageView]() {
+			vkDestroyImageView(device, imageView, nullptr);
+			vkDestroyImage(device, image, nullptr);
+			freeMemory(imageMemory);
+		});
 	}
 };
 
-// Main function
-int main() {
+// Function to parse the command line arguments into the application settings
+AppSettings parseCommandLine(int argc, char* argv[]) {
+	AppSettings settings;
+
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+
+		// Check whether the option is followed by a value
+		bool hasValue = i + 1 < argc;
+
+		if (argument == "--instances" && hasValue) {
+			// No of copies of the bird in the flock
+			settings.instanceCount = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (argument == "--no-instancing") {
+			// Draw every copy with its own draw
+			settings.instancing = false;
+		}
+		else if (argument == "--no-bindless") {
+			// Bind the texture on its own instead of indexing it from the bindless texture array
+			settings.bindless = false;
+		}
+		else if (argument == "--no-gpu-culling") {
+			// Draw every object without the culling pass
+			settings.gpuCulling = false;
+		}
+		else if (argument == "--verify-culling") {
+			// Compare the culling pass with the CPU reference every frame
+			settings.verifyCulling = true;
+		}
+		else if (argument == "--present" && hasValue) {
+			// Presentation policy of the swap chain
+			std::string policy = argv[++i];
+			if (policy == "uncapped") {
+				settings.presentPolicy = PresentPolicy::Uncapped;
+			}
+			else if (policy == "vsync") {
+				settings.presentPolicy = PresentPolicy::Vsync;
+			}
+			else if (policy == "relaxed") {
+				settings.presentPolicy = PresentPolicy::Relaxed;
+			}
+			else if (policy == "mailbox") {
+				settings.presentPolicy = PresentPolicy::Mailbox;
+			}
+			else {
+				throw std::invalid_argument("unknown present policy: " + policy);
+			}
+		}
+		else if (argument == "--fps-cap" && hasValue) {
+			// Max frame rate enforced by the frame pacer
+			settings.frameRateCap = std::max(0.0, std::atof(argv[++i]));
+		}
+		else if (argument == "--headless") {
+			// Render offscreen without a window
+			settings.headless = true;
+		}
+		else if (argument == "--frames" && hasValue) {
+			// No of frames to render before exiting
+			settings.frameCount = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (argument == "--size" && hasValue) {
+			// Size of the window or offscreen images as WIDTHxHEIGHT
+			std::string size = argv[++i];
+			size_t separator = size.find('x');
+			int width = separator == std::string::npos ? 0 : std::atoi(size.substr(0, separator).c_str());
+			int height = separator == std::string::npos ? 0 : std::atoi(size.substr(separator + 1).c_str());
+			if (width <= 0 || height <= 0) {
+				throw std::invalid_argument("invalid size: " + size);
+			}
+			settings.width = static_cast<uint32_t>(width);
+			settings.height = static_cast<uint32_t>(height);
+		}
+		else if (argument == "--export" && hasValue) {
+			// Path of the exported frames
+			settings.exportPath = argv[++i];
+		}
+		else if (argument == "--writer-threads" && hasValue) {
+			// No of threads writing the exported frames
+			settings.writerThreadCount = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (argument == "--benchmark") {
+			// Replay the scripted path and report frame times
+			settings.benchmark = true;
+		}
+		else if (argument == "--benchmark-warmup" && hasValue) {
+			// No of frames left out of the benchmark statistics
+			settings.benchmarkWarmupFrames = static_cast<uint32_t>(std::max(0, std::atoi(argv[++i])));
+		}
+		else if (argument == "--benchmark-output" && hasValue) {
+			// Path of the benchmark results
+			settings.benchmarkOutputPath = argv[++i];
+		}
+		else if (argument == "--gpu-profile") {
+			// Time the passes and draw groups on the GPU
+			settings.gpuProfiling = true;
+		}
+		else if (argument == "--gpu-trace" && hasValue) {
+			// Write the GPU scopes as a Chrome trace
+			settings.gpuProfiling = true;
+			settings.gpuTracePath = argv[++i];
+		}
+		else if (argument == "--cpu-trace" && hasValue) {
+			// Write the CPU scopes merged with the GPU scopes as a Chrome trace
+			settings.cpuTracePath = argv[++i];
+		}
+		else if (argument == "--metrics" && hasValue) {
+			// Write the frame, upload and memory metrics to a text file
+			settings.metricsPath = argv[++i];
+		}
+		else if (argument == "--metrics-interval" && hasValue) {
+			// No of frames between two writes of the metrics file
+			settings.metricsIntervalFrames = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (argument == "--software") {
+			// Render on the CPU with the software rasterizer instead of Vulkan
+			settings.software = true;
+		}
+		else if (argument == "--software-threads" && hasValue) {
+			// No of threads of the software rasterizer
+			settings.softwareThreadCount = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (argument == "--device" && hasValue) {
+			// Use the first GPU whose name contains the value
+			settings.deviceName = argv[++i];
+		}
+		else if (argument == "--golden" && hasValue) {
+			// Compare the canonical views with the golden images in the directory
+			settings.goldenDirectory = argv[++i];
+		}
+		else if (argument == "--golden-update" && hasValue) {
+			// Write the canonical views as the golden images of the directory
+			settings.goldenDirectory = argv[++i];
+			settings.goldenUpdate = true;
+		}
+		else if (argument == "--golden-diff" && hasValue) {
+			// Directory the images of the failed views are written to
+			settings.goldenDiffDirectory = argv[++i];
+		}
+		else if (argument == "--golden-tolerance" && hasValue) {
+			// Largest colour channel difference not counted as a differing pixel
+			settings.goldenTolerance = static_cast<uint32_t>(std::max(0, std::atoi(argv[++i])));
+		}
+		else if (argument == "--golden-max-differing" && hasValue) {
+			// Largest fraction of differing pixels of a passing view
+			settings.goldenMaxDifferingPixels = std::atof(argv[++i]);
+		}
+		else if (argument == "--golden-min-ssim" && hasValue) {
+			// Smallest structural similarity of a passing view
+			settings.goldenMinSsim = std::atof(argv[++i]);
+		}
+		else if (argument == "--mipmaps" && hasValue) {
+			// Generation of the mip levels of the texture
+			std::string generation = argv[++i];
+			if (generation == "auto") {
+				settings.mipmapGeneration = MipmapGeneration::Auto;
+			}
+			else if (generation == "gpu") {
+				settings.mipmapGeneration = MipmapGeneration::Gpu;
+			}
+			else if (generation == "cpu") {
+				settings.mipmapGeneration = MipmapGeneration::Cpu;
+			}
+			else if (generation == "off") {
+				settings.mipmapGeneration = MipmapGeneration::Off;
+			}
+			else {
+				throw std::invalid_argument("unknown mipmap generation: " + generation);
+			}
+		}
+		else if (argument == "--texture-compression" && hasValue) {
+			// Block compressed format of the texture
+			std::string compression = argv[++i];
+			if (compression == "auto") {
+				settings.textureCompression = TextureCompression::Auto;
+			}
+			else if (compression == "bc1") {
+				settings.textureCompression = TextureCompression::Bc1;
+			}
+			else if (compression == "bc3") {
+				settings.textureCompression = TextureCompression::Bc3;
+			}
+			else if (compression == "bc7") {
+				settings.textureCompression = TextureCompression::Bc7;
+			}
+			else if (compression == "etc2") {
+				settings.textureCompression = TextureCompression::Etc2;
+			}
+			else if (compression == "off") {
+				settings.textureCompression = TextureCompression::Off;
+			}
+			else {
+				throw std::invalid_argument("unknown texture compression: " + compression);
+			}
+		}
+		else if (argument == "--pipeline-cache" && hasValue) {
+			// File of the pipeline cache
+			settings.pipelineCachePath = argv[++i];
+		}
+		else if (argument == "--push-constants") {
+			// Draw every object on its own with push constants, which needs no instancing and no culling pass
+			settings.pushConstantDraws = true;
+			settings.instancing = false;
+			settings.gpuCulling = false;
+		}
+		else if (argument == "--depth-prepass") {
+			// Draw the depth of the scene before shading it
+			settings.depthPrepass = true;
+		}
+		else if (argument == "--no-draw-sorting") {
+			// Draw the objects in scene order
+			settings.sortDraws = false;
+		}
+		else if (argument == "--no-shadows") {
+			// Light the scene without the shadow map
+			settings.shadows = false;
+		}
+		else if (argument == "--shadow-map-size" && hasValue) {
+			// Width and height of the shadow map
+			settings.shadowMapSize = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if (argument == "--lights" && hasValue) {
+			// No of point lights around the flock
+			settings.pointLightCount = std::min(maxPointLights, static_cast<uint32_t>(std::max(0, std::atoi(argv[++i]))));
+		}
+		else if (argument == "--light-sweep") {
+			// Benchmark every power of two no of point lights
+			settings.lightSweep = true;
+			settings.benchmark = true;
+		}
+		else if (argument == "--msaa" && hasValue) {
+			// Samples per pixel, rounded down to a power of two up to 8
+			int samples = std::min(8, std::max(1, std::atoi(argv[++i])));
+			settings.sampleCount = samples >= 8 ? 8 : samples >= 4 ? 4 : samples >= 2 ? 2 : 1;
+		}
+		else if (argument == "--dynamic-resolution" && hasValue) {
+			// Frame rate to keep by scaling the resolution the scene is rendered at
+			settings.dynamicResolution = true;
+			settings.dynamicResolutionTargetFps = std::max(1.0, std::atof(argv[++i]));
+		}
+		else if (argument == "--min-resolution-scale" && hasValue) {
+			// Lowest scale of the width and height at a dynamic resolution
+			settings.minimumResolutionScale = std::min(1.0f, std::max(0.1f, static_cast<float>(std::atof(argv[++i]))));
+		}
+		else if (argument == "--swapchain-images" && hasValue) {
+			// No of swap chain images, clamped to the limits of the surface
+			settings.swapChainImageCount = static_cast<uint32_t>(std::max(0, std::atoi(argv[++i])));
+		}
+		else {
+			throw std::invalid_argument("unknown command line argument: " + argument);
+		}
+	}
 
-	// Instance to Vulkan Application
-	HelloTriangleApplication app;
+	// The software rasterizer reproduces shader.frag with the light of the scene, but without the shadow map and the point lights
+	if (settings.software && (settings.pointLightCount > 0 || settings.lightSweep)) {
+		throw std::invalid_argument("--lights and --light-sweep are not supported by the software rasterizer");
+	}
+	if (settings.software && settings.shadows) {
+		std::cout << "shadows disabled: the software rasterizer does not render the shadow map" << std::endl;
+		settings.shadows = false;
+	}
+
+	// The golden image check renders every canonical view once, offscreen unless on the software rasterizer
+	// Both backends share the golden images, so the GPU renders them without the shadows and point lights the software rasterizer lacks
+	if (!settings.goldenDirectory.empty()) {
+		settings.frameCount = canonicalViewCount;
+		settings.headless = !settings.software;
+		settings.benchmark = false;
+		if (settings.shadows || settings.pointLightCount > 0) {
+			std::cout << "shadows and point lights disabled: the golden images are shared with the software rasterizer" << std::endl;
+		}
+		settings.shadows = false;
+		settings.pointLightCount = 0;
+	}
+
+	// The benchmark replays its path over a fixed no of frames, 300 unless told otherwise
+	if (settings.benchmark && settings.frameCount == 0) {
+		settings.frameCount = 300;
+	}
+
+	// The light sweep replays the path once for every step, with as many point lights as the step needs
+	if (settings.lightSweep && settings.benchmark) {
+		settings.lightSweepStepFrames = settings.frameCount;
+		settings.frameCount *= lightSweepSteps;
+		settings.pointLightCount = maxPointLights;
+	}
+
+	// Offscreen and software rendering have no window to close, so render a single frame unless told otherwise
+	if ((settings.headless || settings.software) && settings.frameCount == 0) {
+		settings.frameCount = 1;
+	}
+
+	return settings;
+}
+
+// Main function
+int main(int argc, char* argv[]) {
 
 	try {
+		// Instance to Vulkan Application
+		HelloTriangleApplication app(parseCommandLine(argc, argv));
+
 		// Run the application to initialize and run the Vulkan objects
 		app.run();
 	}
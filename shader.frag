@@ -1,68 +1,188 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// The bindless build indexes the texture array with the material of the object, which may differ between the instances of a draw
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
 // Texture sampler uniform
 layout(binding = 2) uniform sampler2D texSampler;
 
+// Shadow map of the light, sampled with depth comparisons
+layout(binding = 8) uniform sampler2DShadow shadowMap;
+
+#ifdef BINDLESS
+// Textures of all materials, of which only the loaded textures are bound
+layout(binding = 5) uniform sampler2D textures[];
+
+// Material of a mesh
+struct MaterialData {
+	uint textureIndex;
+	uint padding0;
+	uint padding1;
+	uint padding2;
+};
+
+// Storage buffer of the materials, indexed by the material index of the object
+layout(std430, binding = 6) readonly buffer MaterialBuffer {
+	MaterialData materials[];
+} materialBuffer;
+#endif
+
+// Uniform for Lighting Properties
+layout(binding = 1) uniform LightingConstants {
+	vec4 lightPosition;
+	vec4 lightAmbient;
+	vec4 lightDiffuse;
+	vec4 lightSpecular;
+	float ambientIntensity;
+	float specularIntensity;
+	float diffuseIntensity;
+	float lightSpecularExponent;
+	float ambientEnabled;
+	float specularEnabled;
+	float diffuseEnabled;
+	float textureEnabled;
+	vec4 viewLightPosition;
+	uvec4 clusterGrid;
+	vec4 clusterScale;
+	mat4 shadowMatrix;
+	vec4 shadowParams;
+} lighting;
+
+// Sizes of the point light and cluster arrays, matching main.cpp
+#define MAX_POINT_LIGHTS 4096
+#define CLUSTER_COUNT 3456
+
+// Point light, with the position in view space in xyz and the radius of influence in w
+struct PointLight {
+	vec4 position;
+	vec4 colour;
+};
+
+// Storage buffer of the point lights, the offset and no of lights of every cluster, and the light indices of the clusters
+layout(std430, binding = 4) readonly buffer LightClusters {
+	PointLight lights[MAX_POINT_LIGHTS];
+	uvec2 clusters[CLUSTER_COUNT];
+	uint lightIndices[];
+} lightClusters;
+
 // Input values to the fragment
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
-layout(location = 2) in vec4 fragLightVector;
-layout(location = 3) in vec4 fragEyeVector;
-layout(location = 4) in vec3 fragSpecularLighting;
-layout(location = 5) in vec3 fragDiffuseLighting;
-layout(location = 6) in vec3 fragAmbientLighting;
-layout(location = 7) in float fragSpecularCoefficient;
-layout(location = 8) in vec3 fragNormal;
-layout(location = 9) in vec4 stagesInfo;
-layout(location = 10) in float fragSpecularIntensity;
-layout(location = 11) in float fragDiffuseIntensity;
-layout(location = 12) in float fragAmbientIntensity;
-
+layout(location = 2) in vec3 fragEyeVector;
+layout(location = 3) in vec3 fragNormal;
+#ifdef BINDLESS
+layout(location = 4) flat in uint fragMaterialIndex;
+#endif
 
 // Output color of the fragment
 layout(location = 0) out vec4 outColor;
 
+// Lighting stages compiled into the pipeline variant, so the disabled stages cost nothing
+layout(constant_id = 0) const bool ambientEnabled = true;
+layout(constant_id = 1) const bool diffuseEnabled = true;
+layout(constant_id = 2) const bool specularEnabled = true;
+layout(constant_id = 3) const bool textureEnabled = true;
+
+// Function to find the fraction of the light reaching the fragment
+// Filters the comparisons with the shadow map over 3x3 texels, each of which the sampler blends from four texels
+float shadowFactor() {
+	if(lighting.shadowParams.x < 0.5)
+	return 1.0;
+
+	vec4 shadowCoord = lighting.shadowMatrix * vec4(-fragEyeVector, 1.0);
+	shadowCoord.xyz /= shadowCoord.w;
+	if(shadowCoord.w <= 0.0 || shadowCoord.z >= 1.0)
+	return 1.0;
+
+	float lit = 0.0;
+	for(int y = -1; y <= 1; y++)
+	for(int x = -1; x <= 1; x++)
+	lit += texture(shadowMap, vec3(shadowCoord.xy + vec2(x, y) * lighting.shadowParams.y, shadowCoord.z));
+	return lit / 9.0;
+}
+
 void main() {
 	
 	// Calculate ambient component
 	vec4 ambientLight = vec4(0);
-	if(stagesInfo.x > 0.5)
-	ambientLight = vec4(fragAmbientLighting * fragColor,1.0) *  fragAmbientIntensity;
+	if(ambientEnabled)
+	ambientLight = vec4(lighting.lightAmbient.rgb * fragColor,1.0) *  lighting.ambientIntensity;
+
+	// Vector from the fragment to the light, from the light position in view space and the vector to the eye at the origin
+	vec4 lightVector = vec4(lighting.viewLightPosition.xyz + fragEyeVector, 0.0);
 
 	// Normalize the vectors
-	vec4 normEyeVector = normalize(fragEyeVector);
-	vec4 normLightVector = normalize(fragLightVector);
+	vec4 normEyeVector = normalize(vec4(fragEyeVector, 0.0));
+	vec4 normLightVector = normalize(lightVector);
 	vec4 normNormal = vec4(normalize(fragNormal),1.0);
 
 	// Calculate the diffuse component
 	float diffuseDotProduct = dot(normLightVector, normNormal);
 	vec4 diffuseLight = vec4(0);
-	if(stagesInfo.y >0.5)
-	diffuseLight = vec4(fragAmbientLighting * fragColor * diffuseDotProduct,1.0) *  fragDiffuseIntensity;
+	if(diffuseEnabled)
+	diffuseLight = vec4(lighting.lightAmbient.rgb * fragColor * diffuseDotProduct,1.0) *  lighting.diffuseIntensity;
 
 	// Calculate the specular component
 	vec4 halfAngleVector = normalize((normEyeVector + normLightVector)/2.0);
 	float specularDotProduct = dot(halfAngleVector, normNormal);
-	float specularPower = pow(max(0.0f,specularDotProduct), fragSpecularCoefficient);
+	float specularPower = pow(max(0.0f,specularDotProduct), lighting.lightSpecularExponent);
 	vec4 specularLight = vec4(0);
-	if(stagesInfo.z >0.5)
+	if(specularEnabled)
 	
 	{
 	specularPower = min(max(specularPower, 0.0), 1.0);
-	specularLight = vec4( fragSpecularLighting * fragColor * specularPower *  fragSpecularIntensity,1.0) ;
+	specularLight = vec4( lighting.lightSpecular.rgb * fragColor * specularPower *  lighting.specularIntensity,1.0) ;
 	
 	 }
+	// Take out the diffuse and specular light the shadow casters block
+	float shadow = shadowFactor();
+	diffuseLight.rgb *= shadow;
+	specularLight.rgb *= shadow;
+
 	// Calculate the total lighting
 	vec4 lightingColor = ambientLight + diffuseLight + specularLight;
 
+	// Add the point lights of the cluster of the fragment, found from its tile on the screen and the log of its view depth
+	if(lighting.clusterGrid.w > 0u)
+	{
+	float slice = clamp(log(fragEyeVector.z) * lighting.clusterScale.z + lighting.clusterScale.w, 0.0, float(lighting.clusterGrid.z - 1u));
+	uvec2 tile = min(uvec2(gl_FragCoord.xy * lighting.clusterScale.xy), lighting.clusterGrid.xy - 1u);
+	uvec2 cluster = lightClusters.clusters[tile.x + lighting.clusterGrid.x * (tile.y + lighting.clusterGrid.y * uint(slice))];
+	for(uint i = 0u; i < cluster.y; i++)
+	{
+		PointLight light = lightClusters.lights[lightClusters.lightIndices[cluster.x + i]];
+
+		// Smooth falloff reaching zero at the radius of the light
+		vec3 pointLightVector = light.position.xyz + fragEyeVector;
+		float distanceRatio = length(pointLightVector) / light.position.w;
+		float attenuation = clamp(1.0 - distanceRatio * distanceRatio, 0.0, 1.0);
+		attenuation *= attenuation;
+		pointLightVector = normalize(pointLightVector);
+
+		if(diffuseEnabled)
+		lightingColor.rgb += light.colour.rgb * fragColor * max(dot(pointLightVector, normNormal.xyz), 0.0) * attenuation * lighting.diffuseIntensity;
+		if(specularEnabled)
+		{
+		vec3 pointHalfAngleVector = normalize(normEyeVector.xyz + pointLightVector);
+		lightingColor.rgb += light.colour.rgb * fragColor * pow(max(dot(pointHalfAngleVector, normNormal.xyz), 0.0), lighting.lightSpecularExponent) * attenuation * lighting.specularIntensity;
+		}
+	}
+	}
+
 	// Set the lighting color to 1 when there is no lighting to show the texture
 	if(lightingColor == vec4(0))
 	lightingColor = vec4(1);
+#ifdef BINDLESS
+	vec4 textureColor = texture(textures[nonuniformEXT(materialBuffer.materials[fragMaterialIndex].textureIndex)], fragTexCoord);
+#else
 	vec4 textureColor = texture(texSampler, fragTexCoord);
+#endif
 
 	// Set the output color
-	if(stagesInfo.w >0.5)
+	if(textureEnabled)
 	    outColor =min(lightingColor * textureColor,vec4(1.0));
 	else
 	outColor =min(lightingColor ,vec4(1.0));
@@ -8,21 +8,34 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 proj;
 } ubo;
 
-// Uniform for Lighting Properties
-layout(binding = 1) uniform LightingConstants {
-    vec4 lightPosition;
-	vec4 lightAmbient;
-	vec4 lightDiffuse;
-	vec4 lightSpecular;
-	float ambientIntensity;
-	float specularIntensity;
-	float diffuseIntensity;
-	float lightSpecularExponent;
-	float ambientEnabled;
-	float specularEnabled;
-	float diffuseEnabled;
-	float textureEnabled;
-} lighting;
+// Per object data
+struct ObjectData {
+    mat4 model;
+    vec4 tint;
+    vec4 boundingSphere;
+    uint meshIndex;
+    uint materialIndex;
+};
+
+// Storage buffer with the data of every scene object, indexed by the instance index of the draw
+layout(std430, binding = 3) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+// Order the objects are drawn in, mapping the instance index of the draws to the object index
+layout(std430, binding = 7) readonly buffer DrawOrderBuffer {
+    uint objectIndices[];
+} drawOrder;
+
+// Transform and tint of the object being drawn, pushed before the draw when every object is drawn on its own
+layout(push_constant) uniform DrawConstants {
+    mat4 model;
+    vec4 tint;
+    uint materialIndex;
+} draw;
+
+// Source of the object data, compiled into the pipeline: the push constants or the object buffer
+layout(constant_id = 0) const bool pushConstantDraws = false;
 
 // Input values at a vertex
 layout(location = 0) in vec3 inPosition;
@@ -31,47 +44,39 @@ layout(location = 2) in vec3 inTexCoord;
 layout(location = 3) in vec3 normal;
 
 // Output values to fragment shader
+// Only values that vary over the surface are interpolated. The lighting uniform is read by the fragment shader directly
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
-layout(location = 2) out vec4 fragLightVector;
-layout(location = 3) out vec4 fragEyeVector;
-layout(location = 4) out vec4 fragSpecularLighting;
-layout(location = 5) out vec4 fragDiffuseLighting;
-layout(location = 6) out vec4 fragAmbientLighting;
-layout(location = 7) out float fragSpecularCoefficient;
-layout(location = 8) out vec4 fragNormal;
-layout(location = 9) out vec4 stagesInfo;
-layout(location = 10) out float fragSpecularIntensity;
-layout(location = 11) out float fragDiffuseIntensity;
-layout(location = 12) out float fragAmbientIntensity;
+layout(location = 2) out vec3 fragEyeVector;
+layout(location = 3) out vec3 fragNormal;
+layout(location = 4) flat out uint fragMaterialIndex;
+
+// The depth pre-pass computes the position the same way, so the depth of both passes matches exactly
+invariant gl_Position;
 
 // Main function
 void main() {
 	
+	// Combine the scene transform with the placement of the object being drawn
+	uint objectIndex = drawOrder.objectIndices[gl_InstanceIndex];
+	mat4 modelMatrix = ubo.model * (pushConstantDraws ? draw.model : objectBuffer.objects[objectIndex].model);
+
 	// Calculate vertex position
-	vec4 VCS_position =  ubo.view * ubo.model * vec4(inPosition,  1.0);
+	vec4 VCS_position =  ubo.view * modelMatrix * vec4(inPosition,  1.0);
     gl_Position = ubo.proj *VCS_position;
 
-	// Pass out color
-    fragColor = inColor;
+	// Pass out color with the material override of the object
+    fragColor = inColor * (pushConstantDraws ? draw.tint.rgb : objectBuffer.objects[objectIndex].tint.rgb);
+
+	// Pass the material of the object, which selects the texture in bindless mode
+	fragMaterialIndex = pushConstantDraws ? draw.materialIndex : objectBuffer.objects[objectIndex].materialIndex;
 
 	// Pass Texture Coordinates
     fragTexCoord = vec2(inTexCoord.x,inTexCoord.y);
 
 	// Calculate and pass normal
-	fragNormal = ubo.view * ubo.model * vec4(normal,0.0);
-
-	// Calculate vector from light positin to current vertex
-	fragLightVector = ubo.view * lighting.lightPosition - VCS_position;
-
-	// Pass Phong specular, ambient and diffuse values
-	fragSpecularLighting = lighting.lightSpecular;
-	fragDiffuseLighting = lighting.lightDiffuse;
-	fragAmbientLighting = lighting.lightAmbient;
-	fragSpecularCoefficient = lighting.lightSpecularExponent;
-	fragSpecularIntensity = lighting.specularIntensity;
-	fragDiffuseIntensity = lighting.diffuseIntensity;;
-	fragAmbientIntensity = lighting.ambientIntensity;;
-	// Pass stages info specifying which stages are enabled
-	stagesInfo = vec4(lighting.ambientEnabled, lighting.diffuseEnabled, lighting.specularEnabled,lighting.textureEnabled );
+	fragNormal = (ubo.view * modelMatrix * vec4(normal,0.0)).xyz;
+
+	// Calculate vector from current vertex to the eye, which is at the origin of the view space
+	fragEyeVector = -VCS_position.xyz;
 }
\ No newline at end of file